@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2014 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#ifndef __ALBASE_ARENA_H__
+#define __ALBASE_ARENA_H__
+
+#include "albase/common.h"
+
+/** Allocates memory by bumping a pointer, and frees it all at once */
+typedef struct AlArena AlArena;
+
+/**
+ * Create a new arena.
+ * @param[out] arena Pointer to where the new arena pointer will be written
+ * @param blockSize The size of the first block of memory to allocate from
+ */
+AlError al_arena_init(AlArena **arena, size_t blockSize);
+
+/**
+ * Free an arena and all memory allocated from it.
+ */
+void al_arena_free(AlArena *arena);
+
+/**
+ * Allocate a memory block from the arena.
+ * The block is aligned for any of the AlVarType values. If size is 0, the
+ * result is NULL.
+ * @param[out] ptr Pointer to the pointer that the result is written to
+ * @param size The number of bytes to allocate
+ */
+AlError al_arena_alloc(AlArena *arena, void *ptr, size_t size);
+
+/**
+ * Release all memory allocated from the arena for reuse.
+ * If the arena had to grow since it was last reset, its blocks are replaced
+ * by a single block large enough for everything that was allocated, so a
+ * repeated pattern of allocations settles into a single block.
+ */
+void al_arena_reset(AlArena *arena);
+
+#endif
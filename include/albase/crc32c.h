@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2014 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#ifndef __ALBASE_CRC32C_H__
+#define __ALBASE_CRC32C_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Update a CRC32C (Castagnoli) checksum with more bytes.
+ * Uses the SSE4.2 or ARMv8 CRC instructions when the CPU has them.
+ * Start with a crc of 0; checksumming data in pieces gives the same result
+ * as checksumming it all at once.
+ * @param crc The checksum of the preceding bytes
+ * @param ptr The bytes to add
+ * @param size The number of bytes to add
+ * @return The updated checksum
+ */
+uint32_t al_crc32c(uint32_t crc, const void *ptr, size_t size);
+
+#endif
@@ -14,6 +14,7 @@
 #include "stream.h"
 #include "geometry.h"
 #include "vars.h"
+#include "arena.h"
 
 /** Type used to tag groups in the alice data format */
 typedef uint32_t AlDataTag;
@@ -65,20 +66,71 @@ typedef uint32_t AlDataTag;
 typedef enum {
 	/** The start of a group */
 	AL_TOKEN_START = 0xFE,
+	/**
+	 * The start of a group, followed by the size in bytes of the rest of the
+	 * group, including its end token. Reported as AL_TOKEN_START when read.
+	 */
+	AL_TOKEN_SIZED_START = 0xFD,
+	/**
+	 * The start of a group whose end token is followed by a CRC32C of the
+	 * group's bytes. Bytes inside nested checked groups and the sizes of
+	 * sized groups are left out, as they are covered by their own checksum or
+	 * checked when the group ends. Reported as AL_TOKEN_START when read.
+	 */
+	AL_TOKEN_CHECKED_START = 0xFC,
+	/** A sized group that is also checked */
+	AL_TOKEN_SIZED_CHECKED_START = 0xFB,
 	/** The end of a group */
 	AL_TOKEN_END = 0xEF,
 	/** A tag item */
 	AL_TOKEN_TAG = 0xEE,
+	/**
+	 * Stands in for a copy of an earlier group. Followed by the distance back
+	 * from the byte after the token to the earlier group's start token, then
+	 * the earlier group's size including its start token and checksum, both
+	 * as varints. Like the sizes of sized groups, references are left out of
+	 * checksums; the group referred to is checked where it was written.
+	 */
+	AL_TOKEN_REFERENCE = 0xED,
 	/** The end of the AlStream */
 	AL_TOKEN_EOF = 0xFF
 } AlToken;
 
+/**
+ * How the items of an array are stored. The encoding goes in bits 4-6 of the
+ * array's type byte, and encoded arrays are decoded back to their item type
+ * when read, so readers don't need to know how an array was written.
+ */
+typedef enum {
+	/**
+	 * Items are stored the same way as single values, except for strings and
+	 * blobs, which are stored as a varint length for each item followed by
+	 * all of their bytes. Each string's bytes are followed by a NUL.
+	 */
+	AL_DATA_ENCODING_RAW = 0,
+	/** Double components are stored as 32 bit floats. Lossy. */
+	AL_DATA_ENCODING_FLOAT = 1,
+	/**
+	 * Each component is stored as a signed varint of its difference from the
+	 * same component of the previous item. Double components are first
+	 * rounded to a multiple of a scale, which is stored after the length.
+	 */
+	AL_DATA_ENCODING_DELTA = 2,
+	/**
+	 * Double components that are multiples of 0.5 from 0 to 127 are stored in
+	 * a byte, and anything else as 0xFF followed by the double.
+	 */
+	AL_DATA_ENCODING_HALVES = 3
+} AlDataEncoding;
+
 /** A single item from an alice data stream */
 typedef struct {
 	/** Can be an AlToken or an AlVarType */
 	uint8_t type;
 	bool array;
 	union {
+		/** For AL_TOKEN_START, the size of the group, or 0 if not known */
+		uint64_t groupSize;
 		AlDataTag tag;
 		bool boolVal;
 		int32_t intVal;
@@ -96,12 +148,87 @@ typedef struct {
 			void *items;
 			uint64_t length;
 		} array;
+		/** Only reported by al_data_skip_item() */
+		struct {
+			/** Offset of the group referred to */
+			uint64_t offset;
+			uint64_t size;
+		} reference;
 	} value;
 } AlDataItem;
 
+/**
+ * Callbacks for al_data_parse(). Any of them can be NULL to ignore that kind
+ * of item. Returning an error from a callback stops parsing with that error.
+ * Pointers passed to callbacks are only valid until the callback returns.
+ */
+typedef struct {
+	/** groupSize is the size of the group, or 0 if not known */
+	AlError (*startGroup)(void *context, uint64_t groupSize);
+	AlError (*endGroup)(void *context);
+	AlError (*tag)(void *context, AlDataTag tag);
+	/**
+	 * value points to the same type al_data_read_value() writes, so a char *
+	 * for strings and an AlBlob for blobs
+	 */
+	AlError (*value)(void *context, AlVarType type, const void *value);
+	/** Called before the items of an array, even if it's empty */
+	AlError (*arrayStart)(void *context, AlVarType type, uint64_t count);
+	/** Called with the next count items of the current array, decoded */
+	AlError (*arrayChunk)(void *context, AlVarType type, const void *items, uint64_t count);
+} AlDataHandler;
+
 /** Reads and writes streams in the alice data format */
 typedef struct AlData AlData;
 
+/** One of the arrays of an AlDataArray, which fills a member of each item */
+typedef struct {
+	AlVarType type;
+	/** Offset of the member in each item, from offsetof() */
+	size_t offset;
+} AlDataMember;
+
+/**
+ * Describes a struct field that points to an array of items, which is
+ * stored as a group of arrays, one for each member of the items, in order.
+ * The group can end before the last members, which are then left as init
+ * set them.
+ */
+typedef struct {
+	/** Size of each item, from sizeof() */
+	size_t itemSize;
+	/** Offset of a uint64_t in the struct that's set to the number of items */
+	size_t countOffset;
+	/** The members, which can't be strings or blobs */
+	const AlDataMember *members;
+	size_t numMembers;
+	/** If not NULL, called on new items before the arrays are read into them */
+	void (*init)(void *items, uint64_t count);
+} AlDataArray;
+
+/** Binds a tag to a field of a struct, for al_data_read_struct() */
+typedef struct {
+	AlDataTag tag;
+	AlVarType type;
+	/** Offset of the field in the struct, from offsetof() */
+	size_t offset;
+	/**
+	 * If not NULL, the field is a pointer to items, and type is ignored. The
+	 * items are allocated with al_malloc() when read, and the caller frees
+	 * them. Not copied with the field.
+	 */
+	const AlDataArray *array;
+} AlDataField;
+
+/** A table of AlDataFields prepared for fast lookup by tag */
+typedef struct AlDataStruct AlDataStruct;
+
+/** Default size of the buffer used to combine writes to the stream */
+#define AL_DATA_DEFAULT_WRITE_BUFFER_SIZE 16384
+
+/** Default limit on how deeply groups can be nested */
+#define AL_DATA_DEFAULT_MAX_DEPTH 256
+
 /**
  * Create a new AlData object.
  * @param[out] data Pointer to where the new AlData object pointer will be
@@ -112,15 +239,109 @@ AlError al_data_init(AlData **data, AlStream *stream);
 
 /**
  * Free an AlData object. Does not free its stream.
+ * Any buffered output is flushed first, but errors from that cannot be
+ * reported, so call al_data_flush() before freeing after writing.
  */
 void al_data_free(AlData *data);
 
+/**
+ * Write any buffered output to the stream.
+ */
+AlError al_data_flush(AlData *data);
+
+/**
+ * Set the size of the buffer used to combine small writes.
+ * Any buffered output is flushed first. A size of 0 disables buffering, so
+ * every item is written to the stream immediately.
+ * @param size The new buffer size in bytes
+ */
+AlError al_data_set_write_buffer_size(AlData *data, size_t size);
+
+/**
+ * Set an arena for arrays returned by al_data_read_array().
+ * While an arena is set, those arrays are allocated from it rather than with
+ * al_malloc(). They must not be freed, and are valid until the arena is reset
+ * or freed, so the caller can reset it at group or document boundaries.
+ * Values that are only valid until the next read always come from an
+ * internal arena, so reading them does not touch the heap once it has grown
+ * large enough.
+ * @param arena The arena to use, or NULL to use the heap
+ */
+void al_data_set_arena(AlData *data, AlArena *arena);
+
+/**
+ * Set the limit on how deeply groups can be nested.
+ * Reading or skipping a group nested deeper than this is an error, as is
+ * writing one.
+ * @param depth The maximum number of open groups
+ */
+void al_data_set_max_depth(AlData *data, size_t depth);
+
+/**
+ * Set whether groups are written with their size.
+ * Sized groups can be skipped over with a single seek when reading. Groups
+ * that grow larger than the write buffer are completed by seeking back in
+ * the stream, so this is ignored for streams that can't seek. Defaults to
+ * false.
+ * @param sized Whether to write sized groups
+ */
+void al_data_set_sized_groups(AlData *data, bool sized);
+
+/**
+ * Set whether groups are written with a checksum.
+ * Checksums are calculated as the data is written, and verified as it is
+ * read, so a truncated or damaged group is reported as invalid data when
+ * its end is reached. Defaults to false.
+ * @param checksums Whether to write checked groups
+ */
+void al_data_set_checksums(AlData *data, bool checksums);
+
+/**
+ * Set whether groups that repeat an earlier group are written as a reference
+ * to it. Each group is hashed as it ends, and compared with earlier groups of
+ * the same hash, so a copy of every distinct group is kept until the AlData
+ * is freed. Groups match if their bytes match, or if the only differences are
+ * references to the same earlier groups. Only groups that are still in the
+ * write buffer when they end can be replaced, so larger groups are always
+ * written out.
+ * References are followed transparently when reading, but only on streams
+ * that can seek or lend their memory. Defaults to false.
+ * @param deduplicate Whether to replace repeated groups with references
+ */
+void al_data_set_deduplicate(AlData *data, bool deduplicate);
+
+/**
+ * Set whether the checksums of checked groups are verified when reading.
+ * Checked groups have to be read through rather than seeked over to be
+ * verified. Defaults to true.
+ * @param verify Whether to verify checksums
+ */
+void al_data_set_verify(AlData *data, bool verify);
+
 /**
  * Read a single item from the stream.
  * @param[out] item Pointer to where the result will be written
  */
 AlError al_data_read(AlData *data, AlDataItem *item);
 
+/**
+ * Read the next item as al_data_read() does, but skip over the contents of
+ * values and arrays instead of decoding them. Groups are still opened and
+ * closed, and their checksums verified. For arrays, strings and blobs only
+ * the length is set. References are reported as AL_TOKEN_REFERENCE items
+ * rather than followed.
+ * @param[out] item Pointer to where the item will be written
+ */
+AlError al_data_skip_item(AlData *data, AlDataItem *item);
+
+/**
+ * Get the offset of the next byte to be read, from where the AlData started
+ * reading. While reading a group through a reference, this is the offset in
+ * the group referred to, and once the group has ended it is the offset just
+ * after the reference.
+ */
+uint64_t al_data_get_offset(AlData *data);
+
 /**
  * Read and expect the start of a group.
  * Returns an error if the start of a group was not read. If atEnd is not
@@ -155,7 +376,8 @@ AlError al_data_read_value(AlData *data, AlVarType type, void *value, bool *atEn
  * Read an array of an expected type.
  * Returns an error if the item read was not an array of the specified type.
  * If atEnd is not NULL, the end of a group will be accepted and atEnd set to
- * true.
+ * true. Arrays of strings and blobs are returned as a table of char pointers
+ * or AlBlobs in the same allocation as their bytes.
  * @param type The expected type to read
  * @param[out] values Pointer to write the array to
  * @param[out] count Pointer to write the array length to
@@ -163,11 +385,99 @@ AlError al_data_read_value(AlData *data, AlVarType type, void *value, bool *atEn
  */
 AlError al_data_read_array(AlData *data, AlVarType type, void *values, uint64_t *count, bool *atEnd);
 
+/**
+ * Read an array of an expected type without taking ownership of it.
+ * As al_data_read_array(), but the array belongs to the AlData object and is
+ * only valid until the next read. When the stream supports borrowing, arrays
+ * of doubles and vectors point directly into the stream's memory rather than
+ * being copied, as do the strings and blobs of arrays of them.
+ * @param type The expected type to read
+ * @param[out] values Pointer to write the array to
+ * @param[out] count Pointer to write the array length to
+ * @param[out] atEnd If not NULL, set to true if at the end of a group
+ */
+AlError al_data_borrow_array(AlData *data, AlVarType type, const void *values, uint64_t *count, bool *atEnd);
+
+/**
+ * Read the length of an array of an expected type, but not its items.
+ * Use al_data_read_array_into() to read the items once there is somewhere
+ * to put them. If the next read is anything else, the items are skipped.
+ * If atEnd is not NULL, the end of a group will be accepted and atEnd set to
+ * true.
+ * @param type The expected type to read
+ * @param[out] count Pointer to write the array length to
+ * @param[out] atEnd If not NULL, set to true if at the end of a group
+ */
+AlError al_data_read_array_length(AlData *data, AlVarType type, uint64_t *count, bool *atEnd);
+
+/**
+ * Read an array of an expected type directly into caller memory.
+ * Items are written stride bytes apart, so they can be decoded straight
+ * into a field of an array of structs. At most capacity items are written
+ * and any beyond that are skipped. If the length was already read with
+ * al_data_read_array_length(), only the items are read. Arrays of strings
+ * and blobs can't be read this way.
+ * @param type The expected type to read
+ * @param[out] dst Where to write the first item
+ * @param stride The distance in bytes between items in dst
+ * @param capacity The maximum number of items to write to dst
+ * @param[out] count If not NULL, pointer to write the full array length to
+ * @param[out] atEnd If not NULL, set to true if at the end of a group
+ */
+AlError al_data_read_array_into(AlData *data, AlVarType type, void *dst, size_t stride, uint64_t capacity, uint64_t *count, bool *atEnd);
+
 /**
  * Read over items until the end of a group is reached.
  */
 AlError al_data_skip_rest(AlData *data);
 
+/**
+ * Read the rest of the stream, calling handler for each item instead of
+ * returning it. Arrays are passed to the handler in chunks of bounded size,
+ * so any stream can be parsed without holding a whole array in memory.
+ * Arrays of strings and blobs are the exception, and are passed whole.
+ * Stops at the end of the stream.
+ * @param handler The callbacks to call
+ * @param context Passed to each callback
+ */
+AlError al_data_parse(AlData *data, const AlDataHandler *handler, void *context);
+
+/**
+ * Prepare a description of a struct for reading and writing with
+ * al_data_read_struct() and al_data_write_struct().
+ * @param[out] desc Pointer to where the new description will be written
+ * @param fields The fields of the struct, which are copied
+ * @param numFields The number of fields, each of which must have a
+ * different tag
+ */
+AlError al_data_struct_init(AlDataStruct **desc, const AlDataField *fields, size_t numFields);
+
+/**
+ * Free a struct description.
+ */
+void al_data_struct_free(AlDataStruct *desc);
+
+/**
+ * Read a sequence of tagged values until the end of the current group, as
+ * written by al_data_write_struct(), into the fields of a struct. This reads
+ * the same data as a START_READ_TAGS block with a case for each field that
+ * reads one value. Fields whose tags are not found are left unchanged, and
+ * unknown tags are skipped over. Strings and blobs are only valid until the
+ * next read. Array fields must be NULL before reading, and can only be
+ * found once.
+ * @param desc The description of the struct
+ * @param[out] dst The struct to read into
+ */
+AlError al_data_read_struct(AlData *data, const AlDataStruct *desc, void *dst);
+
+/**
+ * Write each field of a struct as a tagged value, or a tagged group of
+ * arrays for array fields, in the order they were described.
+ * @param desc The description of the struct
+ * @param src The struct to write
+ */
+AlError al_data_write_struct(AlData *data, const AlDataStruct *desc, const void *src);
+
 /**
  * Write the start of a group.
  */
@@ -209,11 +519,57 @@ AlError al_data_write_string(AlData *data, const char *value, uint32_t length);
 
 /**
  * Write an array.
- * Arrays of strings or blobs are not supported.
+ * Strings are passed as an array of char pointers and blobs as an array of
+ * AlBlobs. strlen() is used to find the length of strings.
  * @param type The type of the values in the array
  * @param values Pointer to the start of the array
  * @param count The length of the array
  */
 AlError al_data_write_array(AlData *data, AlVarType type, const void *values, uint64_t count);
 
+/**
+ * Write an array whose items are spaced out in memory.
+ * Encoded exactly as al_data_write_array(), but the items are taken stride
+ * bytes apart, so they can come straight from a field of an array of structs.
+ * @param type The type of the values in the array
+ * @param values Pointer to the first value
+ * @param stride The distance in bytes between values
+ * @param count The length of the array
+ */
+AlError al_data_write_array_strided(AlData *data, AlVarType type, const void *values, size_t stride, uint64_t count);
+
+/**
+ * Write an array with a compact encoding.
+ * Arrays of bools can only be raw, and arrays of ints can also be
+ * AL_DATA_ENCODING_DELTA, for which the scale is ignored.
+ * @param type The type of the values in the array
+ * @param encoding How the values are stored
+ * @param scale For AL_DATA_ENCODING_DELTA, the step doubles are rounded to
+ * @param values Pointer to the first value
+ * @param stride The distance in bytes between values
+ * @param count The length of the array
+ */
+AlError al_data_write_array_encoded(AlData *data, AlVarType type, AlDataEncoding encoding, double scale, const void *values, size_t stride, uint64_t count);
+
+/**
+ * Start writing an array whose items are passed in pieces, so the whole
+ * array never needs to be in memory. Items written with
+ * al_data_write_array_items() must add up to count before anything else is
+ * written. Arrays of strings and blobs can't be written this way.
+ * @param type The type of the values in the array
+ * @param encoding How the values are stored
+ * @param scale For AL_DATA_ENCODING_DELTA, the step doubles are rounded to
+ * @param count The length of the array
+ */
+AlError al_data_write_array_start(AlData *data, AlVarType type, AlDataEncoding encoding, double scale, uint64_t count);
+
+/**
+ * Write some of the items of an array started with
+ * al_data_write_array_start().
+ * @param values Pointer to the first value
+ * @param stride The distance in bytes between values
+ * @param count The number of values to write
+ */
+AlError al_data_write_array_items(AlData *data, const void *values, size_t stride, uint64_t count);
+
 #endif
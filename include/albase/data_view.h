@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2014 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#ifndef __ALBASE_DATA_VIEW_H__
+#define __ALBASE_DATA_VIEW_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "albase/common.h"
+#include "albase/data.h"
+#include "albase/stream.h"
+
+/**
+ * An index over alice data held in memory, so that items can be found
+ * directly rather than by reading from the start.
+ */
+typedef struct AlDataView AlDataView;
+
+/** An item in an AlDataView */
+typedef uint32_t AlDataNode;
+
+/** The node for the whole buffer, whose children are its top level items */
+#define AL_DATA_ROOT_NODE ((AlDataNode)0)
+
+/** Returned when a node isn't found */
+#define AL_DATA_NO_NODE ((AlDataNode)UINT32_MAX)
+
+/**
+ * Index alice data in memory, reading it through once. The memory must stay
+ * valid until the view is freed. A reference to an earlier group is a node
+ * with that group's tag and children, though the children's parent is still
+ * the earlier group.
+ * @param[out] view Pointer to where the new view will be written
+ * @param ptr The start of the data
+ * @param size The size of the data in bytes
+ */
+AlError al_data_view_open(AlDataView **view, const void *ptr, size_t size);
+
+/**
+ * Free a view. Does not free the memory it indexes.
+ */
+void al_data_view_free(AlDataView *view);
+
+/**
+ * Get the number of items in a group. The tag at the start of a tagged group
+ * is not counted, see al_data_view_get_tag().
+ */
+size_t al_data_view_get_num_children(AlDataView *view, AlDataNode node);
+
+/**
+ * Get an item in a group by its position, or AL_DATA_NO_NODE if there aren't
+ * that many.
+ * @param index The position of the item, starting at 0
+ */
+AlDataNode al_data_view_get_child(AlDataView *view, AlDataNode node, size_t index);
+
+/**
+ * Find the first tagged group in a group with a tag, or AL_DATA_NO_NODE if
+ * there isn't one.
+ */
+AlDataNode al_data_view_find_tag(AlDataView *view, AlDataNode node, AlDataTag tag);
+
+/**
+ * Find a group by following a path of tags from node, as
+ * al_data_view_find_tag() does for each one.
+ * @param tags The tags to follow
+ * @param numTags The number of tags
+ */
+AlDataNode al_data_view_find_path(AlDataView *view, AlDataNode node, const AlDataTag *tags, size_t numTags);
+
+/**
+ * Get the group containing a node, or AL_DATA_NO_NODE for the root.
+ */
+AlDataNode al_data_view_get_parent(AlDataView *view, AlDataNode node);
+
+/**
+ * Get the tag of a tagged group, or AL_NO_TAG if it has none.
+ */
+AlDataTag al_data_view_get_tag(AlDataView *view, AlDataNode node);
+
+/**
+ * Get the type of an item: AL_TOKEN_START for groups, AL_TOKEN_TAG for tags
+ * that don't start a group, or the AlVarType of a value or array.
+ * @param[out] array If not NULL, set to whether the item is an array
+ */
+uint8_t al_data_view_get_type(AlDataView *view, AlDataNode node, bool *array);
+
+/**
+ * Get the bytes of an item, from its type byte to the end of its value, or
+ * for a group to the end of its checksum.
+ * For a reference, these are the bytes of the group it refers to.
+ * @param[out] size Pointer to where the size in bytes will be written
+ */
+const void *al_data_view_get_bytes(AlDataView *view, AlDataNode node, size_t *size);
+
+/**
+ * Create a stream that reads the bytes of an item, so it can be read with an
+ * AlData as if it started the stream. The data before the item can still be
+ * seeked back to, so references in the item can be followed.
+ * @param[out] stream Pointer to where the new stream will be written
+ */
+AlError al_data_view_init_stream(AlDataView *view, AlDataNode node, AlStream **stream);
+
+#endif
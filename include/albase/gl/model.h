@@ -20,9 +20,18 @@ struct AlModel {
 
 	int numPaths;
 	GLuint vertexBuffer;
+	/** Where each path's vertices start in the buffer */
+	int *vertexStarts;
 	int *vertexCounts;
 	Vec3 *colours;
 
+	/** The paths last built, and their generations then, to find changed paths */
+	AlModelPath **paths;
+	unsigned int *generations;
+	/** Vertices reserved for each path, with room to grow once the model's been edited */
+	int *vertexCapacities;
+	bool built;
+
 	Box2 bounds;
 };
 
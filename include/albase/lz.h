@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2014 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#ifndef __ALBASE_LZ_H__
+#define __ALBASE_LZ_H__
+
+#include <stddef.h>
+
+#include "albase/common.h"
+
+/**
+ * Compress a block of memory with a small LZ77 codec.
+ * Each block is self-contained, and is decoded with al_lz_decompress().
+ * @param src The bytes to compress
+ * @param srcSize The number of bytes to compress
+ * @param[out] dst Where to write the compressed bytes
+ * @param dstCapacity The size of dst
+ * @return The size of the compressed data, or 0 if it doesn't fit in
+ * dstCapacity bytes
+ */
+size_t al_lz_compress(const void *src, size_t srcSize, void *dst, size_t dstCapacity);
+
+/**
+ * Decompress a block written by al_lz_compress().
+ * Malformed input is detected and reported as AL_ERROR_INVALID_DATA rather
+ * than reading or writing out of bounds.
+ * @param src The compressed bytes
+ * @param srcSize The number of compressed bytes
+ * @param[out] dst Where to write the decompressed bytes
+ * @param dstSize The exact size of the decompressed data
+ */
+AlError al_lz_decompress(const void *src, size_t srcSize, void *dst, size_t dstSize);
+
+#endif
@@ -15,6 +15,14 @@ struct AlModel;
 typedef struct AlModel AlModel;
 
 AlError al_model_use_file(AlModel **model, const char *filename);
+
+/**
+ * Set the pack that models are loaded from when their filename starts with
+ * AL_PACK_PREFIX, replacing any previous one. Models already loaded aren't
+ * affected. Also available from Lua as Model.set_pack().
+ * @param filename The pack file to open, or NULL to just close the current one
+ */
+AlError al_model_set_pack(const char *filename);
 AlError al_model_use_shape(AlModel **model, AlModelShape *shape);
 AlError al_model_set_shape(AlModel *model, AlModelShape *shape);
 void al_model_unuse(AlModel *model);
@@ -27,8 +27,25 @@ void al_model_systems_free(void);
 AlError al_model_shape_init(AlModelShape **shape);
 void al_model_shape_free(AlModelShape *shape);
 
+/** How al_model_shape_save_with_options() writes a shape */
+typedef struct {
+	/**
+	 * If positive, point locations are rounded to a multiple of this and
+	 * stored as deltas, and curve biases stored in a byte where possible
+	 */
+	double precision;
+	/** Whether paths that repeat an earlier path are saved as references to it */
+	bool deduplicate;
+	/**
+	 * Whether to save the shape as a compressed stream, which loading
+	 * detects. The whole shape is built in memory first.
+	 */
+	bool compressed;
+} AlModelShapeSaveOptions;
+
 AlError al_model_shape_load(AlModelShape *shape, AlStream *stream);
 AlError al_model_shape_save(AlModelShape *shape, AlStream *stream);
+AlError al_model_shape_save_with_options(AlModelShape *shape, AlStream *stream, const AlModelShapeSaveOptions *options);
 
 AlModelPath *const *al_model_shape_get_paths(AlModelShape *shape, int *numPaths);
 AlError al_model_shape_add_path(AlModelShape *shape, int index, AlModelPoint start, AlModelPoint end);
@@ -36,6 +53,13 @@ AlError al_model_shape_remove_path(AlModelShape *shape, int index);
 
 Vec3 al_model_path_get_colour(AlModelPath *path);
 void al_model_path_set_colour(AlModelPath *path, Vec3 colour);
+/**
+ * Note that a path's points have changed, so models built from it rebuild
+ * it on their next al_model_set_shape(). The functions here do this
+ * themselves; it's only needed after changing the points returned by
+ * al_model_path_get_points().
+ */
+void al_model_path_changed(AlModelPath *path);
 AlModelPoint *al_model_path_get_points(AlModelPath *path, int *numPoints);
 AlError al_model_path_add_point(AlModelPath *path, int index, AlModelPoint point);
 AlError al_model_path_remove_point(AlModelPath *path, int index);
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2014 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#ifndef __ALBASE_PACK_H__
+#define __ALBASE_PACK_H__
+
+#include <stddef.h>
+
+#include "albase/common.h"
+#include "albase/stream.h"
+#include "albase/vars.h"
+
+/**
+ * Many named documents in one file, each found through a directory at the
+ * start of the file rather than by opening a file of its own.
+ */
+typedef struct AlPack AlPack;
+
+/** Prefix for filenames that name a document in a pack */
+#define AL_PACK_PREFIX "pack:"
+
+/**
+ * Open a pack file. The whole file is mapped, and the directory read and
+ * indexed, so documents can be found without further reads.
+ * @param[out] pack Pointer to where the new pack will be written
+ * @param filename The pack file to open
+ */
+AlError al_pack_open(AlPack **pack, const char *filename);
+
+/**
+ * Close a pack. Streams opened from it must already have been freed.
+ */
+void al_pack_free(AlPack *pack);
+
+/**
+ * Get the number of documents in a pack.
+ */
+size_t al_pack_get_num_documents(AlPack *pack);
+
+/**
+ * Get the name of a document.
+ * @param index The position of the document in the pack
+ */
+const char *al_pack_get_name(AlPack *pack, size_t index);
+
+/**
+ * Open a stream that reads a document straight out of the pack's memory.
+ * The document's checksum is checked first.
+ * @param name The name of the document
+ * @param[out] stream Pointer to where the new stream will be written
+ */
+AlError al_pack_init_stream(AlPack *pack, const char *name, AlStream **stream);
+
+/**
+ * Write a pack.
+ * Documents are stored as given, after a directory of their names, sizes
+ * and checksums.
+ * @param stream The stream to write to
+ * @param names The name of each document, which must all be different
+ * @param documents The contents of each document
+ * @param count The number of documents
+ */
+AlError al_pack_write(AlStream *stream, const char *const *names, const AlBlob *documents, size_t count);
+
+#endif
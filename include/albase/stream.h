@@ -9,6 +9,7 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "albase/common.h"
 
@@ -29,9 +30,28 @@ struct AlStream {
 	const char *name;
 	AlError (*read)(AlStream *stream, void *ptr, size_t size, size_t *bytesRead);
 	AlError (*write)(AlStream *stream, const void *ptr, size_t size);
-	AlError (*seek)(AlStream *stream, long offset, AlSeekPos whence);
-	AlError (*tell)(AlStream *stream, long *offset);
+	/**
+	 * May be NULL if the stream can only be written in order. Offsets are
+	 * 64-bit on every platform, so streams can be larger than 2 GB even where
+	 * long is 32 bits.
+	 */
+	AlError (*seek)(AlStream *stream, int64_t offset, AlSeekPos whence);
+	AlError (*tell)(AlStream *stream, int64_t *offset);
 	void (*free)(AlStream *stream);
+
+	/**
+	 * Optional. Get a pointer to the next size bytes of the stream without
+	 * copying them, and advance past them. The memory stays valid until the
+	 * stream is freed. As with read, a short result is only accepted if
+	 * bytesBorrowed is not NULL.
+	 */
+	AlError (*borrow)(AlStream *stream, size_t size, const void **ptr, size_t *bytesBorrowed);
+
+	/**
+	 * Optional. Write out anything the stream is holding back. Streams also
+	 * do this when they're freed, but can't report errors then.
+	 */
+	AlError (*flush)(AlStream *stream);
 };
 
 typedef struct {
@@ -45,8 +65,145 @@ AlError al_stream_init_filename(AlStream **stream, const char *filename, AlOpenM
 AlError al_stream_init_file(AlStream **stream, FILE *file, bool closeFile, const char *name);
 AlError al_stream_init_mem(AlStream **stream, void *ptr, size_t size, bool freePtr, const char *name);
 AlMemStream al_stream_init_mem_stack(const void *ptr, size_t size, const char *name);
+AlError al_stream_init_mmap(AlStream **stream, const char *filename);
+
+/** Size of the buffer a growable memory stream starts with, if not given */
+#define AL_STREAM_DEFAULT_MEM_RESERVE 4096
+
+/**
+ * Create a stream that writes into memory, doubling its buffer whenever it
+ * runs out of room. It can seek anywhere in what has been written, so sized
+ * groups can be patched, and can be read back like any memory stream.
+ * @param[out] stream Pointer to where the new stream pointer will be written
+ * @param reserve Size of the buffer to start with, or 0 for the default
+ * @param name Name for the stream, copied, or NULL
+ */
+AlError al_stream_init_mem_writer(AlStream **stream, size_t reserve, const char *name);
+
+/**
+ * Take the buffer of a stream made by al_stream_init_mem_writer() without
+ * copying it. The caller frees it with al_free(). The stream is left empty,
+ * and can be written to again.
+ * @param[out] ptr Set to the buffer, or NULL if nothing has been written
+ * @param[out] size Set to the number of bytes written
+ */
+AlError al_stream_detach_mem(AlStream *stream, void **ptr, size_t *size);
+
+/** The bytes that start a compressed stream */
+#define AL_STREAM_COMPRESSED_MAGIC "ALZ1"
+
+/** Amount of data compressed together when writing a compressed stream */
+#define AL_STREAM_COMPRESSED_BLOCK_SIZE 65536
+
+/**
+ * Wrap a stream so that data is compressed as it's written, or decompressed
+ * as it's read. Data is compressed in blocks that can each be decompressed
+ * on their own, so seeking when reading only decompresses the block that
+ * is seeked to. When writing, the stream can't seek, and the last block is
+ * written by al_stream_flush(), or when the stream is freed.
+ * @param[out] stream Pointer to where the new stream pointer will be written
+ * @param wrapped The stream the compressed data is read from or written to
+ * @param mode Whether to read or write
+ * @param freeStream Whether to free the wrapped stream with this one
+ */
+AlError al_stream_init_compressed(AlStream **stream, AlStream *wrapped, AlOpenMode mode, bool freeStream);
+
+/**
+ * Check whether a stream being read starts with AL_STREAM_COMPRESSED_MAGIC,
+ * and if so replace it with a stream that decompresses it, which frees the
+ * original when it's freed. Otherwise the stream is left where it was. The
+ * stream must be able to seek back over the bytes checked.
+ * @param[in,out] stream The stream to check, replaced if it's compressed
+ */
+AlError al_stream_detect_compressed(AlStream **stream);
+
+/** Size of the blocks a prefetching stream reads, if not given */
+#define AL_STREAM_PREFETCH_BLOCK_SIZE (256 * 1024)
+
+/** Number of blocks a prefetching stream reads ahead, if not given */
+#define AL_STREAM_PREFETCH_BLOCKS 4
+
+/**
+ * Wrap a stream for reading so that a thread reads ahead of what has been
+ * used, keeping a ring of blocks filled. Parsing then overlaps with waiting
+ * on the device, which matters most on slow storage. Seeks within the block
+ * being read are cheap; others wait for the thread's read to finish and
+ * start reading ahead again from the new position. The wrapped stream
+ * mustn't be used while this one exists, and is left positioned after what
+ * was read when this one is freed.
+ * @param[out] stream Pointer to where the new stream pointer will be written
+ * @param wrapped The stream to read from
+ * @param blockSize Size of each read of the wrapped stream, or 0 for the
+ * default
+ * @param numBlocks Number of blocks to read ahead, or 0 for the default
+ * @param freeStream Whether to free the wrapped stream with this one
+ */
+AlError al_stream_init_prefetch(AlStream **stream, AlStream *wrapped, size_t blockSize, size_t numBlocks, bool freeStream);
+
+/** Calls made to one stream operation, and the time spent in them */
+typedef struct {
+	uint64_t calls;
+	uint64_t bytes;
+	double seconds;
+} AlStreamCounter;
+
+typedef struct {
+	AlStreamCounter read;
+	AlStreamCounter write;
+	AlStreamCounter seek;
+	AlStreamCounter tell;
+	AlStreamCounter borrow;
+} AlStreamStats;
+
+/**
+ * Wrap a stream so that calls to it are counted and timed. The counts are
+ * also added to totals for all counted streams, which are available from
+ * Lua as streams.get_stats().
+ * @param[out] stream Pointer to where the new stream pointer will be written
+ * @param wrapped The stream to pass calls on to
+ * @param dump Whether to log the counts when the stream is freed
+ * @param freeStream Whether to free the wrapped stream with this one
+ */
+AlError al_stream_init_counted(AlStream **stream, AlStream *wrapped, bool dump, bool freeStream);
+
+/**
+ * Get the counts of a stream made by al_stream_init_counted().
+ */
+AlError al_stream_get_stats(AlStream *stream, AlStreamStats *stats);
+
+/**
+ * Get the counts of all counted streams, including freed ones. Safe to call
+ * while streams are in use on other threads.
+ */
+void al_stream_get_total_stats(AlStreamStats *stats);
+
+/**
+ * Set whether streams opened by al_stream_init_filename_counted() are
+ * counted, with their counts logged when they're freed. Defaults to false.
+ * Also available from Lua as streams.set_counting().
+ */
+void al_stream_set_counting(bool counting);
+bool al_stream_get_counting(void);
+
+/**
+ * Open a file as al_stream_init_filename() does, wrapped in a counted stream
+ * if counting has been turned on with al_stream_set_counting().
+ */
+AlError al_stream_init_filename_counted(AlStream **stream, const char *filename, AlOpenMode mode);
+
+/**
+ * Map a file as al_stream_init_mmap() does, wrapped in a counted stream if
+ * counting has been turned on.
+ */
+AlError al_stream_init_mmap_counted(AlStream **stream, const char *filename);
 
 void al_stream_free(AlStream *stream);
+
+/**
+ * Write out anything the stream is holding back, if it holds anything back.
+ * Call this when done writing, so errors aren't lost when it's freed.
+ */
+AlError al_stream_flush(AlStream *stream);
 AlError al_stream_read_to_string(AlStream *stream, char **string, size_t *size);
 AlError al_read_file_to_string(const char *filename, char **string);
 
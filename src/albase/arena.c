@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2014 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include <stdint.h>
+
+#include "albase/arena.h"
+
+#define ALIGNMENT 16
+
+typedef struct Block {
+	struct Block *next;
+	size_t size;
+	size_t used;
+} Block;
+
+struct AlArena {
+	size_t blockSize;
+	Block *blocks;
+};
+
+static uint8_t *block_start(Block *block)
+{
+	uintptr_t start = (uintptr_t)(block + 1);
+	return (uint8_t *)((start + ALIGNMENT - 1) & ~(uintptr_t)(ALIGNMENT - 1));
+}
+
+static void free_blocks(Block *block)
+{
+	while (block) {
+		Block *next = block->next;
+		al_free(block);
+		block = next;
+	}
+}
+
+AlError al_arena_init(AlArena **result, size_t blockSize)
+{
+	BEGIN()
+
+	AlArena *arena = NULL;
+	TRY(al_malloc(&arena, sizeof(AlArena)));
+
+	arena->blockSize = blockSize;
+	arena->blocks = NULL;
+
+	*result = arena;
+
+	PASS()
+}
+
+void al_arena_free(AlArena *arena)
+{
+	if (arena) {
+		free_blocks(arena->blocks);
+		al_free(arena);
+	}
+}
+
+AlError al_arena_alloc(AlArena *arena, void *ptr, size_t size)
+{
+	BEGIN()
+
+	void *result = NULL;
+
+	if (size > 0) {
+		size_t aligned = (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+		Block *block = arena->blocks;
+
+		if (aligned < size || aligned > SIZE_MAX - sizeof(Block) - ALIGNMENT) {
+			al_log_error("arena allocation for %zuB too large", size);
+			THROW(AL_ERROR_MEMORY);
+		}
+
+		if (!block || block->size - block->used < aligned) {
+			size_t blockSize = (aligned > arena->blockSize) ? aligned : arena->blockSize;
+
+			TRY(al_malloc(&block, sizeof(Block) + ALIGNMENT + blockSize));
+			block->next = arena->blocks;
+			block->size = blockSize;
+			block->used = 0;
+			arena->blocks = block;
+		}
+
+		result = block_start(block) + block->used;
+		block->used += aligned;
+	}
+
+	*(void **)ptr = result;
+
+	PASS()
+}
+
+void al_arena_reset(AlArena *arena)
+{
+	Block *block = arena->blocks;
+
+	if (block && block->next) {
+		size_t total = 0;
+		for (Block *b = block; b; b = b->next) {
+			total += b->used;
+		}
+
+		if (total > arena->blockSize) {
+			arena->blockSize = total;
+		}
+
+		free_blocks(block);
+		arena->blocks = NULL;
+
+	} else if (block) {
+		block->used = 0;
+	}
+}
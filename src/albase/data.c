@@ -4,21 +4,200 @@
  * See COPYING for details.
  */
 
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #include "albase/data.h"
+#include "albase/arena.h"
+#include "albase/crc32c.h"
 
 const uint32_t NO_LENGTH = UINT32_MAX;
 
-#define data_read(data, ptr, size) (data)->stream->read((data)->stream, (ptr), (size), NULL)
-#define data_write(data, ptr, size) (data)->stream->write((data)->stream, (ptr), (size))
-#define data_seek(data, offset, whence) (data)->stream->seek((data)->stream, (offset), (whence))
+#define READ_BUFFER_SIZE 8192
+#define SCRATCH_BLOCK_SIZE 4096
+
+/** Marks a group on the group stack that was not written with its size */
+#define UNSIZED_GROUP UINT64_MAX
+
+/** Marks that no group is having its checksum calculated */
+#define NO_GROUP SIZE_MAX
+
+/** Magnitude that quantized components must stay below, so deltas fit */
+#define QUANTIZED_LIMIT 4611686018427387904.0
+
+/** Byte marking a raw double in an AL_DATA_ENCODING_HALVES array */
+#define HALVES_ESCAPE 0xFF
+
+/** Multiplier for hashing tags into the slots of an AlDataStruct */
+#define TAG_HASH 2654435761u
+
+/** Largest chunk in bytes that al_data_parse() passes array items in */
+#define PARSE_CHUNK_SIZE 4096
+
+typedef struct {
+	/**
+	 * For reading, the offset of the end of a sized group; for writing, the
+	 * offset of a sized group's length field
+	 */
+	uint64_t offset;
+	bool checked;
+	uint32_t crc;
+	/** The group whose checksum was being calculated when this was opened */
+	size_t outerHashGroup;
+	/** For writing, the offset of the group's start token */
+	uint64_t start;
+	/**
+	 * For writing, the checksum of the group in outerHashGroup before this
+	 * group started, so it can be put back if the group is replaced
+	 */
+	uint32_t outerCrc;
+} Group;
+
+/** A group that has been written, which later copies can refer to */
+typedef struct {
+	uint64_t offset;
+	size_t size;
+	uint32_t hash;
+	/**
+	 * The group's bytes, with any references in it giving the offset they
+	 * refer to, so copies that refer to the same groups from elsewhere match
+	 */
+	uint8_t *key;
+	size_t keySize;
+	/** The group's slot in the hash table, so it can be removed */
+	size_t slot;
+} WrittenGroup;
+
+/** A reference that has been written, while the groups around it are open */
+typedef struct {
+	uint64_t offset;
+	uint64_t target;
+	uint64_t size;
+	size_t length;
+} WrittenReference;
+
+/** Where reading had got to when a reference was followed */
+typedef struct {
+	const uint8_t *readCur;
+	const uint8_t *readEnd;
+	const uint8_t *readHashed;
+	uint64_t readOffset;
+	bool readBorrowed;
+	size_t hashGroup;
+	/** Groups that were open, so the referred group's end can be found */
+	size_t numGroups;
+} Reference;
+
+/** A referred group copied out of a stream that can't lend its memory */
+typedef struct {
+	uint64_t offset;
+	size_t size;
+	uint8_t *bytes;
+} CachedGroup;
+
+struct AlDataStruct {
+	AlDataField *fields;
+	size_t numFields;
+	/** Hash table of indexes into fields plus one, or 0 for empty slots */
+	size_t *slots;
+	int slotBits;
+};
 
 struct AlData {
 	AlStream *stream;
 	bool eof;
-	void *temp;
+
+	/** Holds values that are only valid until the next read */
+	AlArena *scratch;
+	/** Caller's arena for arrays returned by al_data_read_array() */
+	AlArena *arena;
+	bool readOwned;
+
+	/** An array whose length has been read, but not its items */
+	bool arrayPending;
+	AlVarType pendingType;
+	AlDataEncoding pendingEncoding;
+	double pendingScale;
+	uint64_t pendingCount;
+
+	uint8_t *readBuffer;
+	const uint8_t *readCur;
+	const uint8_t *readEnd;
+	bool readBorrowed;
+	/** Offset of readEnd from where the AlData started reading */
+	uint64_t readOffset;
+	/** Position in the stream where reading started, or -1 if not yet needed */
+	int64_t readStart;
+	/** Bytes before this have been added to the checksum */
+	const uint8_t *readHashed;
+	bool verify;
+	/** The start of memory lent by the stream, and its offset */
+	const uint8_t *borrowStart;
+	uint64_t borrowOffset;
+
+	/** References being followed, innermost last */
+	Reference *references;
+	size_t numReferences;
+	size_t referencesLength;
+
+	/** Groups that have been referred to, and a hash table of them by offset */
+	CachedGroup *cached;
+	size_t numCached;
+	size_t cachedLength;
+	/** Indexes into cached plus one, or 0 for empty slots */
+	size_t *cachedSlots;
+	int cachedSlotBits;
+
+	size_t writeBufferSize;
+	uint8_t *writeBuffer;
+	uint8_t *writeCur;
+	uint8_t *writeEnd;
+	/** Number of bytes handed to the stream so far */
+	uint64_t writeOffset;
+	/** Bytes in the write buffer before this have been added to the checksum */
+	uint8_t *writeHashed;
+	bool writeSized;
+	bool writeChecked;
+
+	/** Items still to be written of an array started in pieces */
+	uint64_t writePendingCount;
+	AlVarType writePendingType;
+	AlDataEncoding writePendingEncoding;
+	double writePendingScale;
+	/** The last values written to a delta encoded array */
+	int64_t writePendingPrevious[4];
+
+	/** Groups written so far, in order, and a hash table of them by contents */
+	bool writeDeduplicate;
+	WrittenGroup *written;
+	size_t numWritten;
+	size_t writtenLength;
+	/** Indexes into written plus one, or 0 for empty slots */
+	size_t *writtenSlots;
+	int writtenSlotBits;
+	/** References written inside the groups still open */
+	WrittenReference *writeReferences;
+	size_t numWriteReferences;
+	size_t writeReferencesLength;
+	uint8_t *writeKey;
+	size_t writeKeyLength;
+
+	Group *groups;
+	size_t numGroups;
+	size_t groupsLength;
+	size_t maxDepth;
+	/**
+	 * The innermost checked group, which the bytes being read or written
+	 * are added to the checksum of
+	 */
+	size_t hashGroup;
 };
 
 AlError al_data_init(AlData **result, AlStream *stream)
@@ -30,7 +209,59 @@ AlError al_data_init(AlData **result, AlStream *stream)
 
 	data->stream = stream;
 	data->eof = false;
-	data->temp = NULL;
+	data->scratch = NULL;
+	data->arena = NULL;
+	data->readOwned = false;
+	data->arrayPending = false;
+
+	data->readBuffer = NULL;
+	data->readCur = NULL;
+	data->readEnd = NULL;
+	data->readBorrowed = false;
+	data->readOffset = 0;
+	data->readStart = -1;
+	data->readHashed = NULL;
+	data->verify = true;
+	data->borrowStart = NULL;
+	data->borrowOffset = 0;
+
+	data->references = NULL;
+	data->numReferences = 0;
+	data->referencesLength = 0;
+
+	data->cached = NULL;
+	data->numCached = 0;
+	data->cachedLength = 0;
+	data->cachedSlots = NULL;
+	data->cachedSlotBits = 0;
+
+	data->writeBufferSize = AL_DATA_DEFAULT_WRITE_BUFFER_SIZE;
+	data->writeBuffer = NULL;
+	data->writeCur = NULL;
+	data->writeEnd = NULL;
+	data->writeOffset = 0;
+	data->writeHashed = NULL;
+	data->writeSized = false;
+	data->writeChecked = false;
+	data->writePendingCount = 0;
+
+	data->writeDeduplicate = false;
+	data->written = NULL;
+	data->numWritten = 0;
+	data->writtenLength = 0;
+	data->writtenSlots = NULL;
+	data->writtenSlotBits = 0;
+	data->writeReferences = NULL;
+	data->numWriteReferences = 0;
+	data->writeReferencesLength = 0;
+	data->writeKey = NULL;
+	data->writeKeyLength = 0;
+
+	data->groups = NULL;
+	data->numGroups = 0;
+	data->groupsLength = 0;
+	data->maxDepth = AL_DATA_DEFAULT_MAX_DEPTH;
+	data->hashGroup = NO_GROUP;
 
 	*result = data;
 
@@ -40,38 +271,473 @@ AlError al_data_init(AlData **result, AlStream *stream)
 void al_data_free(AlData *data)
 {
 	if (data) {
-		al_free(data->temp);
+		// Where the stream was being read, outside of any references
+		Reference *outer = data->numReferences ? &data->references[0] : NULL;
+		const uint8_t *readCur = outer ? outer->readCur : data->readCur;
+		const uint8_t *readEnd = outer ? outer->readEnd : data->readEnd;
+
+		if (readCur != readEnd && data->stream->seek) {
+			// Leave the stream positioned after the last item actually read
+			int64_t unread = readEnd - readCur;
+			data->stream->seek(data->stream, -unread, AL_SEEK_CUR);
+		}
+
+		al_data_flush(data);
+
+		for (size_t i = 0; i < data->numCached; i++) {
+			al_free(data->cached[i].bytes);
+		}
+
+		for (size_t i = 0; i < data->numWritten; i++) {
+			al_free(data->written[i].key);
+		}
+
+		al_free(data->readBuffer);
+		al_free(data->writeBuffer);
+		al_free(data->references);
+		al_free(data->cached);
+		al_free(data->cachedSlots);
+		al_free(data->written);
+		al_free(data->writtenSlots);
+		al_free(data->writeReferences);
+		al_free(data->writeKey);
+		al_free(data->groups);
+		al_arena_free(data->scratch);
 		al_free(data);
 	}
 }
 
+static inline void hash_bytes(AlData *data, const void *ptr, size_t size)
+{
+	if (data->hashGroup != NO_GROUP && size > 0) {
+		Group *group = &data->groups[data->hashGroup];
+		group->crc = al_crc32c(group->crc, ptr, size);
+	}
+}
+
+/**
+ * Add the bytes read since the last call to the checksum of the innermost
+ * checked group. Called before the read buffer is replaced, and whenever
+ * the innermost checked group changes.
+ */
+static inline void hash_read(AlData *data)
+{
+	hash_bytes(data, data->readHashed, data->readCur - data->readHashed);
+	data->readHashed = data->readCur;
+}
+
+/**
+ * Add the bytes written since the last call to the checksum of the innermost
+ * checked group.
+ */
+static inline void hash_write(AlData *data)
+{
+	hash_bytes(data, data->writeHashed, data->writeCur - data->writeHashed);
+	data->writeHashed = data->writeCur;
+}
+
+/**
+ * Refill the read buffer from the stream. Any unread bytes in the buffer are
+ * discarded.
+ */
+static AlError fill_buffer(AlData *data, size_t *bytesRead)
+{
+	BEGIN()
+
+	if (!data->readBuffer) {
+		TRY(al_malloc(&data->readBuffer, READ_BUFFER_SIZE));
+	}
+
+	hash_read(data);
+
+	size_t n;
+	TRY(data->stream->read(data->stream, data->readBuffer, READ_BUFFER_SIZE, &n));
+	data->readOffset += n;
+	data->readCur = data->readBuffer;
+	data->readEnd = data->readBuffer + n;
+	data->readHashed = data->readCur;
+	data->readBorrowed = false;
+
+	*bytesRead = n;
+
+	PASS()
+}
+
+/**
+ * Refill the read buffer and copy from it, or read directly from the stream
+ * for large reads. If the stream supports borrowing, the rest of the stream
+ * is borrowed and used as the buffer instead. Only called when the buffer
+ * cannot satisfy a read on its own. If bytesRead is NULL, reading less than
+ * size bytes is an error.
+ */
+static AlError data_read_slow(AlData *data, void *ptr, size_t size, size_t *bytesRead)
+{
+	BEGIN()
+
+	if (data->numReferences > 0) {
+		al_log_error("unexpected end of referred group");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	size_t available = data->readEnd - data->readCur;
+	size_t total = available;
+
+	if (available) {
+		memcpy(ptr, data->readCur, available);
+	}
+	data->readCur = data->readEnd;
+	ptr += available;
+	size -= available;
+
+	hash_read(data);
+
+	if (data->stream->borrow) {
+		const void *borrowed;
+		size_t n;
+		TRY(data->stream->borrow(data->stream, SIZE_MAX, &borrowed, &n));
+
+		// Memory lent after a seek usually carries on from what was lent before
+		if (!data->borrowStart || borrowed != data->borrowStart + (data->readOffset - data->borrowOffset)) {
+			data->borrowStart = borrowed;
+			data->borrowOffset = data->readOffset;
+		}
+
+		data->readOffset += n;
+		data->readCur = borrowed;
+		data->readEnd = data->readCur + n;
+		data->readHashed = data->readCur;
+		data->readBorrowed = true;
+
+		size_t copy = (n < size) ? n : size;
+		memcpy(ptr, data->readCur, copy);
+		data->readCur += copy;
+		total += copy;
+		size -= copy;
+
+	} else if (size >= READ_BUFFER_SIZE) {
+		size_t n;
+		TRY(data->stream->read(data->stream, ptr, size, &n));
+		hash_bytes(data, ptr, n);
+		data->readOffset += n;
+		total += n;
+		size -= n;
+
+	} else {
+		size_t n;
+		TRY(fill_buffer(data, &n));
+
+		size_t copy = (n < size) ? n : size;
+		memcpy(ptr, data->readCur, copy);
+		data->readCur += copy;
+		total += copy;
+		size -= copy;
+	}
+
+	if (bytesRead) {
+		*bytesRead = total;
+
+	} else if (size > 0) {
+		al_log_error("unexpected end of stream");
+		THROW(AL_ERROR_IO);
+	}
+
+	PASS()
+}
+
+static inline AlError data_read(AlData *data, void *ptr, size_t size)
+{
+	if ((size_t)(data->readEnd - data->readCur) >= size) {
+		memcpy(ptr, data->readCur, size);
+		data->readCur += size;
+		return AL_NO_ERROR;
+	}
+
+	return data_read_slow(data, ptr, size, NULL);
+}
+
+/**
+ * Get a pointer to the next size bytes so they can be used in place. Only
+ * possible when reading straight out of the stream's memory, and when the
+ * bytes are suitably aligned, otherwise NULL is returned and nothing is read.
+ */
+static const void *borrow_bytes(AlData *data, size_t size, size_t align)
+{
+	if (!data->readBorrowed ||
+		(size_t)(data->readEnd - data->readCur) < size ||
+		(uintptr_t)data->readCur % align != 0)
+		return NULL;
+
+	const void *ptr = data->readCur;
+	data->readCur += size;
+
+	return ptr;
+}
+
+static inline AlError read_byte(AlData *data, uint8_t *byte)
+{
+	if (data->readCur != data->readEnd) {
+		*byte = *data->readCur++;
+		return AL_NO_ERROR;
+	}
+
+	return data_read_slow(data, byte, 1, NULL);
+}
+
+static inline uint64_t read_offset(AlData *data)
+{
+	return data->readOffset - (data->readEnd - data->readCur);
+}
+
+/**
+ * Skip forward over length bytes, within the read buffer if possible. Short
+ * gaps past the end of the buffer are read through rather than seeked over,
+ * so runs of small items never turn into runs of small seeks. Bytes that are
+ * part of a checksum are always read through.
+ */
+static AlError data_skip(AlData *data, uint64_t length)
+{
+	BEGIN()
+
+	size_t available = data->readEnd - data->readCur;
+
+	if (length <= available) {
+		data->readCur += length;
+
+	} else if (data->numReferences > 0) {
+		al_log_error("unexpected end of referred group");
+		THROW(AL_ERROR_INVALID_DATA);
+
+	} else if (data->hashGroup != NO_GROUP) {
+		do {
+			data->readCur = data->readEnd;
+			length -= available;
+
+			TRY(fill_buffer(data, &available));
+			if (available == 0) {
+				al_log_error("unexpected end of stream");
+				THROW(AL_ERROR_IO);
+			}
+		} while (length > available);
+
+		data->readCur += length;
+
+	} else if (!data->readBorrowed && length - available < READ_BUFFER_SIZE) {
+		length -= available;
+
+		size_t n;
+		TRY(fill_buffer(data, &n));
+
+		if (n < length) {
+			al_log_error("unexpected end of stream");
+			THROW(AL_ERROR_IO);
+		}
+
+		data->readCur += length;
+
+	} else {
+		if (length - available > INT64_MAX) {
+			al_log_error("skip too long");
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+		TRY(data->stream->seek(data->stream, length - available, AL_SEEK_CUR));
+		data->readOffset += length - available;
+		data->readCur = data->readEnd = data->readHashed = data->readBuffer;
+		data->readBorrowed = false;
+	}
+
+	PASS()
+}
+
+static inline uint64_t write_offset(AlData *data)
+{
+	return data->writeOffset + (data->writeCur - data->writeBuffer);
+}
+
+/**
+ * Open a group. If hash is set, the bytes that follow are added to the
+ * group's checksum until the group is closed or another checked group is
+ * opened inside it; the caller must have already called hash_read() or
+ * hash_write().
+ */
+static AlError push_group(AlData *data, uint64_t offset, bool checked, bool hash)
+{
+	BEGIN()
+
+	if (data->numGroups >= data->maxDepth) {
+		al_log_error("groups nested too deeply");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	if (data->numGroups == data->groupsLength) {
+		size_t length = data->groupsLength ? data->groupsLength * 2 : 16;
+		TRY(al_realloc(&data->groups, sizeof(Group) * length));
+		data->groupsLength = length;
+	}
+
+	data->groups[data->numGroups] = (Group){
+		.offset = offset,
+		.checked = checked,
+		.crc = 0,
+		.outerHashGroup = data->hashGroup
+	};
+
+	if (hash) {
+		data->hashGroup = data->numGroups;
+	}
+
+	data->numGroups++;
+
+	PASS()
+}
+
+/**
+ * Close the innermost group. The caller must have already called hash_read()
+ * or hash_write() so its checksum is complete.
+ */
+static AlError pop_group(AlData *data, Group *group)
+{
+	BEGIN()
+
+	if (data->numGroups == 0) {
+		al_log_error("unexpected end of group");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	*group = data->groups[--data->numGroups];
+	data->hashGroup = group->outerHashGroup;
+
+	PASS()
+}
+
+void al_data_set_max_depth(AlData *data, size_t depth)
+{
+	data->maxDepth = depth;
+}
+
+AlError al_data_flush(AlData *data)
+{
+	BEGIN()
+
+	size_t length = data->writeCur - data->writeBuffer;
+
+	hash_write(data);
+
+	if (length > 0) {
+		data->writeCur = data->writeHashed = data->writeBuffer;
+		TRY(data->stream->write(data->stream, data->writeBuffer, length));
+		data->writeOffset += length;
+	}
+
+	PASS()
+}
+
+AlError al_data_set_write_buffer_size(AlData *data, size_t size)
+{
+	BEGIN()
+
+	TRY(al_data_flush(data));
+
+	al_free(data->writeBuffer);
+	data->writeBufferSize = size;
+	data->writeBuffer = NULL;
+	data->writeCur = NULL;
+	data->writeEnd = NULL;
+
+	PASS()
+}
+
+/**
+ * Flush the write buffer and either copy into it, or write directly to the
+ * stream if the data would not fit. Only called when the buffer does not
+ * have enough space left.
+ */
+static AlError data_write_slow(AlData *data, const void *ptr, size_t size)
+{
+	BEGIN()
+
+	TRY(al_data_flush(data));
+
+	if (size >= data->writeBufferSize) {
+		TRY(data->stream->write(data->stream, ptr, size));
+		hash_bytes(data, ptr, size);
+		data->writeOffset += size;
+
+	} else {
+		if (!data->writeBuffer) {
+			TRY(al_malloc(&data->writeBuffer, data->writeBufferSize));
+			data->writeCur = data->writeHashed = data->writeBuffer;
+			data->writeEnd = data->writeBuffer + data->writeBufferSize;
+		}
+
+		memcpy(data->writeCur, ptr, size);
+		data->writeCur += size;
+	}
+
+	PASS()
+}
+
+static inline AlError data_write(AlData *data, const void *ptr, size_t size)
+{
+	if ((size_t)(data->writeEnd - data->writeCur) >= size) {
+		memcpy(data->writeCur, ptr, size);
+		data->writeCur += size;
+		return AL_NO_ERROR;
+	}
+
+	return data_write_slow(data, ptr, size);
+}
+
 static AlError read_uint(AlData *data, uint64_t *result)
 {
 	BEGIN()
 
+	const uint8_t *cur = data->readCur;
+	uint64_t value = 0;
+
+	if (data->readEnd - cur >= 10) {
+		for (int shift = 0; shift < 70; shift += 7) {
+			uint8_t byte = *cur++;
+			value |= (uint64_t)(byte & 0x7F) << shift;
+
+			if (!(byte & 0x80)) {
+				data->readCur = cur;
+				*result = value;
+				RETURN();
+			}
+		}
+
+		al_log_error("varint too long");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
 	uint8_t byte;
 	int length = 0;
 
-	*result = 0;
 	do {
-		if (length > 10) {
+		if (length >= 10) {
 			al_log_error("varint too long");
 			THROW(AL_ERROR_INVALID_DATA);
 		}
 
-		TRY(data_read(data, &byte, 1));
+		TRY(read_byte(data, &byte));
 
-		*result |= (byte & 0x7F) << (length * 7);
+		value |= (uint64_t)(byte & 0x7F) << (length * 7);
 		length++;
 	} while (byte & 0x80);
 
+	*result = value;
+
 	PASS()
 }
 
-static AlError write_uint(AlData *data, uint64_t value)
+/**
+ * Encode an unsigned int into at most 10 bytes.
+ * @return the number of bytes used
+ */
+static size_t encode_uint(uint8_t *dst, uint64_t value)
 {
-	uint8_t buffer[10];
-	int length = 0;
+	size_t length = 0;
 
 	do {
 		uint8_t byte = value & 0x7F;
@@ -81,9 +747,30 @@ static AlError write_uint(AlData *data, uint64_t value)
 			byte |= 0x80;
 		}
 
-		buffer[length++] = byte;
+		dst[length++] = byte;
 	} while (value);
 
+	return length;
+}
+
+static AlError write_uint(AlData *data, uint64_t value)
+{
+	if (data->writeEnd - data->writeCur >= 10) {
+		uint8_t *cur = data->writeCur;
+
+		while (value >= 0x80) {
+			*cur++ = (value & 0x7F) | 0x80;
+			value >>= 7;
+		}
+		*cur++ = value;
+
+		data->writeCur = cur;
+		return AL_NO_ERROR;
+	}
+
+	uint8_t buffer[10];
+	size_t length = encode_uint(buffer, value);
+
 	return data_write(data, buffer, length);
 }
 
@@ -93,7 +780,7 @@ static AlError skip_uint(AlData *data)
 
 	uint8_t byte;
 	do {
-		TRY(data_read(data, &byte, 1));
+		TRY(read_byte(data, &byte));
 	} while (byte & 0x80);
 
 	PASS()
@@ -115,21 +802,47 @@ static AlError read_sint(AlData *data, int64_t *result)
 static AlError write_sint(AlData *data, int64_t value)
 {
 	uint64_t uvalue = (value < 0) ?
-		~(value << 1) : value << 1;
+		~((uint64_t)value << 1) : (uint64_t)value << 1;
 
 	return write_uint(data, uvalue);
 }
 
+/**
+ * Check that an array being written in pieces has been finished, before
+ * anything else is written.
+ */
+static AlError check_array_written(AlData *data)
+{
+	BEGIN()
+
+	if (data->writePendingCount > 0) {
+		al_log_error("array items not all written");
+		THROW(AL_ERROR_INVALID_OPERATION);
+	}
+
+	PASS()
+}
+
 static AlError write_token(AlData *data, AlToken token)
 {
+	BEGIN()
+
 	uint8_t t = token;
-	return data_write(data, &t, 1);
+	TRY(check_array_written(data));
+	TRY(data_write(data, &t, 1));
+
+	PASS()
 }
 
 static AlError write_type(AlData *data, AlVarType type)
 {
+	BEGIN()
+
 	uint8_t t = type;
-	return data_write(data, &t, 1);
+	TRY(check_array_written(data));
+	TRY(data_write(data, &t, 1));
+
+	PASS()
 }
 
 static AlError read_tag(AlData *data, AlDataTag *tag)
@@ -147,7 +860,7 @@ static AlError read_bool(AlData *data, bool *result)
 	BEGIN()
 
 	uint8_t value;
-	TRY(data_read(data, &value, 1));
+	TRY(read_byte(data, &value));
 
 	*result = value;
 
@@ -232,6 +945,45 @@ static AlError write_box2(AlData *data, const Box2 *value)
 	return data_write(data, value, 32);
 }
 
+void al_data_set_arena(AlData *data, AlArena *arena)
+{
+	data->arena = arena;
+}
+
+/**
+ * Allocate memory for a value being read. Values are normally only valid
+ * until the next read, so come from the scratch arena, which is reset on
+ * every read. Owned values belong to the caller instead, so come from the
+ * caller's arena if there is one, or the heap.
+ */
+static AlError alloc_value(AlData *data, void *ptr, size_t size, bool owned)
+{
+	BEGIN()
+
+	if (owned && data->arena) {
+		TRY(al_arena_alloc(data->arena, ptr, size));
+
+	} else if (owned) {
+		TRY(al_malloc(ptr, size));
+
+	} else {
+		if (!data->scratch) {
+			TRY(al_arena_init(&data->scratch, SCRATCH_BLOCK_SIZE));
+		}
+
+		TRY(al_arena_alloc(data->scratch, ptr, size));
+	}
+
+	PASS()
+}
+
+static void free_value(AlData *data, void *ptr, bool owned)
+{
+	if (owned && !data->arena) {
+		al_free(ptr);
+	}
+}
+
 static AlError read_string(AlData *data, char **result, uint64_t *resultLength)
 {
 	BEGIN()
@@ -245,23 +997,16 @@ static AlError read_string(AlData *data, char **result, uint64_t *resultLength)
 		THROW(AL_ERROR_MEMORY);
 	}
 
-	TRY(al_malloc(&chars, length + 1));
+	TRY(alloc_value(data, &chars, length + 1, false));
 	TRY(data_read(data, chars, length));
 	chars[length] = '\0';
 
-	if (data->temp) {
-		al_free(data->temp);
-	}
-
-	*result = data->temp = chars;
+	*result = chars;
 	if (resultLength) {
 		*resultLength = length;
 	}
 
-	CATCH({
-		al_free(chars);
-	})
-	FINALLY()
+	PASS()
 }
 
 static AlError write_string(AlData *data, const char *value, uint64_t length)
@@ -284,7 +1029,7 @@ static AlError skip_string(AlData *data)
 
 	uint64_t length;
 	TRY(read_uint(data, &length));
-	TRY(data_seek(data, length, AL_SEEK_CUR));
+	TRY(data_skip(data, length));
 
 	PASS()
 }
@@ -302,24 +1047,21 @@ static AlError read_blob(AlData *data, AlBlob *result)
 		THROW(AL_ERROR_MEMORY);
 	}
 
-	TRY(al_malloc(&bytes, length));
-	TRY(data_read(data, bytes, length));
+	const void *borrowed = borrow_bytes(data, length, 1);
 
-	if (data->temp) {
-		al_free(data->temp);
+	if (!borrowed) {
+		TRY(alloc_value(data, &bytes, length, false));
+		if (length > 0) {
+			TRY(data_read(data, bytes, length));
+		}
 	}
 
-	data->temp = bytes;
-
 	*result = (AlBlob){
 		.length = length,
-		.bytes = bytes
+		.bytes = borrowed ? (uint8_t *)borrowed : bytes
 	};
 
-	CATCH({
-		al_free(bytes);
-	})
-	FINALLY()
+	PASS()
 }
 
 static AlError write_blob(AlData *data, const AlBlob *value)
@@ -327,7 +1069,10 @@ static AlError write_blob(AlData *data, const AlBlob *value)
 	BEGIN()
 
 	TRY(write_uint(data, value->length));
-	TRY(data_write(data, value->bytes, value->length));
+
+	if (value->length > 0) {
+		TRY(data_write(data, value->bytes, value->length));
+	}
 
 	PASS()
 }
@@ -353,53 +1098,522 @@ static size_t get_var_size(AlVarType type)
 	}
 }
 
-static AlError read_array(AlData *data, AlVarType type, void *result, uint64_t *resultCount)
+static bool is_raw_type(AlVarType type)
 {
-	BEGIN()
+	switch (type) {
+		case AL_VAR_DOUBLE:
+		case AL_VAR_VEC2:
+		case AL_VAR_VEC3:
+		case AL_VAR_VEC4:
+		case AL_VAR_BOX2:
+			return true;
 
-	size_t itemSize = get_var_size(type);
-	uint64_t count;
-	void *array = NULL;
-	TRY(read_uint(data, &count));
-	TRY(al_malloc(&array, itemSize * count));
+		default:
+			return false;
+	}
+}
 
-	for (uint64_t i = 0; i < count; i++) {
-		void *item = array + (i * itemSize);
+static bool is_encoding_supported(AlVarType type, AlDataEncoding encoding)
+{
+	switch (encoding) {
+		case AL_DATA_ENCODING_RAW:
+			return type <= AL_VAR_BLOB;
+
+		case AL_DATA_ENCODING_DELTA:
+			return type == AL_VAR_INT || is_raw_type(type);
+
+		case AL_DATA_ENCODING_FLOAT:
+		case AL_DATA_ENCODING_HALVES:
+			return is_raw_type(type);
+
+		default:
+			return false;
+	}
+}
+
+/**
+ * Split the type byte of an array into its item type and encoding.
+ * Returns false if the byte is not a valid array type.
+ */
+static bool parse_array_type(uint8_t byte, AlVarType *type, AlDataEncoding *encoding)
+{
+	if (!(byte & 0x80)) {
+		return false;
+	}
+
+	*type = byte & 0x0F;
+	*encoding = (byte >> 4) & 0x07;
+
+	return is_encoding_supported(*type, *encoding);
+}
+
+static AlError write_array_type(AlData *data, AlVarType type, AlDataEncoding encoding)
+{
+	return write_type(data, 0x80 | (encoding << 4) | type);
+}
+
+/** Number of doubles in one item of a raw type */
+static inline size_t get_var_components(AlVarType type)
+{
+	return get_var_size(type) / sizeof(double);
+}
+
+/**
+ * Decode a run of single byte varints, which all have their top bit clear,
+ * from src into count ints. count must be a multiple of 16.
+ */
+static void decode_small_ints(const uint8_t *src, int32_t *dst, size_t count)
+{
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi32(1);
+
+	for (size_t i = 0; i < count; i += 16, src += 16, dst += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i *)src);
+		__m128i lo = _mm_unpacklo_epi8(bytes, zero);
+		__m128i hi = _mm_unpackhi_epi8(bytes, zero);
+		__m128i words[4] = {
+			_mm_unpacklo_epi16(lo, zero),
+			_mm_unpackhi_epi16(lo, zero),
+			_mm_unpacklo_epi16(hi, zero),
+			_mm_unpackhi_epi16(hi, zero)
+		};
+
+		for (int j = 0; j < 4; j++) {
+			__m128i sign = _mm_sub_epi32(zero, _mm_and_si128(words[j], one));
+			__m128i value = _mm_xor_si128(_mm_srli_epi32(words[j], 1), sign);
+			_mm_storeu_si128((__m128i *)(dst + j * 4), value);
+		}
+	}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	const uint32x4_t one = vdupq_n_u32(1);
+
+	for (size_t i = 0; i < count; i += 16, src += 16, dst += 16) {
+		uint8x16_t bytes = vld1q_u8(src);
+		uint16x8_t lo = vmovl_u8(vget_low_u8(bytes));
+		uint16x8_t hi = vmovl_u8(vget_high_u8(bytes));
+		uint32x4_t words[4] = {
+			vmovl_u16(vget_low_u16(lo)),
+			vmovl_u16(vget_high_u16(lo)),
+			vmovl_u16(vget_low_u16(hi)),
+			vmovl_u16(vget_high_u16(hi))
+		};
+
+		for (int j = 0; j < 4; j++) {
+			int32x4_t sign = vnegq_s32(vreinterpretq_s32_u32(vandq_u32(words[j], one)));
+			int32x4_t value = veorq_s32(vreinterpretq_s32_u32(vshrq_n_u32(words[j], 1)), sign);
+			vst1q_s32(dst + j * 4, value);
+		}
+	}
+
+#else
+	for (size_t i = 0; i < count; i++) {
+		dst[i] = (src[i] >> 1) ^ -(int32_t)(src[i] & 1);
+	}
+#endif
+}
+
+/**
+ * Check whether the next 16 bytes are all single byte varints.
+ */
+static inline bool are_small_ints(const uint8_t *src)
+{
+#if defined(__SSE2__)
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)src)) == 0;
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	uint64x2_t high = vreinterpretq_u64_u8(vandq_u8(vld1q_u8(src), vdupq_n_u8(0x80)));
+	return (vgetq_lane_u64(high, 0) | vgetq_lane_u64(high, 1)) == 0;
+
+#else
+	uint64_t words[2];
+	memcpy(words, src, 16);
+	return ((words[0] | words[1]) & UINT64_C(0x8080808080808080)) == 0;
+#endif
+}
+
+static AlError read_int_array(AlData *data, int32_t *values, uint64_t count)
+{
+	BEGIN()
+
+	uint64_t i = 0;
+
+	while (i < count) {
+		size_t available = data->readEnd - data->readCur;
+		size_t run = 0;
+
+		while (run + 16 <= available && i + run + 16 <= count &&
+			   are_small_ints(data->readCur + run)) {
+			run += 16;
+		}
 
+		if (run > 0) {
+			decode_small_ints(data->readCur, values + i, run);
+			data->readCur += run;
+			i += run;
+
+		} else {
+			TRY(read_int(data, values + i));
+			i++;
+		}
+	}
+
+	PASS()
+}
+
+static AlError read_raw_items(AlData *data, AlVarType type, uint8_t *dst, size_t stride, uint64_t count)
+{
+	BEGIN()
+
+	size_t itemSize = get_var_size(type);
+
+	if (stride == itemSize) {
 		switch (type) {
-			case AL_VAR_BOOL: TRY(read_bool(data, item)); break;
-			case AL_VAR_INT: TRY(read_int(data, item)); break;
-			case AL_VAR_DOUBLE: TRY(read_double(data, item)); break;
-			case AL_VAR_VEC2: TRY(read_vec2(data, item)); break;
-			case AL_VAR_VEC3: TRY(read_vec3(data, item)); break;
-			case AL_VAR_VEC4: TRY(read_vec4(data, item)); break;
-			case AL_VAR_BOX2: TRY(read_box2(data, item)); break;
+			case AL_VAR_BOOL:
+				if (sizeof(bool) == 1) {
+					TRY(data_read(data, dst, count));
+					for (uint64_t i = 0; i < count; i++) {
+						((bool *)dst)[i] = dst[i];
+					}
+					RETURN();
+				}
+				break;
+
+			case AL_VAR_INT:
+				TRY(read_int_array(data, (int32_t *)dst, count));
+				RETURN();
 
-			case AL_VAR_STRING:
-				al_log_error("arrays of strings not supported");
-				THROW(AL_ERROR_INVALID_DATA);
-			case AL_VAR_BLOB:
-				al_log_error("arrays of blobs not supported");
-				THROW(AL_ERROR_INVALID_DATA);
 			default:
-				al_log_error("unknown value type: 0x%02x", type);
+				TRY(data_read(data, dst, itemSize * count));
+				RETURN();
+		}
+	}
+
+	for (uint64_t i = 0; i < count; i++, dst += stride) {
+		switch (type) {
+			case AL_VAR_BOOL: TRY(read_bool(data, (bool *)dst)); break;
+			case AL_VAR_INT: TRY(read_int(data, (int32_t *)dst)); break;
+			default: TRY(data_read(data, dst, itemSize)); break;
+		}
+	}
+
+	PASS()
+}
+
+static AlError read_float_items(AlData *data, AlVarType type, uint8_t *dst, size_t stride, uint64_t count)
+{
+	BEGIN()
+
+	size_t components = get_var_components(type);
+	float values[4];
+	double item[4];
+
+	for (uint64_t i = 0; i < count; i++, dst += stride) {
+		TRY(data_read(data, values, sizeof(float) * components));
+
+		for (size_t j = 0; j < components; j++) {
+			item[j] = values[j];
+		}
+
+		memcpy(dst, item, sizeof(double) * components);
+	}
+
+	PASS()
+}
+
+/**
+ * Decode delta encoded items. previous holds the last value of each
+ * component, starting at zeros, so an array can be decoded a piece at a time.
+ */
+static AlError read_delta_items(AlData *data, AlVarType type, double scale, int64_t *previous, uint8_t *dst, size_t stride, uint64_t count)
+{
+	BEGIN()
+
+	int64_t delta;
+
+	if (type == AL_VAR_INT) {
+		int64_t value = previous[0];
+
+		for (uint64_t i = 0; i < count; i++, dst += stride) {
+			TRY(read_sint(data, &delta));
+			value = (int64_t)((uint64_t)value + (uint64_t)delta);
+			previous[0] = value;
+
+			if (value > INT32_MAX || value < INT32_MIN) {
+				al_log_error("integer value out of range");
+				THROW(AL_ERROR_INVALID_DATA);
+			}
+
+			int32_t item = (int32_t)value;
+			memcpy(dst, &item, sizeof(int32_t));
+		}
+
+	} else {
+		size_t components = get_var_components(type);
+		double item[4];
+
+		for (uint64_t i = 0; i < count; i++, dst += stride) {
+			for (size_t j = 0; j < components; j++) {
+				TRY(read_sint(data, &delta));
+				previous[j] = (int64_t)((uint64_t)previous[j] + (uint64_t)delta);
+				item[j] = previous[j] * scale;
+			}
+
+			memcpy(dst, item, sizeof(double) * components);
+		}
+	}
+
+	PASS()
+}
+
+static AlError read_halves_items(AlData *data, AlVarType type, uint8_t *dst, size_t stride, uint64_t count)
+{
+	BEGIN()
+
+	size_t components = get_var_components(type);
+	double item[4];
+
+	for (uint64_t i = 0; i < count; i++, dst += stride) {
+		for (size_t j = 0; j < components; j++) {
+			uint8_t byte;
+			TRY(read_byte(data, &byte));
+
+			if (byte == HALVES_ESCAPE) {
+				TRY(data_read(data, &item[j], sizeof(double)));
+			} else {
+				item[j] = byte * 0.5;
+			}
+		}
+
+		memcpy(dst, item, sizeof(double) * components);
+	}
+
+	PASS()
+}
+
+static inline bool is_packed_type(AlVarType type)
+{
+	return type == AL_VAR_STRING || type == AL_VAR_BLOB;
+}
+
+/**
+ * Read the items of an array of strings or blobs into a table of char
+ * pointers or AlBlobs, followed by their bytes in the same allocation. If
+ * the array isn't owned, the bytes are used in place where possible. The
+ * table of lengths grows as they're read, so a bad count in a short stream
+ * can't ask for more memory than the stream holds.
+ */
+static AlError read_packed_items(AlData *data, AlVarType type, uint64_t count, bool owned, void *result)
+{
+	BEGIN()
+
+	bool strings = (type == AL_VAR_STRING);
+	size_t tableSize = get_var_size(type) * count;
+	uint64_t *lengths = NULL;
+	uint64_t lengthsSize = 0;
+	uint64_t total = 0;
+	uint8_t *array = NULL;
+
+	if (count > SIZE_MAX / sizeof(uint64_t) || count > SIZE_MAX / get_var_size(type)) {
+		al_log_error("array too large to fit in memory");
+		THROW(AL_ERROR_MEMORY);
+	}
+
+	for (uint64_t i = 0; i < count; i++) {
+		if (i == lengthsSize) {
+			lengthsSize = lengthsSize ? lengthsSize * 2 : 64;
+			if (lengthsSize > count) {
+				lengthsSize = count;
+			}
+
+			TRY(al_realloc(&lengths, sizeof(uint64_t) * lengthsSize));
+		}
+
+		TRY(read_uint(data, &lengths[i]));
+
+		uint64_t length = lengths[i] + strings;
+		if (lengths[i] == UINT64_MAX || length > SIZE_MAX - tableSize - total) {
+			al_log_error("array too large to fit in memory");
+			THROW(AL_ERROR_MEMORY);
+		}
+
+		total += length;
+	}
+
+	const uint8_t *bytes = owned ? NULL : borrow_bytes(data, total, 1);
+
+	TRY(alloc_value(data, &array, tableSize + (bytes ? 0 : total), owned));
+
+	if (!bytes && total > 0) {
+		TRY(data_read(data, array + tableSize, total));
+		bytes = array + tableSize;
+	}
+
+	for (uint64_t i = 0; i < count; i++) {
+		if (strings) {
+			if (bytes[lengths[i]] != '\0') {
+				al_log_error("string in array is not terminated");
 				THROW(AL_ERROR_INVALID_DATA);
+			}
+
+			((const char **)array)[i] = (const char *)bytes;
+
+		} else {
+			((AlBlob *)array)[i] = (AlBlob){
+				.bytes = (uint8_t *)bytes,
+				.length = lengths[i]
+			};
+		}
+
+		bytes += lengths[i] + strings;
+	}
+
+	*(void **)result = array;
+
+	CATCH({
+		free_value(data, array, owned);
+	})
+	FINALLY({
+		al_free(lengths);
+	})
+}
+
+static AlError skip_packed_items(AlData *data, AlVarType type, uint64_t count)
+{
+	BEGIN()
+
+	uint64_t total = 0;
+
+	for (uint64_t i = 0; i < count; i++) {
+		uint64_t length;
+		TRY(read_uint(data, &length));
+
+		length += (type == AL_VAR_STRING);
+		if (length > UINT64_MAX - total) {
+			al_log_error("array too large");
+			THROW(AL_ERROR_INVALID_DATA);
 		}
+
+		total += length;
+	}
+
+	TRY(data_skip(data, total));
+
+	PASS()
+}
+
+/**
+ * Decode count array items into dst, stride bytes apart.
+ * The type and encoding must already have been checked.
+ */
+static AlError read_items(AlData *data, AlVarType type, AlDataEncoding encoding, double scale, void *dst, size_t stride, uint64_t count)
+{
+	int64_t previous[4] = {0, 0, 0, 0};
+
+	if (count == 0) {
+		return AL_NO_ERROR;
+	}
+
+	switch (encoding) {
+		case AL_DATA_ENCODING_FLOAT: return read_float_items(data, type, dst, stride, count);
+		case AL_DATA_ENCODING_DELTA: return read_delta_items(data, type, scale, previous, dst, stride, count);
+		case AL_DATA_ENCODING_HALVES: return read_halves_items(data, type, dst, stride, count);
+		default: return read_raw_items(data, type, dst, stride, count);
+	}
+}
+
+/**
+ * Read the length of an array, and its scale if the encoding has one.
+ */
+static AlError read_array_header(AlData *data, AlVarType type, AlDataEncoding encoding, uint64_t *count, double *scale)
+{
+	BEGIN()
+
+	TRY(read_uint(data, count));
+
+	*scale = 1.0;
+	if (encoding == AL_DATA_ENCODING_DELTA && type != AL_VAR_INT) {
+		TRY(data_read(data, scale, sizeof(double)));
+	}
+
+	PASS()
+}
+
+static AlError read_array(AlData *data, AlVarType type, AlDataEncoding encoding, void *result, uint64_t *resultCount)
+{
+	BEGIN()
+
+	size_t itemSize = get_var_size(type);
+	uint64_t count;
+	double scale;
+	void *array = NULL;
+	TRY(read_array_header(data, type, encoding, &count, &scale));
+
+	if (itemSize && count > SIZE_MAX / itemSize) {
+		al_log_error("array too large to fit in memory");
+		THROW(AL_ERROR_MEMORY);
+	}
+
+	if (is_packed_type(type)) {
+		TRY(read_packed_items(data, type, count, data->readOwned, result));
+		*resultCount = count;
+		RETURN();
 	}
 
-	if (data->temp) {
-		al_free(data->temp);
+	if (encoding == AL_DATA_ENCODING_RAW && is_raw_type(type) && !data->readOwned) {
+		const void *borrowed = borrow_bytes(data, itemSize * count, sizeof(double));
+		if (borrowed) {
+			*(const void **)result = borrowed;
+			*resultCount = count;
+			RETURN();
+		}
 	}
 
-	*(void **)result = data->temp = array;
+	TRY(alloc_value(data, &array, itemSize * count, data->readOwned));
+	TRY(read_items(data, type, encoding, scale, array, itemSize, count));
+
+	*(void **)result = array;
 	*resultCount = count;
 
 	CATCH({
-		al_free(array);
+		free_value(data, array, data->readOwned);
 	})
 	FINALLY()
 }
 
+/**
+ * Write the items of an array of strings or blobs, as a table of their
+ * lengths followed by all of their bytes.
+ */
+static AlError write_packed_items(AlData *data, AlVarType type, const uint8_t *values, size_t stride, uint64_t count)
+{
+	BEGIN()
+
+	const uint8_t *item = values;
+
+	for (uint64_t i = 0; i < count; i++, item += stride) {
+		if (type == AL_VAR_STRING) {
+			TRY(write_uint(data, strlen(*(const char *const *)item)));
+		} else {
+			TRY(write_uint(data, ((const AlBlob *)item)->length));
+		}
+	}
+
+	item = values;
+
+	for (uint64_t i = 0; i < count; i++, item += stride) {
+		if (type == AL_VAR_STRING) {
+			const char *chars = *(const char *const *)item;
+			TRY(data_write(data, chars, strlen(chars) + 1));
+		} else if (((const AlBlob *)item)->length) {
+			TRY(data_write(data, ((const AlBlob *)item)->bytes, ((const AlBlob *)item)->length));
+		}
+	}
+
+	PASS()
+}
+
 static AlError write_array(AlData *data, AlVarType type, const void *values, uint64_t count)
 {
 	BEGIN()
@@ -408,332 +1622,2007 @@ static AlError write_array(AlData *data, AlVarType type, const void *values, uin
 
 	TRY(write_uint(data, count));
 
-	for (uint64_t i = 0; i < count; i++) {
-		const void *value = values + (i * itemSize);
+	if (count == 0) {
+		RETURN();
+	}
+
+	switch (type) {
+		case AL_VAR_BOOL:
+			if (sizeof(bool) == 1) {
+				TRY(data_write(data, values, count));
+
+			} else {
+				for (uint64_t i = 0; i < count; i++) {
+					TRY(write_bool(data, (const bool *)values + i));
+				}
+			}
+			break;
+
+		case AL_VAR_INT:
+			for (uint64_t i = 0; i < count; i++) {
+				TRY(write_int(data, (const int32_t *)values + i));
+			}
+			break;
+
+		case AL_VAR_DOUBLE:
+		case AL_VAR_VEC2:
+		case AL_VAR_VEC3:
+		case AL_VAR_VEC4:
+		case AL_VAR_BOX2:
+			TRY(data_write(data, values, itemSize * count));
+			break;
+
+		case AL_VAR_STRING:
+		case AL_VAR_BLOB:
+			TRY(write_packed_items(data, type, values, itemSize, count));
+			break;
+
+		default:
+			al_log_error("unknown value type: 0x%02x", type);
+			THROW(AL_ERROR_INVALID_OPERATION);
+	}
+
+	PASS()
+}
+
+static AlError write_raw_items(AlData *data, AlVarType type, const uint8_t *values, size_t stride, uint64_t count)
+{
+	BEGIN()
+
+	size_t itemSize = get_var_size(type);
+
+	if (is_packed_type(type)) {
+		TRY(write_packed_items(data, type, values, stride, count));
+		RETURN();
+	}
+
+	for (uint64_t i = 0; i < count; i++, values += stride) {
+		switch (type) {
+			case AL_VAR_BOOL: TRY(write_bool(data, (const bool *)values)); break;
+			case AL_VAR_INT: TRY(write_int(data, (const int32_t *)values)); break;
+			default: TRY(data_write(data, values, itemSize)); break;
+		}
+	}
+
+	PASS()
+}
+
+static AlError write_float_items(AlData *data, AlVarType type, const uint8_t *values, size_t stride, uint64_t count)
+{
+	BEGIN()
+
+	size_t components = get_var_components(type);
+	double item[4];
+	float floats[4];
+
+	for (uint64_t i = 0; i < count; i++, values += stride) {
+		memcpy(item, values, sizeof(double) * components);
+
+		for (size_t j = 0; j < components; j++) {
+			floats[j] = (float)item[j];
+		}
+
+		TRY(data_write(data, floats, sizeof(float) * components));
+	}
+
+	PASS()
+}
+
+/**
+ * Write delta encoded items. previous holds the last value of each
+ * component written so far, so an array can be written in pieces.
+ */
+static AlError write_delta_items(AlData *data, AlVarType type, double scale, int64_t *previous, const uint8_t *values, size_t stride, uint64_t count)
+{
+	BEGIN()
+
+	if (type == AL_VAR_INT) {
+		for (uint64_t i = 0; i < count; i++, values += stride) {
+			int32_t item;
+			memcpy(&item, values, sizeof(int32_t));
+			TRY(write_sint(data, item - previous[0]));
+			previous[0] = item;
+		}
+
+	} else {
+		size_t components = get_var_components(type);
+		double item[4];
+
+		for (uint64_t i = 0; i < count; i++, values += stride) {
+			memcpy(item, values, sizeof(double) * components);
+
+			for (size_t j = 0; j < components; j++) {
+				double quantized = round(item[j] / scale);
+				if (!(fabs(quantized) < QUANTIZED_LIMIT)) {
+					al_log_error("value can't be quantized: %g", item[j]);
+					THROW(AL_ERROR_INVALID_OPERATION);
+				}
+
+				int64_t value = (int64_t)quantized;
+				TRY(write_sint(data, value - previous[j]));
+				previous[j] = value;
+			}
+		}
+	}
+
+	PASS()
+}
+
+static AlError write_halves_items(AlData *data, AlVarType type, const uint8_t *values, size_t stride, uint64_t count)
+{
+	BEGIN()
+
+	size_t components = get_var_components(type);
+	double item[4];
+
+	for (uint64_t i = 0; i < count; i++, values += stride) {
+		memcpy(item, values, sizeof(double) * components);
+
+		for (size_t j = 0; j < components; j++) {
+			double halves = item[j] * 2;
+			uint8_t byte = HALVES_ESCAPE;
+
+			if (halves >= 0 && halves < HALVES_ESCAPE && halves == (int)halves && !signbit(item[j])) {
+				byte = (uint8_t)halves;
+			}
+
+			TRY(data_write(data, &byte, 1));
+			if (byte == HALVES_ESCAPE) {
+				TRY(data_write(data, &item[j], sizeof(double)));
+			}
+		}
+	}
+
+	PASS()
+}
+
+static AlError skip_array_items(AlData *data, AlVarType type, AlDataEncoding encoding, uint64_t count)
+{
+	BEGIN()
+
+	switch (encoding) {
+		case AL_DATA_ENCODING_RAW:
+			break;
+
+		case AL_DATA_ENCODING_FLOAT:
+			TRY(data_skip(data, count * get_var_components(type) * sizeof(float)));
+			RETURN();
+
+		case AL_DATA_ENCODING_DELTA: {
+			uint64_t length = (type == AL_VAR_INT) ? count : count * get_var_components(type);
+			for (uint64_t i = 0; i < length; i++) {
+				TRY(skip_uint(data));
+			}
+			RETURN();
+		}
+
+		case AL_DATA_ENCODING_HALVES: {
+			uint64_t length = count * get_var_components(type);
+			for (uint64_t i = 0; i < length; i++) {
+				uint8_t byte;
+				TRY(read_byte(data, &byte));
+				if (byte == HALVES_ESCAPE) {
+					TRY(data_skip(data, sizeof(double)));
+				}
+			}
+			RETURN();
+		}
+	}
+
+	switch (type) {
+		case AL_VAR_BOOL:
+			TRY(data_skip(data, count));
+			break;
+
+		case AL_VAR_INT:
+			for (uint64_t i = 0; i < count; i++) {
+				TRY(skip_uint(data));
+			}
+			break;
+
+		case AL_VAR_DOUBLE:
+		case AL_VAR_VEC2:
+		case AL_VAR_VEC3:
+		case AL_VAR_VEC4:
+		case AL_VAR_BOX2:
+			TRY(data_skip(data, count * get_var_size(type)));
+			break;
+
+		case AL_VAR_STRING:
+		case AL_VAR_BLOB:
+			TRY(skip_packed_items(data, type, count));
+			break;
+
+		default:
+			al_log_error("unknown value type: 0x%02x", type);
+			THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	PASS()
+}
+
+static AlError skip_array(AlData *data, AlVarType type, AlDataEncoding encoding)
+{
+	BEGIN()
+
+	uint64_t count;
+	double scale;
+	TRY(read_array_header(data, type, encoding, &count, &scale));
+	TRY(skip_array_items(data, type, encoding, count));
+
+	PASS()
+}
+
+/**
+ * Skip the items of an array whose length was read by
+ * al_data_read_array_length() but which were never read.
+ */
+static AlError skip_pending_array(AlData *data)
+{
+	BEGIN()
+
+	if (data->arrayPending) {
+		data->arrayPending = false;
+		TRY(skip_array_items(data, data->pendingType, data->pendingEncoding, data->pendingCount));
+	}
+
+	PASS()
+}
+
+/**
+ * Skip a single value, after its type byte.
+ */
+static AlError skip_value(AlData *data, AlVarType type)
+{
+	BEGIN()
+
+	switch (type) {
+		case AL_VAR_BOOL: TRY(data_skip(data, 1)); break;
+		case AL_VAR_INT: TRY(skip_uint(data)); break;
+		case AL_VAR_DOUBLE: TRY(data_skip(data, 8)); break;
+		case AL_VAR_VEC2: TRY(data_skip(data, 16)); break;
+		case AL_VAR_VEC3: TRY(data_skip(data, 24)); break;
+		case AL_VAR_VEC4: TRY(data_skip(data, 32)); break;
+		case AL_VAR_BOX2: TRY(data_skip(data, 32)); break;
+		case AL_VAR_STRING: TRY(skip_string(data)); break;
+		case AL_VAR_BLOB: TRY(skip_blob(data)); break;
+		default:
+			al_log_error("unknown value type: 0x%02x", type);
+			THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	PASS()
+}
+
+/**
+ * Read bytes that aren't part of any group's checksum.
+ */
+static AlError read_unhashed(AlData *data, void *ptr, size_t size)
+{
+	BEGIN()
+
+	size_t hashGroup = data->hashGroup;
+
+	hash_read(data);
+	data->hashGroup = NO_GROUP;
+
+	TRY(data_read(data, ptr, size));
+
+	PASS({
+		hash_read(data);
+		data->hashGroup = hashGroup;
+	})
+}
+
+static inline bool is_start_token(uint8_t token)
+{
+	return token == AL_TOKEN_START || token == AL_TOKEN_SIZED_START ||
+		token == AL_TOKEN_CHECKED_START || token == AL_TOKEN_SIZED_CHECKED_START;
+}
+
+static inline size_t get_cached_slot(uint64_t offset, int bits)
+{
+	return ((uint32_t)(offset ^ (offset >> 32)) * TAG_HASH) >> (32 - bits);
+}
+
+static AlError grow_cached_slots(AlData *data)
+{
+	BEGIN()
+
+	int bits = data->cachedSlotBits ? data->cachedSlotBits + 1 : 6;
+	size_t numSlots = (size_t)1 << bits;
+
+	TRY(al_realloc(&data->cachedSlots, sizeof(size_t) * numSlots));
+	memset(data->cachedSlots, 0, sizeof(size_t) * numSlots);
+	data->cachedSlotBits = bits;
+
+	for (size_t i = 0; i < data->numCached; i++) {
+		size_t slot = get_cached_slot(data->cached[i].offset, bits);
+		while (data->cachedSlots[slot]) {
+			slot = (slot + 1) & (numSlots - 1);
+		}
+		data->cachedSlots[slot] = i + 1;
+	}
+
+	PASS()
+}
+
+/**
+ * Copy a referred group out of the stream by seeking back to it, keeping the
+ * copy for any later references to the same group.
+ */
+static AlError cache_group(AlData *data, uint64_t offset, size_t size, const uint8_t **result)
+{
+	BEGIN()
+
+	uint8_t *bytes = NULL;
+
+	if ((data->numCached + 1) * 2 > ((size_t)1 << data->cachedSlotBits)) {
+		TRY(grow_cached_slots(data));
+	}
+
+	size_t mask = ((size_t)1 << data->cachedSlotBits) - 1;
+	size_t slot = get_cached_slot(offset, data->cachedSlotBits);
+
+	while (data->cachedSlots[slot]) {
+		CachedGroup *cached = &data->cached[data->cachedSlots[slot] - 1];
+
+		if (cached->offset == offset) {
+			if (cached->size != size) {
+				al_log_error("references to the same group disagree on its size");
+				THROW(AL_ERROR_INVALID_DATA);
+			}
+
+			*result = cached->bytes;
+			RETURN();
+		}
+
+		slot = (slot + 1) & mask;
+	}
+
+	if (!data->stream->seek) {
+		al_log_error("can't follow a reference in a stream that can't seek");
+		THROW(AL_ERROR_INVALID_OPERATION);
+	}
+
+	if (data->numCached == data->cachedLength) {
+		size_t length = data->cachedLength ? data->cachedLength * 2 : 16;
+		TRY(al_realloc(&data->cached, sizeof(CachedGroup) * length));
+		data->cachedLength = length;
+	}
+
+	// The stream is where the outermost read buffer ends
+	uint64_t position = data->numReferences ? data->references[0].readOffset : data->readOffset;
+	uint64_t back = position - offset;
+	size_t n;
+
+	TRY(al_malloc(&bytes, size));
+	TRY(data->stream->seek(data->stream, -(int64_t)back, AL_SEEK_CUR));
+	TRY(data->stream->read(data->stream, bytes, size, &n));
+	TRY(data->stream->seek(data->stream, (int64_t)(back - n), AL_SEEK_CUR));
+
+	if (n != size) {
+		al_log_error("reference is past the end of the stream");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	data->cached[data->numCached++] = (CachedGroup){offset, size, bytes};
+	data->cachedSlots[slot] = data->numCached;
+	*result = bytes;
+
+	CATCH({
+		al_free(bytes);
+	})
+	FINALLY()
+}
+
+/**
+ * Read the rest of a reference, after its token. References are left out of
+ * checksums, like the sizes of sized groups, so neither the token nor what
+ * follows it is added to one.
+ * @param[out] offset Set to the offset of the group referred to
+ * @param[out] size Set to the size of the group referred to
+ */
+static AlError read_reference(AlData *data, uint64_t *offset, uint64_t *size)
+{
+	BEGIN()
+
+	size_t hashGroup = data->hashGroup;
+
+	// The token is always still in the buffer, just before readCur
+	data->readCur--;
+	hash_read(data);
+	data->readCur++;
+	data->hashGroup = NO_GROUP;
+
+	uint64_t from = read_offset(data);
+	uint64_t distance;
+	TRY(read_uint(data, &distance));
+	TRY(read_uint(data, size));
+
+	if (data->readStart < 0 && data->stream->tell) {
+		// The stream is where the outermost read buffer ends
+		uint64_t position = data->numReferences ? data->references[0].readOffset : data->readOffset;
+		int64_t tell;
+		TRY(data->stream->tell(data->stream, &tell));
+		data->readStart = tell - (int64_t)position;
+	}
+
+	// The group must come entirely before the reference, and after the start
+	// of the stream, which can be before where reading started
+	if (distance <= *size || distance > from + (data->readStart > 0 ? data->readStart : 0)) {
+		al_log_error("invalid reference");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	*offset = from - distance;
+
+	PASS({
+		data->readHashed = data->readCur;
+		data->hashGroup = hashGroup;
+	})
+}
+
+/**
+ * Read the rest of a reference, after its token, and carry on reading from
+ * the start token of the group it refers to. The group is read from the
+ * stream's lent memory if it's there, otherwise from a copy.
+ * @param[out] token Set to the group's start token
+ */
+static AlError follow_reference(AlData *data, uint8_t *token)
+{
+	BEGIN()
+
+	uint64_t from = read_offset(data);
+	uint64_t offset, size;
+	TRY(read_reference(data, &offset, &size));
+
+	if (size < 2 || size > SIZE_MAX) {
+		al_log_error("invalid reference");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	const uint8_t *bytes;
+	// Lent memory runs unbroken from borrowOffset to the end of the read buffer.
+	// Offsets can be negative when the group is before where reading started.
+	bool borrowed = (data->borrowStart &&
+		(int64_t)(offset - data->borrowOffset) >= 0 &&
+		(int64_t)(from - (offset + size)) >= 0);
+
+	if (borrowed) {
+		bytes = data->borrowStart + (offset - data->borrowOffset);
+	} else {
+		TRY(cache_group(data, offset, size, &bytes));
+	}
+
+	if (!is_start_token(bytes[0])) {
+		al_log_error("reference is not to a group");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	if (data->numReferences == data->referencesLength) {
+		size_t length = data->referencesLength ? data->referencesLength * 2 : 8;
+		TRY(al_realloc(&data->references, sizeof(Reference) * length));
+		data->referencesLength = length;
+	}
+
+	data->references[data->numReferences++] = (Reference){
+		.readCur = data->readCur,
+		.readEnd = data->readEnd,
+		.readHashed = data->readHashed,
+		.readOffset = data->readOffset,
+		.readBorrowed = data->readBorrowed,
+		.hashGroup = data->hashGroup,
+		.numGroups = data->numGroups
+	};
+
+	data->readCur = data->readHashed = bytes;
+	data->readEnd = bytes + size;
+	data->readOffset = offset + size;
+	data->readBorrowed = borrowed;
+	data->hashGroup = NO_GROUP;
+
+	*token = *data->readCur++;
+
+	PASS()
+}
+
+/**
+ * Go back to reading after a reference once the group it refers to has
+ * ended. Called whenever a group is closed.
+ */
+static AlError end_reference(AlData *data)
+{
+	BEGIN()
+
+	if (data->numReferences == 0 ||
+		data->references[data->numReferences - 1].numGroups != data->numGroups) {
+		RETURN();
+	}
+
+	if (data->readCur != data->readEnd) {
+		al_log_error("reference is to more than one group");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	Reference *reference = &data->references[--data->numReferences];
+	data->readCur = reference->readCur;
+	data->readEnd = reference->readEnd;
+	data->readHashed = reference->readHashed;
+	data->readOffset = reference->readOffset;
+	data->readBorrowed = reference->readBorrowed;
+	data->hashGroup = reference->hashGroup;
+
+	PASS()
+}
+
+/**
+ * Open the group started by a start token that has just been read.
+ * @param[out] size Set to the size of the group, or 0 if unsized
+ */
+static AlError read_start(AlData *data, uint8_t token, uint64_t *size)
+{
+	BEGIN()
+
+	bool sized = (token == AL_TOKEN_SIZED_START || token == AL_TOKEN_SIZED_CHECKED_START);
+	bool checked = (token == AL_TOKEN_CHECKED_START || token == AL_TOKEN_SIZED_CHECKED_START);
+	uint64_t end = UNSIZED_GROUP;
+
+	*size = 0;
+
+	// The start token is part of the enclosing group
+	hash_read(data);
+
+	if (sized) {
+		TRY(read_unhashed(data, size, 8));
+		end = read_offset(data) + *size;
+	}
+
+	TRY(push_group(data, end, checked, checked && data->verify));
+
+	PASS()
+}
+
+/**
+ * Close the group ended by an end token that has just been read, and check
+ * its size and checksum.
+ */
+static AlError read_end(AlData *data)
+{
+	BEGIN()
+
+	Group group;
+
+	hash_read(data);
+	TRY(pop_group(data, &group));
+
+	if (group.offset != UNSIZED_GROUP && group.offset != read_offset(data)) {
+		al_log_error("group size does not match its contents");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	if (group.checked) {
+		uint32_t crc;
+		TRY(read_unhashed(data, &crc, 4));
+
+		if (data->verify && crc != group.crc) {
+			al_log_error("group checksum does not match its contents");
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+	}
+
+	TRY(end_reference(data));
+
+	PASS()
+}
+
+AlError al_data_read(AlData *data, AlDataItem *item)
+{
+	BEGIN()
+
+	if (data->eof) {
+		al_log_error("unexpected end of stream");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	if (data->scratch) {
+		al_arena_reset(data->scratch);
+	}
+
+	TRY(skip_pending_array(data));
+
+	uint8_t type;
+	size_t bytesRead = 1;
+
+	if (data->readCur != data->readEnd) {
+		type = *data->readCur++;
+	} else {
+		TRY(data_read_slow(data, &type, 1, &bytesRead));
+	}
+
+	if (bytesRead && type == AL_TOKEN_REFERENCE) {
+		TRY(follow_reference(data, &type));
+	}
+
+	item->array = false;
+
+	if (!bytesRead) {
+		data->eof = true;
+		type = AL_TOKEN_EOF;
+
+	} else {
+		switch (type) {
+			case AL_TOKEN_START:
+			case AL_TOKEN_SIZED_START:
+			case AL_TOKEN_CHECKED_START:
+			case AL_TOKEN_SIZED_CHECKED_START:
+				TRY(read_start(data, type, &item->value.groupSize));
+				type = AL_TOKEN_START;
+				break;
+
+			case AL_TOKEN_END:
+				TRY(read_end(data));
+				break;
+
+			case AL_TOKEN_TAG: TRY(read_tag(data, &item->value.tag)); break;
+			case AL_VAR_BOOL: TRY(read_bool(data, &item->value.boolVal)); break;
+			case AL_VAR_INT: TRY(read_int(data, &item->value.intVal)); break;
+			case AL_VAR_DOUBLE: TRY(read_double(data, &item->value.doubleVal)); break;
+			case AL_VAR_VEC2: TRY(read_vec2(data, &item->value.vec2)); break;
+			case AL_VAR_VEC3: TRY(read_vec3(data, &item->value.vec3)); break;
+			case AL_VAR_VEC4: TRY(read_vec4(data, &item->value.vec4)); break;
+			case AL_VAR_BOX2: TRY(read_box2(data, &item->value.box2)); break;
+			case AL_VAR_STRING:
+				TRY(read_string(data, &item->value.string.chars, &item->value.string.length));
+				break;
+			case AL_VAR_BLOB: TRY(read_blob(data, &item->value.blob)); break;
+
+			default: {
+				AlVarType itemType;
+				AlDataEncoding encoding;
+
+				if (!parse_array_type(type, &itemType, &encoding)) {
+					al_log_error("unknown value type: 0x%02x", type);
+					THROW(AL_ERROR_INVALID_DATA);
+				}
+
+				type = itemType;
+				item->array = true;
+				TRY(read_array(data, itemType, encoding, &item->value.array.items, &item->value.array.length));
+				break;
+			}
+		}
+	}
+
+	item->type = type;
+
+	PASS()
+}
+
+AlError al_data_skip_item(AlData *data, AlDataItem *item)
+{
+	BEGIN()
+
+	if (data->eof) {
+		al_log_error("unexpected end of stream");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	TRY(skip_pending_array(data));
+
+	uint8_t type;
+	size_t bytesRead = 1;
+
+	if (data->readCur != data->readEnd) {
+		type = *data->readCur++;
+	} else {
+		TRY(data_read_slow(data, &type, 1, &bytesRead));
+	}
+
+	item->array = false;
+
+	if (!bytesRead) {
+		data->eof = true;
+		type = AL_TOKEN_EOF;
+
+	} else {
+		switch (type) {
+			case AL_TOKEN_START:
+			case AL_TOKEN_SIZED_START:
+			case AL_TOKEN_CHECKED_START:
+			case AL_TOKEN_SIZED_CHECKED_START:
+				TRY(read_start(data, type, &item->value.groupSize));
+				type = AL_TOKEN_START;
+				break;
+
+			case AL_TOKEN_END:
+				TRY(read_end(data));
+				break;
+
+			case AL_TOKEN_TAG:
+				TRY(read_tag(data, &item->value.tag));
+				break;
+
+			case AL_TOKEN_REFERENCE:
+				TRY(read_reference(data, &item->value.reference.offset, &item->value.reference.size));
+				break;
+
+			case AL_VAR_BOOL:
+			case AL_VAR_INT:
+			case AL_VAR_DOUBLE:
+			case AL_VAR_VEC2:
+			case AL_VAR_VEC3:
+			case AL_VAR_VEC4:
+			case AL_VAR_BOX2:
+				TRY(skip_value(data, type));
+				break;
+
+			case AL_VAR_STRING:
+				item->value.string.chars = NULL;
+				TRY(read_uint(data, &item->value.string.length));
+				TRY(data_skip(data, item->value.string.length));
+				break;
+
+			case AL_VAR_BLOB: {
+				uint64_t length;
+				TRY(read_uint(data, &length));
+				TRY(data_skip(data, length));
+				item->value.blob = (AlBlob){NULL, length};
+				break;
+			}
+
+			default: {
+				AlVarType itemType;
+				AlDataEncoding encoding;
+				double scale;
+
+				if (!parse_array_type(type, &itemType, &encoding)) {
+					al_log_error("unknown value type: 0x%02x", type);
+					THROW(AL_ERROR_INVALID_DATA);
+				}
+
+				type = itemType;
+				item->array = true;
+				item->value.array.items = NULL;
+				TRY(read_array_header(data, itemType, encoding, &item->value.array.length, &scale));
+				TRY(skip_array_items(data, itemType, encoding, item->value.array.length));
+				break;
+			}
+		}
+	}
+
+	item->type = type;
+
+	PASS()
+}
+
+uint64_t al_data_get_offset(AlData *data)
+{
+	return read_offset(data);
+}
+
+AlError al_data_read_start(AlData *data, bool *atEnd)
+{
+	BEGIN()
+
+	AlDataItem item;
+	TRY(al_data_read(data, &item));
+
+	if (item.type == AL_TOKEN_END) {
+		if (atEnd) {
+			*atEnd = true;
+		} else {
+			al_log_error("unexpected end of group");
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+	} else if (item.type != AL_TOKEN_START) {
+		al_log_error("unexpected value, type: 0x%02x", item.type);
+		THROW(AL_ERROR_INVALID_DATA);
+
+	} else if (atEnd) {
+		*atEnd = false;
+	}
+
+	PASS()
+}
+
+AlError al_data_read_start_tag(AlData *data, AlDataTag expected, AlDataTag *actual)
+{
+	BEGIN()
+
+	AlDataItem item;
+	TRY(al_data_read(data, &item));
+
+	switch (item.type) {
+		case AL_TOKEN_START:
+			TRY(al_data_read(data, &item));
+			if (item.type != AL_TOKEN_TAG) {
+				al_log_error("missing expected tag");
+				THROW(AL_ERROR_INVALID_DATA);
+			}
+
+			if (expected != AL_ANY_TAG && item.value.tag != expected) {
+				al_log_error("unexpected tag: 0x%04x", item.value.tag);
+				THROW(AL_ERROR_INVALID_DATA);
+			}
+
+			if (actual) {
+				*actual = item.value.tag;
+			}
+			break;
+
+		case AL_TOKEN_END:
+			if (expected != AL_ANY_TAG) {
+				al_log_error("unexpected end of group");
+				THROW(AL_ERROR_INVALID_DATA);
+			}
+
+			*actual = AL_NO_TAG;
+			break;
+
+		default:
+			al_log_error("unexpected value, type: 0x%02x", item.type);
+			THROW(AL_ERROR_INVALID_DATA);
+	}
+	
+	PASS()
+}
+
+AlError al_data_read_value(AlData *data, AlVarType type, void *value, bool *atEnd)
+{
+	BEGIN()
+
+	AlDataItem item;
+	TRY(al_data_read(data, &item));
+
+	if (item.type == AL_TOKEN_END) {
+		if (atEnd) {
+			*atEnd = true;
+		} else {
+			al_log_error("unexpected end of group");
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+	} else if (item.type != type) {
+		al_log_error("value is unexpected type: 0x%02x, expecting: 0x%02x", item.type, type);
+		THROW(AL_ERROR_INVALID_DATA);
+
+	} else if (item.array) {
+		al_log_error("unexpected array");
+		THROW(AL_ERROR_INVALID_DATA);
+
+	} else {
+		if (atEnd) {
+			*atEnd = false;
+		}
+
+		switch (type) {
+			case AL_VAR_BOOL: *(bool *)value = item.value.boolVal; break;
+			case AL_VAR_INT: *(int *)value = item.value.intVal; break;
+			case AL_VAR_DOUBLE: *(double *)value = item.value.doubleVal; break;
+			case AL_VAR_VEC2: *(Vec2 *)value = item.value.vec2; break;
+			case AL_VAR_VEC3: *(Vec3 *)value = item.value.vec3; break;
+			case AL_VAR_VEC4: *(Vec4 *)value = item.value.vec4; break;
+			case AL_VAR_BOX2: *(Box2 *)value = item.value.box2; break;
+			case AL_VAR_STRING: *(char **)value = item.value.string.chars; break;
+			case AL_VAR_BLOB: *(AlBlob *)value = item.value.blob; break;
+		}
+	}
+
+	PASS()
+}
+
+/**
+ * Read an array item of an expected type, leaving the array owned by the
+ * AlData object.
+ */
+static AlError read_array_item(AlData *data, AlVarType type, void **values, uint64_t *count, bool *atEnd)
+{
+	BEGIN()
+
+	AlDataItem item;
+	TRY(al_data_read(data, &item));
+
+	if (item.type == AL_TOKEN_END) {
+		if (atEnd) {
+			*atEnd = true;
+		} else {
+			al_log_error("unexpected end of group");
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+	} else if (item.type != type) {
+		if (item.array) {
+			free_value(data, item.value.array.items, data->readOwned);
+		}
+
+		al_log_error("value is unexpected type: 0x%02x, expecting: 0x%02x", item.type, type);
+		THROW(AL_ERROR_INVALID_DATA);
+
+	} else if (!item.array) {
+		al_log_error("unexpected single value");
+		THROW(AL_ERROR_INVALID_DATA);
+
+	} else {
+		if (atEnd) {
+			*atEnd = false;
+		}
+
+		*values = item.value.array.items;
+		*count = item.value.array.length;
+	}
+
+	PASS()
+}
+
+AlError al_data_read_array(AlData *data, AlVarType type, void *values, uint64_t *count, bool *atEnd)
+{
+	BEGIN()
+
+	data->readOwned = true;
+	TRY(read_array_item(data, type, values, count, atEnd));
+
+	PASS({
+		data->readOwned = false;
+	})
+}
+
+AlError al_data_borrow_array(AlData *data, AlVarType type, const void *values, uint64_t *count, bool *atEnd)
+{
+	return read_array_item(data, type, (void **)values, count, atEnd);
+}
+
+AlError al_data_read_array_length(AlData *data, AlVarType type, uint64_t *count, bool *atEnd)
+{
+	BEGIN()
+
+	if (data->scratch) {
+		al_arena_reset(data->scratch);
+	}
+
+	TRY(skip_pending_array(data));
+
+	uint8_t byte;
+	AlVarType itemType;
+	AlDataEncoding encoding;
+	TRY(read_byte(data, &byte));
+
+	if (byte == AL_TOKEN_END) {
+		TRY(read_end(data));
+
+		if (atEnd) {
+			*atEnd = true;
+		} else {
+			al_log_error("unexpected end of group");
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+	} else if (!parse_array_type(byte, &itemType, &encoding) || itemType != type) {
+		al_log_error("value is unexpected type: 0x%02x, expecting array of: 0x%02x", byte, type);
+		THROW(AL_ERROR_INVALID_DATA);
+
+	} else {
+		if (atEnd) {
+			*atEnd = false;
+		}
+
+		TRY(read_array_header(data, type, encoding, count, &data->pendingScale));
+
+		data->arrayPending = true;
+		data->pendingType = type;
+		data->pendingEncoding = encoding;
+		data->pendingCount = *count;
+	}
+
+	PASS()
+}
+
+AlError al_data_read_array_into(AlData *data, AlVarType type, void *dst, size_t stride, uint64_t capacity, uint64_t *count, bool *atEnd)
+{
+	BEGIN()
+
+	if (is_packed_type(type)) {
+		al_log_error("arrays of strings and blobs can't be read into caller memory");
+		THROW(AL_ERROR_INVALID_OPERATION);
+	}
+
+	if (!data->arrayPending) {
+		bool end = false;
+		uint64_t length;
+		TRY(al_data_read_array_length(data, type, &length, &end));
+
+		if (end) {
+			if (atEnd) {
+				*atEnd = true;
+			} else {
+				al_log_error("unexpected end of group");
+				THROW(AL_ERROR_INVALID_DATA);
+			}
+			RETURN();
+		}
+
+	} else if (data->pendingType != type) {
+		al_log_error("array is unexpected type: 0x%02x, expecting: 0x%02x", data->pendingType, type);
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	if (atEnd) {
+		*atEnd = false;
+	}
+
+	uint64_t length = data->pendingCount;
+	uint64_t n = (length < capacity) ? length : capacity;
+	data->arrayPending = false;
+
+	TRY(read_items(data, type, data->pendingEncoding, data->pendingScale, dst, stride, n));
+	TRY(skip_array_items(data, type, data->pendingEncoding, length - n));
+
+	if (count) {
+		*count = length;
+	}
+
+	PASS()
+}
+
+/**
+ * Read over the items in the current group, including its end token.
+ * Nested groups are opened and closed as they are read rather than by
+ * recursing, so they are limited by the maximum depth and their checksums
+ * are verified. Sized groups are seeked over unless a checksum needs them.
+ */
+static AlError skip_group(AlData *data)
+{
+	BEGIN()
+
+	size_t depth = data->numGroups;
+	do {
+		uint8_t type;
+		TRY(read_byte(data, &type));
+
+		switch (type) {
+			case AL_TOKEN_START:
+			case AL_TOKEN_CHECKED_START:
+			case AL_TOKEN_SIZED_START:
+			case AL_TOKEN_SIZED_CHECKED_START: {
+				bool sized = (type == AL_TOKEN_SIZED_START || type == AL_TOKEN_SIZED_CHECKED_START);
+				bool checked = (type == AL_TOKEN_CHECKED_START || type == AL_TOKEN_SIZED_CHECKED_START);
+
+				if (sized && data->hashGroup == NO_GROUP && !(checked && data->verify)) {
+					uint64_t size;
+					TRY(data_read(data, &size, 8));
+					TRY(data_skip(data, size + (checked ? 4 : 0)));
+
+				} else {
+					uint64_t size;
+					TRY(read_start(data, type, &size));
+				}
+				break;
+			}
+
+			case AL_TOKEN_END:
+				TRY(read_end(data));
+				break;
+
+			case AL_TOKEN_TAG: TRY(data_skip(data, 4)); break;
+
+			case AL_TOKEN_REFERENCE: {
+				uint64_t offset, size;
+				TRY(read_reference(data, &offset, &size));
+				break;
+			}
+
+			case AL_VAR_BOOL:
+			case AL_VAR_INT:
+			case AL_VAR_DOUBLE:
+			case AL_VAR_VEC2:
+			case AL_VAR_VEC3:
+			case AL_VAR_VEC4:
+			case AL_VAR_BOX2:
+			case AL_VAR_STRING:
+			case AL_VAR_BLOB:
+				TRY(skip_value(data, type));
+				break;
+
+			default: {
+				AlVarType itemType;
+				AlDataEncoding encoding;
+
+				if (!parse_array_type(type, &itemType, &encoding)) {
+					al_log_error("unknown value type: 0x%02x", type);
+					THROW(AL_ERROR_INVALID_DATA);
+				}
+
+				TRY(skip_array(data, itemType, encoding));
+				break;
+			}
+		}
+	} while (data->numGroups >= depth);
+
+	PASS()
+}
+
+AlError al_data_skip_rest(AlData *data)
+{
+	BEGIN()
+
+	TRY(skip_pending_array(data));
+
+	if (data->numGroups > 0 && data->groups[data->numGroups - 1].offset != UNSIZED_GROUP &&
+		data->hashGroup == NO_GROUP) {
+		Group group;
+		TRY(pop_group(data, &group));
+
+		uint64_t offset = read_offset(data);
+		if (group.offset < offset) {
+			al_log_error("read past the end of group");
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+		TRY(data_skip(data, group.offset - offset + (group.checked ? 4 : 0)));
+		TRY(end_reference(data));
+
+	} else {
+		TRY(skip_group(data));
+	}
+
+	PASS()
+}
+
+/**
+ * Read a single value of a known type, after its type byte, into the same
+ * representation al_data_read_value() uses.
+ */
+static AlError read_typed_value(AlData *data, AlVarType type, void *value)
+{
+	BEGIN()
+
+	switch (type) {
+		case AL_VAR_BOOL: TRY(read_bool(data, value)); break;
+		case AL_VAR_INT: TRY(read_int(data, value)); break;
+		case AL_VAR_DOUBLE: TRY(read_double(data, value)); break;
+		case AL_VAR_VEC2: TRY(read_vec2(data, value)); break;
+		case AL_VAR_VEC3: TRY(read_vec3(data, value)); break;
+		case AL_VAR_VEC4: TRY(read_vec4(data, value)); break;
+		case AL_VAR_BOX2: TRY(read_box2(data, value)); break;
+		case AL_VAR_STRING: TRY(read_string(data, value, NULL)); break;
+		case AL_VAR_BLOB: TRY(read_blob(data, value)); break;
+		default:
+			al_log_error("unknown value type: 0x%02x", type);
+			THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	PASS()
+}
+
+static AlError parse_value(AlData *data, const AlDataHandler *handler, void *context, AlVarType type)
+{
+	BEGIN()
+
+	union {
+		bool boolVal;
+		int32_t intVal;
+		double doubleVal;
+		Vec2 vec2;
+		Vec3 vec3;
+		Vec4 vec4;
+		Box2 box2;
+		char *string;
+		AlBlob blob;
+	} value;
+
+	if (!handler->value) {
+		switch (type) {
+			case AL_VAR_STRING: TRY(skip_string(data)); RETURN();
+			case AL_VAR_BLOB: TRY(skip_blob(data)); RETURN();
+			default: break;
+		}
+	}
+
+	TRY(read_typed_value(data, type, &value));
+
+	if (handler->value) {
+		TRY(handler->value(context, type, &value));
+	}
+
+	PASS()
+}
+
+static AlError parse_array(AlData *data, const AlDataHandler *handler, void *context, AlVarType type, AlDataEncoding encoding)
+{
+	BEGIN()
+
+	uint64_t count;
+	double scale;
+	TRY(read_array_header(data, type, encoding, &count, &scale));
+
+	if (handler->arrayStart) {
+		TRY(handler->arrayStart(context, type, count));
+	}
+
+	if (!handler->arrayChunk) {
+		TRY(skip_array_items(data, type, encoding, count));
+		RETURN();
+	}
+
+	if (is_packed_type(type)) {
+		void *items;
+		TRY(read_packed_items(data, type, count, false, &items));
+		if (count > 0) {
+			TRY(handler->arrayChunk(context, type, items, count));
+		}
+		RETURN();
+	}
+
+	double chunk[PARSE_CHUNK_SIZE / sizeof(double)];
+	size_t itemSize = get_var_size(type);
+	uint64_t chunkLength = sizeof(chunk) / itemSize;
+	int64_t previous[4] = {0, 0, 0, 0};
+
+	while (count > 0) {
+		uint64_t n = (count < chunkLength) ? count : chunkLength;
+		const void *items = NULL;
+
+		if (encoding == AL_DATA_ENCODING_RAW && is_raw_type(type)) {
+			items = borrow_bytes(data, itemSize * n, sizeof(double));
+		}
+
+		if (!items) {
+			if (encoding == AL_DATA_ENCODING_DELTA) {
+				TRY(read_delta_items(data, type, scale, previous, (uint8_t *)chunk, itemSize, n));
+			} else {
+				TRY(read_items(data, type, encoding, scale, chunk, itemSize, n));
+			}
+			items = chunk;
+		}
+
+		TRY(handler->arrayChunk(context, type, items, n));
+		count -= n;
+	}
+
+	PASS()
+}
+
+AlError al_data_parse(AlData *data, const AlDataHandler *handler, void *context)
+{
+	BEGIN()
+
+	if (data->eof) {
+		al_log_error("unexpected end of stream");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	TRY(skip_pending_array(data));
+
+	while (true) {
+		if (data->scratch) {
+			al_arena_reset(data->scratch);
+		}
+
+		uint8_t type;
+		size_t bytesRead = 1;
+
+		if (data->readCur != data->readEnd) {
+			type = *data->readCur++;
+		} else {
+			TRY(data_read_slow(data, &type, 1, &bytesRead));
+		}
+
+		if (!bytesRead) {
+			data->eof = true;
+			break;
+		}
+
+		if (type == AL_TOKEN_REFERENCE) {
+			TRY(follow_reference(data, &type));
+		}
+
+		switch (type) {
+			case AL_TOKEN_START:
+			case AL_TOKEN_SIZED_START:
+			case AL_TOKEN_CHECKED_START:
+			case AL_TOKEN_SIZED_CHECKED_START: {
+				uint64_t size;
+				TRY(read_start(data, type, &size));
+				if (handler->startGroup) {
+					TRY(handler->startGroup(context, size));
+				}
+				break;
+			}
+
+			case AL_TOKEN_END:
+				TRY(read_end(data));
+				if (handler->endGroup) {
+					TRY(handler->endGroup(context));
+				}
+				break;
+
+			case AL_TOKEN_TAG: {
+				AlDataTag tag;
+				TRY(read_tag(data, &tag));
+				if (handler->tag) {
+					TRY(handler->tag(context, tag));
+				}
+				break;
+			}
+
+			case AL_VAR_BOOL:
+			case AL_VAR_INT:
+			case AL_VAR_DOUBLE:
+			case AL_VAR_VEC2:
+			case AL_VAR_VEC3:
+			case AL_VAR_VEC4:
+			case AL_VAR_BOX2:
+			case AL_VAR_STRING:
+			case AL_VAR_BLOB:
+				TRY(parse_value(data, handler, context, type));
+				break;
+
+			default: {
+				AlVarType itemType;
+				AlDataEncoding encoding;
+
+				if (!parse_array_type(type, &itemType, &encoding)) {
+					al_log_error("unknown value type: 0x%02x", type);
+					THROW(AL_ERROR_INVALID_DATA);
+				}
+
+				TRY(parse_array(data, handler, context, itemType, encoding));
+				break;
+			}
+		}
+	}
+
+	PASS()
+}
+
+static inline size_t get_tag_slot(AlDataTag tag, int bits)
+{
+	return (uint32_t)(tag * TAG_HASH) >> (32 - bits);
+}
+
+static const AlDataField *find_field(const AlDataStruct *desc, AlDataTag tag)
+{
+	size_t mask = ((size_t)1 << desc->slotBits) - 1;
+
+	for (size_t slot = get_tag_slot(tag, desc->slotBits); desc->slots[slot]; slot = (slot + 1) & mask) {
+		const AlDataField *field = &desc->fields[desc->slots[slot] - 1];
+		if (field->tag == tag) {
+			return field;
+		}
+	}
+
+	return NULL;
+}
+
+AlError al_data_struct_init(AlDataStruct **result, const AlDataField *fields, size_t numFields)
+{
+	BEGIN()
+
+	AlDataStruct *desc = NULL;
+	TRY(al_malloc(&desc, sizeof(AlDataStruct)));
+
+	desc->fields = NULL;
+	desc->numFields = numFields;
+	desc->slots = NULL;
+
+	// At most half full, so lookups of missing tags end quickly
+	desc->slotBits = 3;
+	while (((size_t)1 << desc->slotBits) < numFields * 2) {
+		desc->slotBits++;
+	}
+
+	size_t numSlots = (size_t)1 << desc->slotBits;
+
+	TRY(al_malloc(&desc->fields, sizeof(AlDataField) * (numFields ? numFields : 1)));
+	TRY(al_malloc(&desc->slots, sizeof(size_t) * numSlots));
+	memset(desc->slots, 0, sizeof(size_t) * numSlots);
+
+	for (size_t i = 0; i < numFields; i++) {
+		const AlDataField *field = &fields[i];
+
+		if (field->tag == AL_NO_TAG || field->tag == AL_ANY_TAG) {
+			al_log_error("invalid tag for struct field");
+			THROW(AL_ERROR_INVALID_OPERATION);
+		}
+
+		if (field->array) {
+			if (!field->array->numMembers || !field->array->itemSize) {
+				al_log_error("array struct field has no members");
+				THROW(AL_ERROR_INVALID_OPERATION);
+			}
+
+			for (size_t j = 0; j < field->array->numMembers; j++) {
+				AlVarType type = field->array->members[j].type;
+
+				if (type > AL_VAR_BLOB || is_packed_type(type)) {
+					al_log_error("invalid type for array struct field member: 0x%02x", type);
+					THROW(AL_ERROR_INVALID_OPERATION);
+				}
+			}
+
+		} else if (field->type > AL_VAR_BLOB) {
+			al_log_error("unknown value type: 0x%02x", field->type);
+			THROW(AL_ERROR_INVALID_OPERATION);
+		}
+
+		if (find_field(desc, field->tag)) {
+			al_log_error("tag used for more than one struct field: 0x%04x", field->tag);
+			THROW(AL_ERROR_INVALID_OPERATION);
+		}
+
+		size_t slot = get_tag_slot(field->tag, desc->slotBits);
+		while (desc->slots[slot]) {
+			slot = (slot + 1) & (numSlots - 1);
+		}
+
+		desc->fields[i] = *field;
+		desc->slots[slot] = i + 1;
+	}
+
+	*result = desc;
+
+	CATCH(
+		al_data_struct_free(desc);
+	)
+	FINALLY()
+}
+
+void al_data_struct_free(AlDataStruct *desc)
+{
+	if (desc) {
+		al_free(desc->fields);
+		al_free(desc->slots);
+		al_free(desc);
+	}
+}
+
+/**
+ * Read the group of arrays of an array field into newly allocated items.
+ * This doesn't go through al_data_read_array_length(), which would reset
+ * scratch memory holding strings already read into the struct.
+ * @param[out] atEnd Set to true if the end of the group was read
+ */
+static AlError read_array_field(AlData *data, const AlDataArray *array, void **result, uint64_t *resultCount, bool *atEnd)
+{
+	BEGIN()
+
+	uint8_t *items = NULL;
+	uint64_t count = 0;
+
+	if (*result) {
+		al_log_error("array struct field found more than once");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	*atEnd = false;
+
+	for (size_t i = 0; i < array->numMembers; i++) {
+		const AlDataMember *member = &array->members[i];
+
+		uint8_t byte;
+		TRY(read_byte(data, &byte));
+
+		if (byte == AL_TOKEN_END && i > 0) {
+			TRY(read_end(data));
+			*atEnd = true;
+			break;
+		}
+
+		AlVarType type;
+		AlDataEncoding encoding;
+		if (!parse_array_type(byte, &type, &encoding) || type != member->type) {
+			al_log_error("value is unexpected type: 0x%02x, expecting array of: 0x%02x", byte, member->type);
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+		uint64_t length;
+		double scale;
+		TRY(read_array_header(data, type, encoding, &length, &scale));
+
+		if (i == 0) {
+			if (length > SIZE_MAX / array->itemSize) {
+				al_log_error("array too large to fit in memory");
+				THROW(AL_ERROR_MEMORY);
+			}
+
+			count = length;
+			TRY(al_malloc(&items, array->itemSize * count));
+
+			if (array->init) {
+				array->init(items, count);
+			}
+
+		} else if (length != count) {
+			al_log_error("arrays of struct field have different lengths");
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+		if (count > 0) {
+			TRY(read_items(data, type, encoding, scale, items + member->offset, array->itemSize, count));
+		}
+	}
+
+	*result = items;
+	*resultCount = count;
+
+	CATCH({
+		al_free(items);
+	})
+	FINALLY()
+}
+
+AlError al_data_read_struct(AlData *data, const AlDataStruct *desc, void *dst)
+{
+	BEGIN()
+
+	uint8_t *base = dst;
+
+	if (data->scratch) {
+		al_arena_reset(data->scratch);
+	}
+
+	TRY(skip_pending_array(data));
+
+	while (true) {
+		uint8_t token;
+		TRY(read_byte(data, &token));
+
+		if (token == AL_TOKEN_END) {
+			TRY(read_end(data));
+			break;
+		}
+
+		if (token == AL_TOKEN_REFERENCE) {
+			TRY(follow_reference(data, &token));
+		}
+
+		if (!is_start_token(token)) {
+			al_log_error("unexpected value, type: 0x%02x", token);
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+		uint64_t size;
+		TRY(read_start(data, token, &size));
+
+		AlDataTag tag;
+		TRY(read_byte(data, &token));
+		if (token != AL_TOKEN_TAG) {
+			al_log_error("missing expected tag");
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+		TRY(read_tag(data, &tag));
+
+		const AlDataField *field = find_field(desc, tag);
+		bool atEnd = false;
+
+		if (field && field->array) {
+			TRY(read_array_field(data, field->array, (void **)(base + field->offset),
+				(uint64_t *)(base + field->array->countOffset), &atEnd));
+
+		} else if (field) {
+			TRY(read_byte(data, &token));
+			if (token != field->type) {
+				al_log_error("value is unexpected type: 0x%02x, expecting: 0x%02x", token, field->type);
+				THROW(AL_ERROR_INVALID_DATA);
+			}
+
+			TRY(read_typed_value(data, field->type, base + field->offset));
+		}
+
+		if (!atEnd) {
+			TRY(al_data_skip_rest(data));
+		}
+	}
+
+	PASS()
+}
+
+AlError al_data_write_struct(AlData *data, const AlDataStruct *desc, const void *src)
+{
+	BEGIN()
+
+	const uint8_t *base = src;
+
+	for (size_t i = 0; i < desc->numFields; i++) {
+		const AlDataField *field = &desc->fields[i];
+		const void *value = base + field->offset;
+
+		if (field->array) {
+			const uint8_t *items = *(const uint8_t *const *)value;
+			uint64_t count = *(const uint64_t *)(base + field->array->countOffset);
+
+			TRY(al_data_write_start_tag(data, field->tag));
+
+			for (size_t j = 0; j < field->array->numMembers; j++) {
+				const AlDataMember *member = &field->array->members[j];
+				TRY(al_data_write_array_strided(data, member->type, items + member->offset, field->array->itemSize, count));
+			}
+
+			TRY(al_data_write_end(data));
+			continue;
+		}
+
+		if (field->type == AL_VAR_STRING) {
+			value = *(const char *const *)value;
+		}
+
+		TRY(al_data_write_simple_tag(data, field->tag, field->type, value));
+	}
+
+	PASS()
+}
+
+void al_data_set_sized_groups(AlData *data, bool sized)
+{
+	data->writeSized = sized;
+}
+
+void al_data_set_checksums(AlData *data, bool checksums)
+{
+	data->writeChecked = checksums;
+}
+
+void al_data_set_verify(AlData *data, bool verify)
+{
+	data->verify = verify;
+}
+
+void al_data_set_deduplicate(AlData *data, bool deduplicate)
+{
+	data->writeDeduplicate = deduplicate;
+}
+
+/**
+ * Fill in the length field of a sized group that has just been ended.
+ * The field is patched in the write buffer if it is still there, otherwise
+ * the stream is seeked back to it.
+ */
+static AlError patch_group_size(AlData *data, uint64_t offset)
+{
+	BEGIN()
+
+	uint64_t size = write_offset(data) - (offset + 8);
+
+	if (offset >= data->writeOffset) {
+		memcpy(data->writeBuffer + (offset - data->writeOffset), &size, 8);
+
+	} else {
+		int64_t end;
+		TRY(al_data_flush(data));
+		TRY(data->stream->tell(data->stream, &end));
+		TRY(data->stream->seek(data->stream, end - (int64_t)(data->writeOffset - offset), AL_SEEK_SET));
+		TRY(data->stream->write(data->stream, &size, 8));
+		TRY(data->stream->seek(data->stream, end, AL_SEEK_SET));
+	}
+
+	PASS()
+}
+
+/**
+ * Write bytes that aren't part of any group's checksum.
+ */
+static AlError write_unhashed(AlData *data, const void *ptr, size_t size)
+{
+	BEGIN()
+
+	size_t hashGroup = data->hashGroup;
+
+	hash_write(data);
+	data->hashGroup = NO_GROUP;
+
+	TRY(data_write(data, ptr, size));
+
+	PASS({
+		hash_write(data);
+		data->hashGroup = hashGroup;
+	})
+}
+
+static inline size_t get_written_slot(uint32_t hash, int bits)
+{
+	return (hash * TAG_HASH) >> (32 - bits);
+}
+
+static void add_written_slot(AlData *data, size_t index)
+{
+	size_t mask = ((size_t)1 << data->writtenSlotBits) - 1;
+	size_t slot = get_written_slot(data->written[index].hash, data->writtenSlotBits);
+
+	while (data->writtenSlots[slot]) {
+		slot = (slot + 1) & mask;
+	}
+
+	data->writtenSlots[slot] = index + 1;
+	data->written[index].slot = slot;
+}
+
+/**
+ * Keep the key of a group that has just been written, for later copies of it
+ * to refer to.
+ */
+static AlError add_written(AlData *data, uint64_t offset, size_t size, const uint8_t *key, size_t keySize, uint32_t hash)
+{
+	BEGIN()
+
+	uint8_t *copy = NULL;
+
+	if ((data->numWritten + 1) * 2 > ((size_t)1 << data->writtenSlotBits)) {
+		int bits = data->writtenSlotBits ? data->writtenSlotBits + 1 : 6;
+		size_t numSlots = (size_t)1 << bits;
+
+		TRY(al_realloc(&data->writtenSlots, sizeof(size_t) * numSlots));
+		memset(data->writtenSlots, 0, sizeof(size_t) * numSlots);
+		data->writtenSlotBits = bits;
+
+		// Added back in order, so the latest groups can still be removed
+		for (size_t i = 0; i < data->numWritten; i++) {
+			add_written_slot(data, i);
+		}
+	}
+
+	if (data->numWritten == data->writtenLength) {
+		size_t length = data->writtenLength ? data->writtenLength * 2 : 64;
+		TRY(al_realloc(&data->written, sizeof(WrittenGroup) * length));
+		data->writtenLength = length;
+	}
+
+	TRY(al_malloc(&copy, keySize));
+	memcpy(copy, key, keySize);
+
+	data->written[data->numWritten] = (WrittenGroup){
+		.offset = offset,
+		.size = size,
+		.hash = hash,
+		.key = copy,
+		.keySize = keySize
+	};
+	add_written_slot(data, data->numWritten++);
+
+	CATCH({
+		al_free(copy);
+	})
+	FINALLY()
+}
+
+static const WrittenGroup *find_written(AlData *data, const uint8_t *key, size_t keySize, uint32_t hash)
+{
+	if (!data->writtenSlots) {
+		return NULL;
+	}
+
+	size_t mask = ((size_t)1 << data->writtenSlotBits) - 1;
+	size_t slot = get_written_slot(hash, data->writtenSlotBits);
 
-		switch (type) {
-			case AL_VAR_BOOL: TRY(write_bool(data, value)); break;
-			case AL_VAR_INT: TRY(write_int(data, value)); break;
-			case AL_VAR_DOUBLE: TRY(write_double(data, value)); break;
-			case AL_VAR_VEC2: TRY(write_vec2(data, value)); break;
-			case AL_VAR_VEC3: TRY(write_vec3(data, value)); break;
-			case AL_VAR_VEC4: TRY(write_vec4(data, value)); break;
-			case AL_VAR_BOX2: TRY(write_box2(data, value)); break;
+	while (data->writtenSlots[slot]) {
+		const WrittenGroup *written = &data->written[data->writtenSlots[slot] - 1];
 
-			case AL_VAR_STRING:
-				al_log_error("arrays of strings not supported");
-				THROW(AL_ERROR_INVALID_OPERATION);
-			case AL_VAR_BLOB:
-				al_log_error("arrays of blobs not supported");
-				THROW(AL_ERROR_INVALID_OPERATION);
-			default:
-				al_log_error("unknown value type: 0x%02x", type);
-				THROW(AL_ERROR_INVALID_OPERATION);
+		if (written->hash == hash && written->keySize == keySize && !memcmp(written->key, key, keySize)) {
+			return written;
 		}
+
+		slot = (slot + 1) & mask;
 	}
 
-	PASS()
+	return NULL;
 }
 
-static AlError skip_array(AlData *data, AlVarType type)
+/**
+ * Forget groups from offset on, once they have been taken back out of the
+ * write buffer. They are the latest added, so nothing added after them can
+ * have probed past their slots and clearing the slots is enough.
+ */
+static void remove_written(AlData *data, uint64_t offset)
 {
-	BEGIN()
-
-	uint64_t count;
-	TRY(read_uint(data, &count));
+	while (data->numWritten > 0 && data->written[data->numWritten - 1].offset >= offset) {
+		WrittenGroup *written = &data->written[--data->numWritten];
+		data->writtenSlots[written->slot] = 0;
+		al_free(written->key);
+	}
+}
 
-	for (uint64_t i = 0; i < count; i++) {
-		switch (type) {
-			case AL_VAR_BOOL: TRY(data_seek(data, 1, AL_SEEK_CUR)); break;
-			case AL_VAR_INT: TRY(skip_uint(data)); break;
-			case AL_VAR_DOUBLE: TRY(data_seek(data, 8, AL_SEEK_CUR)); break;
-			case AL_VAR_VEC2: TRY(data_seek(data, 16, AL_SEEK_CUR)); break;
-			case AL_VAR_VEC3: TRY(data_seek(data, 24, AL_SEEK_CUR)); break;
-			case AL_VAR_VEC4: TRY(data_seek(data, 32, AL_SEEK_CUR)); break;
-			case AL_VAR_BOX2: TRY(data_seek(data, 32, AL_SEEK_CUR)); break;
+/**
+ * Find the first of the references written from offset on.
+ */
+static size_t find_write_reference(AlData *data, uint64_t offset)
+{
+	size_t first = data->numWriteReferences;
 
-			case AL_VAR_STRING:
-				al_log_error("arrays of strings not supported");
-				THROW(AL_ERROR_INVALID_DATA);
-			case AL_VAR_BLOB:
-				al_log_error("arrays of blobs not supported");
-				THROW(AL_ERROR_INVALID_DATA);
-			default:
-				al_log_error("unknown value type: 0x%02x", type);
-				THROW(AL_ERROR_INVALID_DATA);
-		}
+	while (first > 0 && data->writeReferences[first - 1].offset >= offset) {
+		first--;
 	}
 
-	PASS()
+	return first;
 }
 
-AlError al_data_read(AlData *data, AlDataItem *item)
+/**
+ * Get the key of a group that is in the write buffer. It's the group's own
+ * bytes unless there are references in it, which are given with the offset
+ * they refer to rather than their distance.
+ */
+static AlError get_key(AlData *data, uint64_t start, const uint8_t *bytes, size_t size, const uint8_t **key, size_t *keySize)
 {
 	BEGIN()
 
-	if (data->eof) {
-		al_log_error("unexpected end of stream");
-		THROW(AL_ERROR_INVALID_DATA);
-	}
+	size_t first = find_write_reference(data, start);
 
-	uint8_t type;
-	size_t bytesRead;
-	data->stream->read(data->stream, &type, 1, &bytesRead);
+	if (first == data->numWriteReferences) {
+		*key = bytes;
+		*keySize = size;
+		RETURN();
+	}
 
-	item->array = false;
+	size_t length = size + (data->numWriteReferences - first) * 21;
 
-	if (!bytesRead) {
-		data->eof = true;
-		type = AL_TOKEN_EOF;
+	if (length > data->writeKeyLength) {
+		TRY(al_realloc(&data->writeKey, length));
+		data->writeKeyLength = length;
+	}
 
-	} else {
-		switch (type) {
-			case AL_TOKEN_START:
-			case AL_TOKEN_END:
-				break;
+	uint8_t *cur = data->writeKey;
+	size_t done = 0;
 
-			case AL_TOKEN_TAG: TRY(read_tag(data, &item->value.tag)); break;
-			case AL_VAR_BOOL: TRY(read_bool(data, &item->value.boolVal)); break;
-			case AL_VAR_INT: TRY(read_int(data, &item->value.intVal)); break;
-			case AL_VAR_DOUBLE: TRY(read_double(data, &item->value.doubleVal)); break;
-			case AL_VAR_VEC2: TRY(read_vec2(data, &item->value.vec2)); break;
-			case AL_VAR_VEC3: TRY(read_vec3(data, &item->value.vec3)); break;
-			case AL_VAR_VEC4: TRY(read_vec4(data, &item->value.vec4)); break;
-			case AL_VAR_BOX2: TRY(read_box2(data, &item->value.box2)); break;
-			case AL_VAR_STRING:
-				TRY(read_string(data, &item->value.string.chars, &item->value.string.length));
-				break;
-			case AL_VAR_BLOB: TRY(read_blob(data, &item->value.blob)); break;
+	for (size_t i = first; i < data->numWriteReferences; i++) {
+		const WrittenReference *reference = &data->writeReferences[i];
+		size_t at = reference->offset - start;
 
-			case AL_VAR_BOOL | 0x80:
-			case AL_VAR_INT | 0x80:
-			case AL_VAR_DOUBLE | 0x80:
-			case AL_VAR_VEC2 | 0x80:
-			case AL_VAR_VEC3 | 0x80:
-			case AL_VAR_VEC4 | 0x80:
-			case AL_VAR_BOX2 | 0x80:
-				type &= 0x7F;
-				item->array = true;
-				TRY(read_array(data, type, &item->value.array.items, &item->value.array.length));
-				break;
+		memcpy(cur, bytes + done, at - done);
+		cur += at - done;
 
-			default:
-				al_log_error("unknown value type: 0x%02x", type);
-				THROW(AL_ERROR_INVALID_DATA);
-		}
+		*cur++ = AL_TOKEN_REFERENCE;
+		cur += encode_uint(cur, reference->target);
+		cur += encode_uint(cur, reference->size);
+		done = at + reference->length;
 	}
 
-	item->type = type;
+	memcpy(cur, bytes + done, size - done);
+	cur += size - done;
+
+	*key = data->writeKey;
+	*keySize = cur - data->writeKey;
 
 	PASS()
 }
 
-AlError al_data_read_start(AlData *data, bool *atEnd)
+static AlError add_write_reference(AlData *data, uint64_t offset, uint64_t target, uint64_t size, size_t length)
 {
 	BEGIN()
 
-	AlDataItem item;
-	TRY(al_data_read(data, &item));
-
-	if (item.type == AL_TOKEN_END) {
-		if (atEnd) {
-			*atEnd = true;
-		} else {
-			al_log_error("unexpected end of group");
-			THROW(AL_ERROR_INVALID_DATA);
-		}
-
-	} else if (item.type != AL_TOKEN_START) {
-		al_log_error("unexpected value, type: 0x%02x", item.type);
-		THROW(AL_ERROR_INVALID_DATA);
-
-	} else if (atEnd) {
-		*atEnd = false;
+	if (data->numWriteReferences == data->writeReferencesLength) {
+		size_t length = data->writeReferencesLength ? data->writeReferencesLength * 2 : 16;
+		TRY(al_realloc(&data->writeReferences, sizeof(WrittenReference) * length));
+		data->writeReferencesLength = length;
 	}
 
+	data->writeReferences[data->numWriteReferences++] = (WrittenReference){
+		.offset = offset,
+		.target = target,
+		.size = size,
+		.length = length
+	};
+
 	PASS()
 }
 
-AlError al_data_read_start_tag(AlData *data, AlDataTag expected, AlDataTag *actual)
+/**
+ * Replace a group that has just been ended with a reference, if an earlier
+ * group has the same contents, otherwise remember it for later groups. Only
+ * groups that are still entirely in the write buffer are looked at, so
+ * neither are any groups around one that isn't.
+ */
+static AlError deduplicate_group(AlData *data, const Group *group)
 {
 	BEGIN()
 
-	AlDataItem item;
-	TRY(al_data_read(data, &item));
-
-	switch (item.type) {
-		case AL_TOKEN_START:
-			TRY(al_data_read(data, &item));
-			if (item.type != AL_TOKEN_TAG) {
-				al_log_error("missing expected tag");
-				THROW(AL_ERROR_INVALID_DATA);
-			}
-
-			if (expected != AL_ANY_TAG && item.value.tag != expected) {
-				al_log_error("unexpected tag: 0x%04x", item.value.tag);
-				THROW(AL_ERROR_INVALID_DATA);
-			}
-
-			if (actual) {
-				*actual = item.value.tag;
-			}
-			break;
-
-		case AL_TOKEN_END:
-			if (expected != AL_ANY_TAG) {
-				al_log_error("unexpected end of group");
-				THROW(AL_ERROR_INVALID_DATA);
-			}
-
-			*actual = AL_NO_TAG;
-			break;
-
-		default:
-			al_log_error("unexpected value, type: 0x%02x", item.type);
-			THROW(AL_ERROR_INVALID_DATA);
+	if (!data->writeBuffer || group->start < data->writeOffset) {
+		data->numWriteReferences = find_write_reference(data, group->start);
+		RETURN();
 	}
-	
-	PASS()
-}
 
-AlError al_data_read_value(AlData *data, AlVarType type, void *value, bool *atEnd)
-{
-	BEGIN()
+	uint8_t *bytes = data->writeBuffer + (group->start - data->writeOffset);
+	size_t size = data->writeCur - bytes;
+	const uint8_t *key;
+	size_t keySize;
+	TRY(get_key(data, group->start, bytes, size, &key, &keySize));
 
-	AlDataItem item;
-	TRY(al_data_read(data, &item));
+	uint32_t hash = al_crc32c(0, key, keySize);
+	const WrittenGroup *earlier = find_written(data, key, keySize, hash);
 
-	if (item.type == AL_TOKEN_END) {
-		if (atEnd) {
-			*atEnd = true;
-		} else {
-			al_log_error("unexpected end of group");
-			THROW(AL_ERROR_INVALID_DATA);
-		}
+	// Measured from just after the reference's token
+	uint64_t distance = earlier ? group->start + 1 - earlier->offset : 0;
+	uint8_t reference[21];
+	size_t length = 0;
 
-	} else if (item.type != type) {
-		al_log_error("value is unexpected type: 0x%02x, expecting: 0x%02x", item.type, type);
-		THROW(AL_ERROR_INVALID_DATA);
+	if (earlier) {
+		reference[length++] = AL_TOKEN_REFERENCE;
+		length += encode_uint(reference + length, distance);
+		length += encode_uint(reference + length, earlier->size);
+	}
 
-	} else if (item.array) {
-		al_log_error("unexpected array");
-		THROW(AL_ERROR_INVALID_DATA);
+	if (!earlier || length >= size) {
+		TRY(add_written(data, group->start, size, key, keySize, hash));
+		RETURN();
+	}
 
-	} else {
-		if (atEnd) {
-			*atEnd = false;
-		}
+	uint64_t target = earlier->offset;
+	uint64_t referredSize = earlier->size;
 
-		switch (type) {
-			case AL_VAR_BOOL: *(bool *)value = item.value.boolVal; break;
-			case AL_VAR_INT: *(int *)value = item.value.intVal; break;
-			case AL_VAR_DOUBLE: *(double *)value = item.value.doubleVal; break;
-			case AL_VAR_VEC2: *(Vec2 *)value = item.value.vec2; break;
-			case AL_VAR_VEC3: *(Vec3 *)value = item.value.vec3; break;
-			case AL_VAR_VEC4: *(Vec4 *)value = item.value.vec4; break;
-			case AL_VAR_BOX2: *(Box2 *)value = item.value.box2; break;
-			case AL_VAR_STRING: *(char **)value = item.value.string.chars; break;
-			case AL_VAR_BLOB: *(AlBlob *)value = item.value.blob; break;
-		}
+	// Take the group back out, along with what it added to the checksum
+	remove_written(data, group->start);
+	data->numWriteReferences = find_write_reference(data, group->start);
+	data->writeCur = data->writeHashed = bytes;
+	if (data->hashGroup != NO_GROUP) {
+		data->groups[data->hashGroup].crc = group->outerCrc;
 	}
 
+	TRY(write_unhashed(data, reference, length));
+	TRY(add_write_reference(data, group->start, target, referredSize, length));
+
 	PASS()
 }
 
-AlError al_data_read_array(AlData *data, AlVarType type, void *values, uint64_t *count, bool *atEnd)
+AlError al_data_write_start(AlData *data)
 {
 	BEGIN()
 
-	AlDataItem item;
-	TRY(al_data_read(data, &item));
+	bool checked = data->writeChecked;
 
-	if (item.type == AL_TOKEN_END) {
-		if (atEnd) {
-			*atEnd = true;
-		} else {
-			al_log_error("unexpected end of group");
-			THROW(AL_ERROR_INVALID_DATA);
-		}
+	// Everything before the group is added to the checksum it's in, so the
+	// checksum can be put back if the group is replaced by a reference
+	hash_write(data);
+	uint64_t start = write_offset(data);
+	uint32_t outerCrc = (data->hashGroup != NO_GROUP) ? data->groups[data->hashGroup].crc : 0;
 
-	} else if (item.type != type) {
-		al_log_error("value is unexpected type: 0x%02x, expecting: 0x%02x", item.type, type);
-		THROW(AL_ERROR_INVALID_DATA);
+	if (data->writeSized && data->stream->seek) {
+		uint64_t size = 0;
+		TRY(write_token(data, checked ? AL_TOKEN_SIZED_CHECKED_START : AL_TOKEN_SIZED_START));
 
-	} else if (!item.array) {
-		al_log_error("unexpected single value");
-		THROW(AL_ERROR_INVALID_DATA);
+		// The length is filled in later, so it can't be part of a checksum
+		uint64_t offset = write_offset(data);
+		TRY(write_unhashed(data, &size, 8));
+		TRY(push_group(data, offset, checked, checked));
 
 	} else {
-		if (atEnd) {
-			*atEnd = false;
-		}
-
-		*(void **)values = item.value.array.items;
-		*count = item.value.array.length;
-		data->temp = NULL;
+		TRY(write_token(data, checked ? AL_TOKEN_CHECKED_START : AL_TOKEN_START));
+		hash_write(data);
+		TRY(push_group(data, UNSIZED_GROUP, checked, checked));
 	}
 
+	data->groups[data->numGroups - 1].start = start;
+	data->groups[data->numGroups - 1].outerCrc = outerCrc;
+
 	PASS()
 }
 
-AlError al_data_skip_rest(AlData *data)
+AlError al_data_write_end(AlData *data)
 {
 	BEGIN()
 
-	bool atEnd = false;
-	do {
-		uint8_t type;
-		TRY(data_read(data, &type, 1));
+	Group group;
+	TRY(write_token(data, AL_TOKEN_END));
+	hash_write(data);
+	TRY(pop_group(data, &group));
 
-		switch (type) {
-			case AL_TOKEN_START:
-				al_data_skip_rest(data);
-				break;
+	if (group.offset != UNSIZED_GROUP) {
+		TRY(patch_group_size(data, group.offset));
+	}
 
-			case AL_TOKEN_END:
-				atEnd = true;
-				break;
+	if (group.checked) {
+		TRY(write_unhashed(data, &group.crc, 4));
+	}
 
-			case AL_TOKEN_TAG: TRY(data_seek(data, 4, AL_SEEK_CUR)); break;
-			case AL_VAR_BOOL: TRY(data_seek(data, 1, AL_SEEK_CUR)); break;
-			case AL_VAR_INT: TRY(skip_uint(data)); break;
-			case AL_VAR_DOUBLE: TRY(data_seek(data, 8, AL_SEEK_CUR)); break;
-			case AL_VAR_VEC2: TRY(data_seek(data, 16, AL_SEEK_CUR)); break;
-			case AL_VAR_VEC3: TRY(data_seek(data, 24, AL_SEEK_CUR)); break;
-			case AL_VAR_VEC4: TRY(data_seek(data, 32, AL_SEEK_CUR)); break;
-			case AL_VAR_BOX2: TRY(data_seek(data, 32, AL_SEEK_CUR)); break;
-			case AL_VAR_STRING: TRY(skip_string(data)); break;
-			case AL_VAR_BLOB: TRY(skip_blob(data)); break;
-
-			case AL_VAR_BOOL | 0x80:
-			case AL_VAR_INT | 0x80:
-			case AL_VAR_DOUBLE | 0x80:
-			case AL_VAR_VEC2 | 0x80:
-			case AL_VAR_VEC3 | 0x80:
-			case AL_VAR_VEC4 | 0x80:
-			case AL_VAR_BOX2 | 0x80:
-				TRY(skip_array(data, type & 0x7F));
-				break;
+	if (data->writeDeduplicate) {
+		TRY(deduplicate_group(data, &group));
 
-			default:
-				al_log_error("unknown value type: 0x%02x", type);
-				THROW(AL_ERROR_INVALID_DATA);
+		// References are only kept for the groups around them
+		if (data->numGroups == 0) {
+			data->numWriteReferences = 0;
 		}
-	} while (!atEnd);
+	}
 
 	PASS()
 }
 
-AlError al_data_write_start(AlData *data)
-{
-	return write_token(data, AL_TOKEN_START);
-}
-
-AlError al_data_write_end(AlData *data)
-{
-	return write_token(data, AL_TOKEN_END);
-}
-
 AlError al_data_write_start_tag(AlData *data, AlDataTag tag)
 {
 	BEGIN()
@@ -790,6 +3679,103 @@ AlError al_data_write_string(AlData *data, const char *value, uint32_t length)
 	PASS()
 }
 
+AlError al_data_write_array_strided(AlData *data, AlVarType type, const void *values, size_t stride, uint64_t count)
+{
+	return al_data_write_array_encoded(data, type, AL_DATA_ENCODING_RAW, 0, values, stride, count);
+}
+
+AlError al_data_write_array_encoded(AlData *data, AlVarType type, AlDataEncoding encoding, double scale, const void *values, size_t stride, uint64_t count)
+{
+	BEGIN()
+
+	if (encoding == AL_DATA_ENCODING_RAW && stride == get_var_size(type)) {
+		TRY(al_data_write_array(data, type, values, count));
+		RETURN();
+	}
+
+	if (is_packed_type(type) && encoding == AL_DATA_ENCODING_RAW) {
+		TRY(write_array_type(data, type, encoding));
+		TRY(write_uint(data, count));
+		TRY(write_packed_items(data, type, values, stride, count));
+		RETURN();
+	}
+
+	TRY(al_data_write_array_start(data, type, encoding, scale, count));
+	TRY(al_data_write_array_items(data, values, stride, count));
+
+	PASS()
+}
+
+AlError al_data_write_array_start(AlData *data, AlVarType type, AlDataEncoding encoding, double scale, uint64_t count)
+{
+	BEGIN()
+
+	if (is_packed_type(type)) {
+		al_log_error("arrays of strings and blobs can't be written in pieces");
+		THROW(AL_ERROR_INVALID_OPERATION);
+	}
+
+	if (!is_encoding_supported(type, encoding)) {
+		al_log_error("can't write array of 0x%02x with encoding %d", type, encoding);
+		THROW(AL_ERROR_INVALID_OPERATION);
+	}
+
+	bool scaled = encoding == AL_DATA_ENCODING_DELTA && type != AL_VAR_INT;
+	if (scaled && !(scale > 0 && isfinite(scale))) {
+		al_log_error("invalid scale for delta encoded array: %g", scale);
+		THROW(AL_ERROR_INVALID_OPERATION);
+	}
+
+	TRY(write_array_type(data, type, encoding));
+	TRY(write_uint(data, count));
+
+	if (scaled) {
+		TRY(data_write(data, &scale, sizeof(double)));
+	}
+
+	data->writePendingCount = count;
+	data->writePendingType = type;
+	data->writePendingEncoding = encoding;
+	data->writePendingScale = scale;
+	memset(data->writePendingPrevious, 0, sizeof(data->writePendingPrevious));
+
+	PASS()
+}
+
+AlError al_data_write_array_items(AlData *data, const void *values, size_t stride, uint64_t count)
+{
+	BEGIN()
+
+	AlVarType type = data->writePendingType;
+
+	if (count > data->writePendingCount) {
+		al_log_error("more items written than the array's length");
+		THROW(AL_ERROR_INVALID_OPERATION);
+	}
+
+	switch (data->writePendingEncoding) {
+		case AL_DATA_ENCODING_RAW:
+			TRY(write_raw_items(data, type, values, stride, count));
+			break;
+
+		case AL_DATA_ENCODING_FLOAT:
+			TRY(write_float_items(data, type, values, stride, count));
+			break;
+
+		case AL_DATA_ENCODING_DELTA:
+			TRY(write_delta_items(data, type, data->writePendingScale, data->writePendingPrevious, values, stride, count));
+			break;
+
+		case AL_DATA_ENCODING_HALVES:
+			TRY(write_halves_items(data, type, values, stride, count));
+			break;
+	}
+
+	data->writePendingCount -= count;
+
+	PASS()
+}
+
 AlError al_data_write_array(AlData *data, AlVarType type, const void *values, uint64_t count)
 {
 	BEGIN()
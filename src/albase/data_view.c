@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2014 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include "albase/data_view.h"
+
+typedef struct {
+	/** Offset of the item's first byte in the data */
+	uint64_t offset;
+	uint64_t size;
+	AlDataNode parent;
+	/** For groups, where the group's children start in the children array */
+	uint32_t firstChild;
+	uint32_t numChildren;
+	AlDataTag tag;
+	uint8_t type;
+	bool array;
+	/** For references, the group referred to, whose contents are used */
+	AlDataNode referred;
+} Node;
+
+struct AlDataView {
+	const uint8_t *ptr;
+	size_t size;
+
+	/** Every item in the order they appear, after the root */
+	Node *nodes;
+	size_t numNodes;
+	size_t nodesLength;
+
+	/** The children of all groups, with each group's kept together */
+	AlDataNode *children;
+};
+
+static AlError add_node(AlDataView *view, Node node)
+{
+	BEGIN()
+
+	if (view->numNodes == AL_DATA_NO_NODE) {
+		al_log_error("too many items to index");
+		THROW(AL_ERROR_MEMORY);
+	}
+
+	if (view->numNodes == view->nodesLength) {
+		size_t length = view->nodesLength ? view->nodesLength * 2 : 256;
+		TRY(al_realloc(&view->nodes, sizeof(Node) * length));
+		view->nodesLength = length;
+	}
+
+	view->nodes[view->numNodes++] = node;
+
+	PASS()
+}
+
+/**
+ * Find the group that starts at an offset. Nodes are added in the order
+ * they appear, so they are sorted by offset.
+ */
+static AlDataNode find_group(AlDataView *view, uint64_t offset)
+{
+	size_t low = 1, high = view->numNodes;
+
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+
+		if (view->nodes[middle].offset < offset) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	if (low == view->numNodes || view->nodes[low].offset != offset ||
+		view->nodes[low].type != AL_TOKEN_START || view->nodes[low].referred != AL_DATA_NO_NODE) {
+		return AL_DATA_NO_NODE;
+	}
+
+	return low;
+}
+
+/**
+ * Read through the data once, adding a node for each item. Groups are
+ * tracked by following parents, so nesting only uses the AlData's stack.
+ */
+static AlError index_items(AlDataView *view)
+{
+	BEGIN()
+
+	AlMemStream stream = al_stream_init_mem_stack(view->ptr, view->size, "<data view>");
+	AlData *data = NULL;
+	AlDataNode current = AL_DATA_ROOT_NODE;
+	bool groupStarted = false;
+
+	TRY(al_data_init(&data, &stream.base));
+
+	TRY(add_node(view, (Node){
+		.offset = 0,
+		.size = view->size,
+		.parent = AL_DATA_NO_NODE,
+		.firstChild = 0,
+		.numChildren = 0,
+		.tag = AL_NO_TAG,
+		.type = AL_TOKEN_START,
+		.array = false,
+		.referred = AL_DATA_NO_NODE
+	}));
+
+	while (true) {
+		AlDataItem item;
+		uint64_t offset = al_data_get_offset(data);
+		TRY(al_data_skip_item(data, &item));
+
+		if (item.type == AL_TOKEN_EOF) {
+			if (current != AL_DATA_ROOT_NODE) {
+				al_log_error("unexpected end of data in group");
+				THROW(AL_ERROR_INVALID_DATA);
+			}
+			break;
+		}
+
+		if (item.type == AL_TOKEN_END) {
+			Node *group = &view->nodes[current];
+			group->size = al_data_get_offset(data) - group->offset;
+			current = group->parent;
+			groupStarted = false;
+			continue;
+		}
+
+		// A tag straight after the start of a group belongs to the group
+		if (item.type == AL_TOKEN_TAG && groupStarted) {
+			view->nodes[current].tag = item.value.tag;
+			groupStarted = false;
+			continue;
+		}
+
+		Node node = {
+			.offset = offset,
+			.size = al_data_get_offset(data) - offset,
+			.parent = current,
+			.firstChild = 0,
+			.numChildren = 0,
+			.tag = AL_NO_TAG,
+			.type = item.type,
+			.array = item.array,
+			.referred = AL_DATA_NO_NODE
+		};
+
+		// References stand in for the group they refer to
+		if (item.type == AL_TOKEN_REFERENCE) {
+			node.referred = find_group(view, item.value.reference.offset);
+
+			if (node.referred == AL_DATA_NO_NODE ||
+				view->nodes[node.referred].size != item.value.reference.size ||
+				view->nodes[node.referred].offset + item.value.reference.size > offset) {
+				al_log_error("invalid reference");
+				THROW(AL_ERROR_INVALID_DATA);
+			}
+
+			node.type = AL_TOKEN_START;
+			node.tag = view->nodes[node.referred].tag;
+		}
+
+		view->nodes[current].numChildren++;
+		TRY(add_node(view, node));
+
+		groupStarted = (item.type == AL_TOKEN_START);
+		if (groupStarted) {
+			current = view->numNodes - 1;
+		}
+	}
+
+	PASS({
+		al_data_free(data);
+	})
+}
+
+/**
+ * Gather the children of each group together, in order, so they can be
+ * found by position.
+ */
+static AlError index_children(AlDataView *view)
+{
+	BEGIN()
+
+	uint32_t position = 0;
+
+	TRY(al_malloc(&view->children, sizeof(AlDataNode) * view->numNodes));
+
+	for (size_t i = 0; i < view->numNodes; i++) {
+		Node *node = &view->nodes[i];
+		node->firstChild = position;
+		position += node->numChildren;
+
+		// Counted back up as the children are added
+		node->numChildren = 0;
+	}
+
+	for (size_t i = 1; i < view->numNodes; i++) {
+		Node *parent = &view->nodes[view->nodes[i].parent];
+		view->children[parent->firstChild + parent->numChildren++] = i;
+	}
+
+	PASS()
+}
+
+AlError al_data_view_open(AlDataView **result, const void *ptr, size_t size)
+{
+	BEGIN()
+
+	AlDataView *view = NULL;
+	TRY(al_malloc(&view, sizeof(AlDataView)));
+
+	view->ptr = ptr;
+	view->size = size;
+	view->nodes = NULL;
+	view->numNodes = 0;
+	view->nodesLength = 0;
+	view->children = NULL;
+
+	TRY(index_items(view));
+	TRY(index_children(view));
+
+	*result = view;
+
+	CATCH({
+		al_data_view_free(view);
+	})
+	FINALLY()
+}
+
+void al_data_view_free(AlDataView *view)
+{
+	if (view) {
+		al_free(view->nodes);
+		al_free(view->children);
+		al_free(view);
+	}
+}
+
+static Node *get_node(AlDataView *view, AlDataNode node)
+{
+	return (node < view->numNodes) ? &view->nodes[node] : NULL;
+}
+
+/**
+ * Get the node whose contents a node has, which for a reference is the group
+ * it refers to.
+ */
+static Node *get_contents(AlDataView *view, AlDataNode node)
+{
+	Node *n = get_node(view, node);
+
+	return (n && n->referred != AL_DATA_NO_NODE) ? &view->nodes[n->referred] : n;
+}
+
+size_t al_data_view_get_num_children(AlDataView *view, AlDataNode node)
+{
+	Node *n = get_contents(view, node);
+
+	return n ? n->numChildren : 0;
+}
+
+AlDataNode al_data_view_get_child(AlDataView *view, AlDataNode node, size_t index)
+{
+	Node *n = get_contents(view, node);
+
+	if (!n || index >= n->numChildren) {
+		return AL_DATA_NO_NODE;
+	}
+
+	return view->children[n->firstChild + index];
+}
+
+AlDataNode al_data_view_find_tag(AlDataView *view, AlDataNode node, AlDataTag tag)
+{
+	Node *n = get_contents(view, node);
+
+	if (n) {
+		for (uint32_t i = 0; i < n->numChildren; i++) {
+			AlDataNode child = view->children[n->firstChild + i];
+			if (view->nodes[child].tag == tag) {
+				return child;
+			}
+		}
+	}
+
+	return AL_DATA_NO_NODE;
+}
+
+AlDataNode al_data_view_find_path(AlDataView *view, AlDataNode node, const AlDataTag *tags, size_t numTags)
+{
+	for (size_t i = 0; i < numTags && node != AL_DATA_NO_NODE; i++) {
+		node = al_data_view_find_tag(view, node, tags[i]);
+	}
+
+	return node;
+}
+
+AlDataNode al_data_view_get_parent(AlDataView *view, AlDataNode node)
+{
+	Node *n = get_node(view, node);
+
+	return n ? n->parent : AL_DATA_NO_NODE;
+}
+
+AlDataTag al_data_view_get_tag(AlDataView *view, AlDataNode node)
+{
+	Node *n = get_node(view, node);
+
+	return n ? n->tag : AL_NO_TAG;
+}
+
+uint8_t al_data_view_get_type(AlDataView *view, AlDataNode node, bool *array)
+{
+	Node *n = get_node(view, node);
+
+	if (array) {
+		*array = n ? n->array : false;
+	}
+
+	return n ? n->type : AL_TOKEN_EOF;
+}
+
+const void *al_data_view_get_bytes(AlDataView *view, AlDataNode node, size_t *size)
+{
+	Node *n = get_contents(view, node);
+
+	if (!n) {
+		*size = 0;
+		return NULL;
+	}
+
+	*size = n->size;
+	return view->ptr + n->offset;
+}
+
+AlError al_data_view_init_stream(AlDataView *view, AlDataNode node, AlStream **stream)
+{
+	BEGIN()
+
+	AlStream *result = NULL;
+	size_t size;
+	const uint8_t *ptr = al_data_view_get_bytes(view, node, &size);
+
+	if (!ptr) {
+		al_log_error("invalid data view node");
+		THROW(AL_ERROR_INVALID_OPERATION);
+	}
+
+	// The stream starts at the start of the data so references in the item
+	// can be followed, and is positioned at the item
+	size_t offset = ptr - view->ptr;
+	TRY(al_stream_init_mem(&result, (void *)view->ptr, offset + size, false, "<data view>"));
+	TRY(result->seek(result, offset, AL_SEEK_SET));
+
+	*stream = result;
+
+	CATCH({
+		al_stream_free(result);
+	})
+	FINALLY()
+}
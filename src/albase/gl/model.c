@@ -12,9 +12,18 @@
 
 #include "albase/gl/model.h"
 #include "albase/model_shape.h"
+#include "albase/pack.h"
 #include "../model_shape_internal.h"
 
+/**
+ * Once a model has been edited, every path it rebuilds gets this many spare
+ * vertices plus half as many again as it uses, so that small edits can be
+ * uploaded in place.
+ */
+#define MIN_PATH_SLACK 24
+
 static AlModel *firstModel = NULL;
+static AlPack *modelPack = NULL;
 
 static AlError model_init(AlModel **result)
 {
@@ -30,9 +39,15 @@ static AlError model_init(AlModel **result)
 
 	model->numPaths = 0;
 	model->vertexBuffer = 0;
+	model->vertexStarts = NULL;
 	model->vertexCounts = NULL;
 	model->colours = NULL;
 
+	model->paths = NULL;
+	model->generations = NULL;
+	model->vertexCapacities = NULL;
+	model->built = false;
+
 	model->bounds = (Box2){{0, 0}, {0, 0}};
 
 	glGenBuffers(1, &model->vertexBuffer);
@@ -47,8 +62,12 @@ static void model_free(AlModel *model)
 	if (model != NULL) {
 		al_free(model->filename);
 		glDeleteBuffers(1, &model->vertexBuffer);
+		al_free(model->vertexStarts);
 		al_free(model->vertexCounts);
 		al_free(model->colours);
+		al_free(model->paths);
+		al_free(model->generations);
+		al_free(model->vertexCapacities);
 		al_free(model);
 	}
 }
@@ -210,7 +229,19 @@ static AlError model_load(AlModel *model, const char *filename)
 	TRY(al_malloc(&filenameCopy, strlen(filename) + 1));
 	strcpy(filenameCopy, filename);
 
-	TRY(al_stream_init_filename(&stream, filename, AL_OPEN_READ));
+	if (!strncmp(filename, AL_PACK_PREFIX, strlen(AL_PACK_PREFIX))) {
+		if (!modelPack) {
+			al_log_error("no model pack set");
+			THROW(AL_ERROR_INVALID_OPERATION);
+		}
+		TRY(al_pack_init_stream(modelPack, filename + strlen(AL_PACK_PREFIX), &stream));
+
+	} else {
+		TRY(al_stream_init_mmap(&stream, filename));
+	}
+
+	TRY(al_stream_detect_compressed(&stream));
+
 	TRY(al_model_shape_init(&shape));
 	TRY(al_model_shape_load(shape, stream));
 	TRY(al_model_set_shape(model, shape));
@@ -270,6 +301,22 @@ AlError al_model_use_file(AlModel **result, const char *filename)
 	FINALLY()
 }
 
+AlError al_model_set_pack(const char *filename)
+{
+	BEGIN()
+
+	AlPack *pack = NULL;
+
+	if (filename) {
+		TRY(al_pack_open(&pack, filename));
+	}
+
+	al_pack_free(modelPack);
+	modelPack = pack;
+
+	PASS()
+}
+
 AlError al_model_use_shape(AlModel **result, AlModelShape *shape)
 {
 	BEGIN()
@@ -287,68 +334,189 @@ AlError al_model_use_shape(AlModel **result, AlModelShape *shape)
 	FINALLY()
 }
 
-AlError al_model_set_shape(AlModel *model, AlModelShape *shape)
+static int max_path_vertices(AlModelPath *path)
+{
+	return path->numPoints * 9 - 6;
+}
+
+static int path_slack(int vertexCount)
+{
+	return vertexCount / 2 + MIN_PATH_SLACK;
+}
+
+/**
+ * Build every path into a new buffer, leaving room after each for it to grow
+ * if slack is set.
+ */
+static AlError build_all_paths(AlModel *model, AlModelShape *shape, bool slack)
 {
 	BEGIN()
 
-	Vec3 *colours = NULL;
+	int numPaths = shape->numPaths;
+	AlModelPath **paths = NULL;
+	unsigned int *generations = NULL;
+	int *vertexStarts = NULL;
 	int *vertexCounts = NULL;
+	int *vertexCapacities = NULL;
+	Vec3 *colours = NULL;
 	AlGlModelVertex *vertices = NULL;
 
-	Box2 bounds = {{0, 0}, {0, 0}};
+	TRY(al_malloc(&paths, sizeof(AlModelPath *) * numPaths));
+	TRY(al_malloc(&generations, sizeof(unsigned int) * numPaths));
+	TRY(al_malloc(&vertexStarts, sizeof(int) * numPaths));
+	TRY(al_malloc(&vertexCounts, sizeof(int) * numPaths));
+	TRY(al_malloc(&vertexCapacities, sizeof(int) * numPaths));
+	TRY(al_malloc(&colours, sizeof(Vec3) * numPaths));
 
-	TRY(al_malloc(&colours, sizeof(Vec3) * shape->numPaths));
-	TRY(al_malloc(&vertexCounts, sizeof(int) * shape->numPaths));
-
-	AlModelPath **pathPtr = shape->paths;
-	Vec3 *colour = colours;
 	int maxVertices = 0;
 
-	for (int i = 0; i < shape->numPaths; i++, pathPtr++, colour++) {
-		AlModelPath *path = *pathPtr;
-
-		*colour = path->colour;
-		maxVertices += path->numPoints * 9 - 6;
-
-		for (int j = 0; j < path->numPoints; j++) {
-			bounds = box2_include_vec2(bounds, path->points[j].location);
-		}
+	for (int i = 0; i < numPaths; i++) {
+		int pathVertices = max_path_vertices(shape->paths[i]);
+		maxVertices += slack ? pathVertices + path_slack(pathVertices) : pathVertices;
 	}
 
 	TRY(al_malloc(&vertices, sizeof(AlGlModelVertex) * maxVertices));
 
-	pathPtr = shape->paths;
-	AlGlModelVertex *pathVertices = vertices;
-	int *vertexCount = vertexCounts;
 	int totalVertices = 0;
-	for (int i = 0; i < shape->numPaths; i++, pathPtr++, vertexCount++) {
-		TRY(build_path_vertices(*pathPtr, pathVertices, vertexCount));
-		pathVertices += *vertexCount;
-		totalVertices += *vertexCount;
+
+	for (int i = 0; i < numPaths; i++) {
+		AlModelPath *path = shape->paths[i];
+
+		TRY(build_path_vertices(path, vertices + totalVertices, &vertexCounts[i]));
+
+		paths[i] = path;
+		generations[i] = path->generation;
+		vertexStarts[i] = totalVertices;
+		vertexCapacities[i] = slack ? vertexCounts[i] + path_slack(vertexCounts[i]) : vertexCounts[i];
+		totalVertices += vertexCapacities[i];
 	}
 
 	glBindBuffer(GL_ARRAY_BUFFER, model->vertexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(AlGlModelVertex) * totalVertices, vertices, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(AlGlModelVertex) * totalVertices, vertices, slack ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	al_free(model->colours);
+	al_free(model->paths);
+	al_free(model->generations);
+	al_free(model->vertexStarts);
 	al_free(model->vertexCounts);
+	al_free(model->vertexCapacities);
+	al_free(model->colours);
 
-	model->numPaths = shape->numPaths;
-	model->colours = colours;
+	model->numPaths = numPaths;
+	model->paths = paths;
+	model->generations = generations;
+	model->vertexStarts = vertexStarts;
 	model->vertexCounts = vertexCounts;
-	model->bounds = bounds;
+	model->vertexCapacities = vertexCapacities;
+	model->colours = colours;
 
 	CATCH({
-		al_log_error("Error building GL data from model shape");
-		al_free(colours);
+		al_free(paths);
+		al_free(generations);
+		al_free(vertexStarts);
 		al_free(vertexCounts);
+		al_free(vertexCapacities);
+		al_free(colours);
 	})
 	FINALLY({
 		al_free(vertices);
 	})
 }
 
+/**
+ * Rebuild only the paths that have changed since they were last built, and
+ * upload each into the range already reserved for it.
+ * @param[out] fits Set to false if the paths aren't the ones last built, or a
+ * path has outgrown its range, in which case everything must be rebuilt
+ */
+static AlError build_changed_paths(AlModel *model, AlModelShape *shape, bool *fits)
+{
+	BEGIN()
+
+	AlGlModelVertex *vertices = NULL;
+	int maxVertices = 0;
+
+	*fits = false;
+
+	if (!model->built || model->numPaths != shape->numPaths)
+		RETURN();
+
+	for (int i = 0; i < model->numPaths; i++) {
+		AlModelPath *path = shape->paths[i];
+
+		if (path != model->paths[i])
+			RETURN();
+
+		if (path->generation != model->generations[i] && max_path_vertices(path) > maxVertices) {
+			maxVertices = max_path_vertices(path);
+		}
+	}
+
+	TRY(al_malloc(&vertices, sizeof(AlGlModelVertex) * maxVertices));
+
+	glBindBuffer(GL_ARRAY_BUFFER, model->vertexBuffer);
+
+	for (int i = 0; i < model->numPaths; i++) {
+		AlModelPath *path = shape->paths[i];
+		int vertexCount;
+
+		if (path->generation == model->generations[i])
+			continue;
+
+		TRY(build_path_vertices(path, vertices, &vertexCount));
+
+		if (vertexCount > model->vertexCapacities[i])
+			RETURN();
+
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(AlGlModelVertex) * model->vertexStarts[i],
+			sizeof(AlGlModelVertex) * vertexCount, vertices);
+
+		model->vertexCounts[i] = vertexCount;
+		model->generations[i] = path->generation;
+	}
+
+	*fits = true;
+
+	PASS({
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		al_free(vertices);
+	})
+}
+
+AlError al_model_set_shape(AlModel *model, AlModelShape *shape)
+{
+	BEGIN()
+
+	Box2 bounds = {{0, 0}, {0, 0}};
+	bool fits;
+
+	TRY(build_changed_paths(model, shape, &fits));
+
+	if (!fits) {
+		TRY(build_all_paths(model, shape, model->built));
+	}
+
+	model->built = true;
+
+	// Colours can be set without the path knowing, so they're always copied
+	for (int i = 0; i < shape->numPaths; i++) {
+		AlModelPath *path = shape->paths[i];
+
+		model->colours[i] = path->colour;
+
+		for (int j = 0; j < path->numPoints; j++) {
+			bounds = box2_include_vec2(bounds, path->points[j].location);
+		}
+	}
+
+	model->bounds = bounds;
+
+	CATCH({
+		al_log_error("Error building GL data from model shape");
+	})
+	FINALLY()
+}
+
 void al_model_unuse(AlModel *model)
 {
 	if (!model)
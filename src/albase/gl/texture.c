@@ -87,7 +87,7 @@ static Sint64 rwops_seek(SDL_RWops *rw, Sint64 offset, int whence)
 	if (error)
 		return 0;
 
-	long position;
+	int64_t position;
 	stream->tell(stream, &position);
 
 	return position;
@@ -151,7 +151,7 @@ AlError algl_texture_load_from_file(AlGlTexture *texture, const char *filename)
 	BEGIN()
 
 	AlStream *stream = NULL;
-	TRY(al_stream_init_filename(&stream, filename, AL_OPEN_READ));
+	TRY(al_stream_init_filename_counted(&stream, filename, AL_OPEN_READ));
 	TRY(algl_texture_load_from_stream(texture, stream));
 
 	PASS(
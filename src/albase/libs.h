@@ -11,5 +11,6 @@
 
 int luaopen_fs(lua_State *L);
 int luaopen_text(lua_State *L);
+int luaopen_streams(lua_State *L);
 
 #endif
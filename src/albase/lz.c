@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2014 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "albase/lz.h"
+
+/*
+ * A block is a series of sequences, each made of a token byte, literals, and
+ * a match copied from earlier in the output:
+ *
+ *   token: high 4 bits literal length, low 4 bits match length - MIN_MATCH
+ *   [literal length - 15 as a run of 255s and a final byte, if it was 15]
+ *   literals
+ *   2 byte little endian offset back to the match
+ *   [match length - MIN_MATCH - 15 in the same way, if it was 15]
+ *
+ * The last sequence ends after its literals, with no match.
+ */
+
+#define HASH_BITS 12
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+
+/** Bytes at the end of a block that are always literals */
+#define LAST_LITERALS 5
+
+/** Matches aren't started this close to the end of a block */
+#define MATCH_LIMIT 12
+
+/** Misses before the search starts skipping ahead faster */
+#define SKIP_TRIGGER 6
+
+static inline uint32_t read32(const uint8_t *ptr)
+{
+	uint32_t value;
+	memcpy(&value, ptr, 4);
+	return value;
+}
+
+static inline uint32_t hash(uint32_t value)
+{
+	return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static uint8_t *write_length(uint8_t *out, size_t length)
+{
+	while (length >= 255) {
+		*out++ = 255;
+		length -= 255;
+	}
+
+	*out++ = length;
+
+	return out;
+}
+
+/**
+ * Write a sequence, or return NULL if it won't fit before end.
+ * A matchLength of 0 writes the final sequence.
+ */
+static uint8_t *write_sequence(uint8_t *out, uint8_t *end, const uint8_t *literals, size_t numLiterals,
+	size_t offset, size_t matchLength)
+{
+	size_t needed = 1 + numLiterals / 255 + 1 + numLiterals + 2 + matchLength / 255 + 1;
+	if ((size_t)(end - out) < needed) {
+		return NULL;
+	}
+
+	uint8_t *token = out++;
+
+	*token = ((numLiterals >= 15) ? 15 : numLiterals) << 4;
+	if (numLiterals >= 15) {
+		out = write_length(out, numLiterals - 15);
+	}
+
+	memcpy(out, literals, numLiterals);
+	out += numLiterals;
+
+	if (matchLength) {
+		*out++ = offset & 0xFF;
+		*out++ = offset >> 8;
+
+		size_t length = matchLength - MIN_MATCH;
+		*token |= (length >= 15) ? 15 : length;
+		if (length >= 15) {
+			out = write_length(out, length - 15);
+		}
+	}
+
+	return out;
+}
+
+size_t al_lz_compress(const void *src, size_t srcSize, void *dst, size_t dstCapacity)
+{
+	const uint8_t *base = src;
+	const uint8_t *in = base;
+	const uint8_t *inEnd = base + srcSize;
+	const uint8_t *literals = base;
+	uint8_t *out = dst;
+	uint8_t *outEnd = out + dstCapacity;
+
+	uint32_t table[1 << HASH_BITS];
+	memset(table, 0, sizeof(table));
+
+	if (srcSize > MATCH_LIMIT) {
+		const uint8_t *searchEnd = inEnd - MATCH_LIMIT;
+		const uint8_t *matchEnd = inEnd - LAST_LITERALS;
+		size_t misses = 0;
+
+		while (in < searchEnd) {
+			uint32_t sequence = read32(in);
+			uint32_t h = hash(sequence);
+			const uint8_t *match = base + table[h];
+			table[h] = in - base;
+
+			if (match >= in || in - match > MAX_OFFSET || read32(match) != sequence) {
+				in += 1 + (misses++ >> SKIP_TRIGGER);
+				continue;
+			}
+
+			const uint8_t *cur = in + MIN_MATCH;
+			match += MIN_MATCH;
+			while (cur < matchEnd && *cur == *match) {
+				cur++;
+				match++;
+			}
+
+			out = write_sequence(out, outEnd, literals, in - literals, cur - match, cur - in);
+			if (!out) {
+				return 0;
+			}
+
+			in = literals = cur;
+			misses = 0;
+		}
+	}
+
+	out = write_sequence(out, outEnd, literals, inEnd - literals, 0, 0);
+	if (!out) {
+		return 0;
+	}
+
+	return out - (uint8_t *)dst;
+}
+
+static bool read_length(const uint8_t **in, const uint8_t *end, size_t *length)
+{
+	uint8_t byte;
+
+	do {
+		if (*in >= end) {
+			return false;
+		}
+
+		byte = *(*in)++;
+		*length += byte;
+	} while (byte == 255);
+
+	return true;
+}
+
+AlError al_lz_decompress(const void *src, size_t srcSize, void *dst, size_t dstSize)
+{
+	BEGIN()
+
+	const uint8_t *in = src;
+	const uint8_t *inEnd = in + srcSize;
+	uint8_t *out = dst;
+	uint8_t *outEnd = out + dstSize;
+
+	while (true) {
+		if (in >= inEnd) {
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+		uint8_t token = *in++;
+
+		size_t numLiterals = token >> 4;
+		if (numLiterals == 15 && !read_length(&in, inEnd, &numLiterals)) {
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+		if (numLiterals > (size_t)(inEnd - in) || numLiterals > (size_t)(outEnd - out)) {
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+		memcpy(out, in, numLiterals);
+		out += numLiterals;
+		in += numLiterals;
+
+		if (in == inEnd) {
+			break;
+		}
+
+		if (inEnd - in < 2) {
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+		size_t offset = in[0] | (in[1] << 8);
+		in += 2;
+
+		size_t matchLength = token & 0x0F;
+		if (matchLength == 15 && !read_length(&in, inEnd, &matchLength)) {
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+		matchLength += MIN_MATCH;
+
+		if (offset == 0 || offset > (size_t)(out - (uint8_t *)dst) || matchLength > (size_t)(outEnd - out)) {
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+		const uint8_t *match = out - offset;
+
+		if (offset >= matchLength) {
+			memcpy(out, match, matchLength);
+			out += matchLength;
+
+		} else {
+			for (size_t i = 0; i < matchLength; i++) {
+				*out++ = *match++;
+			}
+		}
+	}
+
+	if (out != outEnd) {
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	CATCH(
+		al_log_error("corrupt compressed data");
+	)
+	FINALLY()
+}
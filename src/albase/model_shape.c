@@ -5,7 +5,9 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <assert.h>
+#include <SDL2/SDL.h>
 
 #include "albase/model_shape.h"
 #include "albase/stream.h"
@@ -19,11 +21,55 @@
 #define COLOUR_TAG AL_DATA_TAG('C', 'O', 'L', 'R')
 #define POINTS_TAG AL_DATA_TAG('P', 'N', 'T', 'S')
 
+/** Number of paths a loading thread decodes before taking more */
+#define LOAD_PATHS_PER_TASK 32
+
+/** Most threads, including the calling thread, used to load a shape */
+#define MAX_LOAD_THREADS 16
+
 static struct {
 	lua_State *lua;
 	AlWrappedType *shapeType;
 	AlWrappedType *pathType;
-} modelSystem = {NULL, NULL, NULL};
+	AlDataStruct *pathStruct;
+} modelSystem = {NULL, NULL, NULL, NULL};
+
+/** What al_data_read_struct() reads a path into */
+typedef struct {
+	Vec3 colour;
+	AlModelPoint *points;
+	uint64_t numPoints;
+} PathFields;
+
+static void init_points(void *items, uint64_t count)
+{
+	AlModelPoint *points = items;
+
+	// Paths saved without curve biases alternate corners and curves
+	for (uint64_t i = 0; i < count; i++) {
+		points[i].curveBias = (i % 2) ? 0.5 : 0.0;
+	}
+}
+
+static const AlDataMember pointMembers[] = {
+	{AL_VAR_VEC2, offsetof(AlModelPoint, location)},
+	{AL_VAR_DOUBLE, offsetof(AlModelPoint, curveBias)}
+};
+
+static const AlDataArray pointsArray = {
+	.itemSize = sizeof(AlModelPoint),
+	.countOffset = offsetof(PathFields, numPoints),
+	.members = pointMembers,
+	.numMembers = sizeof(pointMembers) / sizeof(pointMembers[0]),
+	.init = init_points
+};
+
+static const AlDataField pathFields[] = {
+	{.tag = COLOUR_TAG, .type = AL_VAR_VEC3, .offset = offsetof(PathFields, colour)},
+	{.tag = POINTS_TAG, .offset = offsetof(PathFields, points), .array = &pointsArray}
+};
+
+static SDL_atomic_t generations;
 
 static AlError al_model_path_ctor(lua_State *L, void *ptr, void *data)
 {
@@ -37,6 +83,7 @@ static AlError al_model_path_ctor(lua_State *L, void *ptr, void *data)
 
 	TRY(al_malloc(&path->points, sizeof(AlModelPoint) * 4));
 	path->pointsLength = 4;
+	al_model_path_changed(path);
 
 	PASS()
 }
@@ -54,106 +101,56 @@ static AlError al_model_path_load(AlModelPath *path, AlData *data)
 {
 	BEGIN()
 
-	Vec3 colour;
-	uint64_t numPoints = 0;
-	Vec2 *locations = NULL;
-	double *biases = NULL;
-	AlModelPoint *points = NULL;
+	PathFields fields = {path->colour, NULL, 0};
 
 	TRY(al_data_read_start(data, NULL));
+	TRY(al_data_read_struct(data, modelSystem.pathStruct, &fields));
 
-	START_READ_TAGS(data) {
-		case COLOUR_TAG:
-			TRY(al_data_read_value(data, AL_VAR_VEC3, &colour, NULL));
-			TRY(al_data_skip_rest(data));
-			break;
-
-		case POINTS_TAG: {
-			if (points) {
-				al_log_error("points can only be specified once in path");
-				THROW(AL_ERROR_INVALID_DATA);
-			}
-
-			TRY(al_data_read_array(data, AL_VAR_VEC2, &locations, &numPoints, NULL));
-			if (numPoints > INT_MAX) {
-				al_log_error("too many points in path");
-				THROW(AL_ERROR_INVALID_DATA);
-			}
-
-			TRY(al_malloc(&points, sizeof(AlModelPoint) * numPoints));
-
-			for (int i = 0; i < numPoints; i++) {
-				points[i] = ((AlModelPoint){
-					.location = locations[i],
-					.curveBias = (i % 2) ? 0.5 : 0.0
-				});
-			}
-
-			bool biasesMissing;
-			uint64_t numBiases;
-			TRY(al_data_read_array(data, AL_VAR_DOUBLE, &biases, &numBiases, &biasesMissing));
-			if (!biasesMissing) {
-				for (int i = 0; i < numPoints && i < numBiases; i++) {
-					points[i].curveBias = biases[i];
-				}
-
-				TRY(al_data_skip_rest(data));
-			}
-			break;
-		}
-	} END_READ_TAGS(data);
-
-	if (!points) {
+	if (!fields.points) {
 		al_log_error("no points defined in path");
 		THROW(AL_ERROR_INVALID_DATA);
 	}
 
+	if (fields.numPoints > INT_MAX) {
+		al_log_error("too many points in path");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
 	al_free(path->points);
 
-	path->colour = colour;
-	path->pointsLength = numPoints;
-	path->numPoints = (int)numPoints;
-	path->points = points;
+	path->colour = fields.colour;
+	path->pointsLength = fields.numPoints;
+	path->numPoints = (int)fields.numPoints;
+	path->points = fields.points;
+	al_model_path_changed(path);
 
 	CATCH({
-		al_free(points);
-	})
-	FINALLY({
-		al_free(locations);
-		al_free(biases);
+		al_free(fields.points);
 	})
+	FINALLY()
 }
 
-static AlError al_model_path_save(AlModelPath *path, AlData *data)
+static AlError al_model_path_save(AlModelPath *path, AlData *data, double precision)
 {
 	BEGIN()
 
-	Vec2 *locations = NULL;
-	double *biases = NULL;
-
-	TRY(al_malloc(&locations, sizeof(Vec2) * path->numPoints));
-	TRY(al_malloc(&biases, sizeof(double) * path->numPoints));
-
-	for (int i = 0; i < path->numPoints; i++) {
-		locations[i] = path->points[i].location;
-		biases[i] = path->points[i].curveBias;
-	}
-
 	TRY(al_data_write_start(data));
 
 	TRY(al_data_write_simple_tag(data, COLOUR_TAG, AL_VAR_VEC3, &path->colour));
 
 	TRY(al_data_write_start_tag(data, POINTS_TAG));
-	TRY(al_data_write_array(data, AL_VAR_VEC2, locations, path->numPoints));
-	TRY(al_data_write_array(data, AL_VAR_DOUBLE, biases, path->numPoints));
+	if (precision > 0) {
+		TRY(al_data_write_array_encoded(data, AL_VAR_VEC2, AL_DATA_ENCODING_DELTA, precision, &path->points->location, sizeof(AlModelPoint), path->numPoints));
+		TRY(al_data_write_array_encoded(data, AL_VAR_DOUBLE, AL_DATA_ENCODING_HALVES, 0, &path->points->curveBias, sizeof(AlModelPoint), path->numPoints));
+	} else {
+		TRY(al_data_write_array_strided(data, AL_VAR_VEC2, &path->points->location, sizeof(AlModelPoint), path->numPoints));
+		TRY(al_data_write_array_strided(data, AL_VAR_DOUBLE, &path->points->curveBias, sizeof(AlModelPoint), path->numPoints));
+	}
 	TRY(al_data_write_end(data));
 
 	TRY(al_data_write_end(data));
 
-	PASS({
-		al_free(locations);
-		al_free(biases);
-	})
+	PASS()
 }
 
 static AlError al_model_shape_ctor(lua_State *L, void *ptr, void *data)
@@ -215,16 +212,156 @@ static void unreference(AlModelShape *shape, AlModelPath *path)
 	al_wrapper_unreference(modelSystem.lua);
 }
 
+/**
+ * Paths being decoded by several threads. The encoded paths are one after
+ * another in memory, and each thread repeatedly takes the next few to decode.
+ */
+typedef struct {
+	const uint8_t *memory;
+	/** Offset of each path in memory, followed by the offset of the end */
+	uint64_t *offsets;
+	AlModelPath **paths;
+	int numPaths;
+
+	SDL_atomic_t nextPath;
+	SDL_atomic_t failed;
+} PathLoad;
+
+static AlError load_path_range(PathLoad *load, int first, int last)
+{
+	BEGIN()
+
+	// Earlier paths stay in the stream so references to them can be followed
+	AlMemStream stream = al_stream_init_mem_stack(load->memory, load->offsets[last], "<paths>");
+	AlData *data = NULL;
+
+	TRY(stream.base.seek(&stream.base, load->offsets[first], AL_SEEK_SET));
+	TRY(al_data_init(&data, &stream.base));
+
+	// Finding the paths has already checked every checksum, theirs included
+	al_data_set_verify(data, false);
+
+	for (int i = first; i < last; i++) {
+		TRY(al_model_path_load(load->paths[i], data));
+	}
+
+	PASS({
+		al_data_free(data);
+	})
+}
+
+static int load_paths_thread(void *ptr)
+{
+	PathLoad *load = ptr;
+
+	while (!SDL_AtomicGet(&load->failed)) {
+		int first = SDL_AtomicAdd(&load->nextPath, LOAD_PATHS_PER_TASK);
+		if (first >= load->numPaths) {
+			break;
+		}
+
+		int last = (load->numPaths - first > LOAD_PATHS_PER_TASK) ? first + LOAD_PATHS_PER_TASK : load->numPaths;
+
+		AlError error = load_path_range(load, first, last);
+		if (error) {
+			SDL_AtomicSet(&load->failed, 1);
+			return error;
+		}
+	}
+
+	return AL_NO_ERROR;
+}
+
+/**
+ * Load paths that are all in memory. The groups are found first without
+ * decoding them, which checks the checksums of the paths and the groups
+ * around them, then decoded by as many threads as there are cores.
+ */
+static AlError load_paths_parallel(AlData *data, const uint8_t *memory, AlModelPath **paths, int numPaths)
+{
+	BEGIN()
+
+	PathLoad load = {
+		.memory = memory,
+		.offsets = NULL,
+		.paths = paths,
+		.numPaths = numPaths
+	};
+	SDL_AtomicSet(&load.nextPath, 0);
+	SDL_AtomicSet(&load.failed, 0);
+
+	SDL_Thread *threads[MAX_LOAD_THREADS - 1];
+	int numThreads = 0;
+
+	TRY(al_malloc(&load.offsets, sizeof(uint64_t) * (numPaths + 1)));
+
+	for (int i = 0; i < numPaths; i++) {
+		load.offsets[i] = al_data_get_offset(data);
+		TRY(al_data_read_start(data, NULL));
+		TRY(al_data_skip_rest(data));
+	}
+	load.offsets[numPaths] = al_data_get_offset(data);
+
+	int numTasks = (numPaths + LOAD_PATHS_PER_TASK - 1) / LOAD_PATHS_PER_TASK;
+	int maxThreads = SDL_GetCPUCount();
+	if (maxThreads > MAX_LOAD_THREADS) {
+		maxThreads = MAX_LOAD_THREADS;
+	}
+	if (maxThreads > numTasks) {
+		maxThreads = numTasks;
+	}
+
+	// If threads can't be started, fewer threads do the work
+	while (numThreads < maxThreads - 1) {
+		SDL_Thread *thread = SDL_CreateThread(load_paths_thread, "path loader", &load);
+		if (!thread) {
+			break;
+		}
+		threads[numThreads++] = thread;
+	}
+
+	error = load_paths_thread(&load);
+
+	for (int i = 0; i < numThreads; i++) {
+		int result;
+		SDL_WaitThread(threads[i], &result);
+		if (!error) {
+			error = result;
+		}
+	}
+
+	if (error) {
+		al_log_error("error loading paths");
+		THROW(error);
+	}
+
+	PASS({
+		al_free(load.offsets);
+	})
+}
+
 AlError al_model_shape_load(AlModelShape *shape, AlStream *stream)
 {
 	BEGIN()
 
 	AlData *data = NULL;
+	AlMemStream memoryStream;
+	const uint8_t *memory = NULL;
+	size_t memorySize = 0;
 
 	int numPaths = 0;
 	AlModelPath **paths = NULL;
 
-	TRY(al_data_init(&data, stream));
+	// Paths can only be decoded on several threads when they're in memory
+	if (stream->borrow && SDL_GetCPUCount() > 1) {
+		TRY(stream->borrow(stream, SIZE_MAX, (const void **)&memory, &memorySize));
+		memoryStream = al_stream_init_mem_stack(memory, memorySize, stream->name);
+		TRY(al_data_init(&data, &memoryStream.base));
+
+	} else {
+		TRY(al_data_init(&data, stream));
+	}
+
 	TRY(al_data_read_start_tag(data, SHAPE_TAG, NULL));
 
 	START_READ_TAGS(data) {
@@ -237,13 +374,24 @@ AlError al_model_shape_load(AlModelShape *shape, AlStream *stream)
 			TRY(al_data_read_value(data, AL_VAR_INT, &numPaths, NULL));
 			TRY(al_malloc(&paths, sizeof(AlModelPath *) * numPaths));
 
+			// Wrappers belong to Lua, so they're all made on this thread
 			for (int i = 0; i < numPaths; i++) {
 				paths[i] = NULL;
+			}
 
+			for (int i = 0; i < numPaths; i++) {
 				TRY(al_wrapper_invoke_ctor(modelSystem.pathType, &paths[i]));
 				reference(shape, paths[i]);
 				al_wrapper_release(modelSystem.lua, paths[i]);
-				TRY(al_model_path_load(paths[i], data));
+			}
+
+			if (memory) {
+				TRY(load_paths_parallel(data, memory, paths, numPaths));
+
+			} else {
+				for (int i = 0; i < numPaths; i++) {
+					TRY(al_model_path_load(paths[i], data));
+				}
 			}
 
 			TRY(al_data_skip_rest(data));
@@ -279,6 +427,14 @@ AlError al_model_shape_load(AlModelShape *shape, AlStream *stream)
 		}
 	})
 	FINALLY({
+		if (memory && data) {
+			// Hand back the part of the stream that wasn't read
+			int64_t unread = memorySize - al_data_get_offset(data);
+			if (unread > 0 && stream->seek) {
+				stream->seek(stream, -unread, AL_SEEK_CUR);
+			}
+		}
+
 		al_data_free(data);
 	})
 }
@@ -292,30 +448,69 @@ AlModelPath *const *al_model_shape_get_paths(AlModelShape *shape, int *numPaths)
 	return shape->paths;
 }
 
-AlError al_model_shape_save(AlModelShape *shape, AlStream *stream)
+AlError al_model_shape_save_with_options(AlModelShape *shape, AlStream *stream, const AlModelShapeSaveOptions *options)
 {
 	BEGIN()
 
 	AlData *data = NULL;
+	AlStream *memory = NULL;
+	AlStream *compressed = NULL;
+	void *bytes = NULL;
+	size_t size = 0;
+	double precision = options->precision;
+
+	if (!(precision >= 0)) {
+		al_log_error("precision can't be negative");
+		THROW(AL_ERROR_INVALID_OPERATION);
+	}
+
+	// Sized groups are patched by seeking back, which a compressed stream
+	// can't do, so a compressed shape is built in memory first
+	if (options->compressed) {
+		TRY(al_stream_init_mem_writer(&memory, 0, stream->name));
+	}
 
-	TRY(al_data_init(&data, stream));
+	TRY(al_data_init(&data, memory ? memory : stream));
+	al_data_set_sized_groups(data, true);
+	al_data_set_checksums(data, true);
+	al_data_set_deduplicate(data, options->deduplicate);
 
 	TRY(al_data_write_start_tag(data, SHAPE_TAG));
 	TRY(al_data_write_start_tag(data, PATHS_TAG));
 	TRY(al_data_write_value(data, AL_VAR_INT, &shape->numPaths));
 
 	for (int i = 0; i < shape->numPaths; i++) {
-		TRY(al_model_path_save(shape->paths[i], data));
+		TRY(al_model_path_save(shape->paths[i], data, precision));
 	}
 
 	TRY(al_data_write_end(data));
 	TRY(al_data_write_end(data));
+	TRY(al_data_flush(data));
+
+	if (memory) {
+		TRY(al_stream_detach_mem(memory, &bytes, &size));
+		TRY(al_stream_init_compressed(&compressed, stream, AL_OPEN_WRITE, false));
+		TRY(compressed->write(compressed, bytes, size));
+		TRY(al_stream_flush(compressed));
+	}
 
 	PASS(
 		al_data_free(data);
+		al_stream_free(compressed);
+		al_stream_free(memory);
+		al_free(bytes);
 	)
 }
 
+AlError al_model_shape_save(AlModelShape *shape, AlStream *stream)
+{
+	return al_model_shape_save_with_options(shape, stream, &(AlModelShapeSaveOptions){
+		.precision = 0,
+		.deduplicate = false,
+		.compressed = false
+	});
+}
+
 AlError al_model_shape_add_path(AlModelShape *shape, int index, AlModelPoint start, AlModelPoint end)
 {
 	assert(index >= -1 && index <= shape->numPaths);
@@ -379,6 +574,13 @@ void al_model_path_set_colour(AlModelPath *path, Vec3 colour)
 	path->colour = colour;
 }
 
+void al_model_path_changed(AlModelPath *path)
+{
+	// Generations are shared by all paths, so a new path can't be mistaken
+	// for an unchanged one that used to be at the same address
+	path->generation = (unsigned int)SDL_AtomicAdd(&generations, 1) + 1;
+}
+
 AlModelPoint *al_model_path_get_points(AlModelPath *path, int *numPoints)
 {
 	if (numPoints) {
@@ -409,6 +611,7 @@ AlError al_model_path_add_point(AlModelPath *path, int index, AlModelPoint point
 	path->points[index] = point;
 
 	path->numPoints++;
+	al_model_path_changed(path);
 
 	PASS()
 }
@@ -423,6 +626,7 @@ AlError al_model_path_remove_point(AlModelPath *path, int index)
 	}
 
 	path->numPoints--;
+	al_model_path_changed(path);
 
 	return AL_NO_ERROR;
 }
@@ -569,6 +773,8 @@ AlError al_model_systems_init(lua_State *L)
 
 	modelSystem.lua = L;
 
+	TRY(al_data_struct_init(&modelSystem.pathStruct, pathFields, sizeof(pathFields) / sizeof(pathFields[0])));
+
 	TRY(al_wrapper_register(L, (AlWrapperReg){
 		.name = "model_shape",
 		.size = sizeof(AlModelShape),
@@ -596,4 +802,7 @@ void al_model_systems_free()
 	modelSystem.lua = NULL;
 	modelSystem.shapeType = NULL;
 	modelSystem.pathType = NULL;
+
+	al_data_struct_free(modelSystem.pathStruct);
+	modelSystem.pathStruct = NULL;
 }
@@ -5,6 +5,7 @@
  */
 
 #include "albase/model_shape.h"
+#include "albase/model.h"
 #include "albase/lua.h"
 #include "albase/wrapper.h"
 
@@ -29,7 +30,9 @@ static int cmd_model_shape_load(lua_State *L)
 
 	AlStream *stream = NULL;
 
-	TRY(al_stream_init_filename(&stream, filename, AL_OPEN_READ));
+	// Mapped, so paths can be decoded on several threads
+	TRY(al_stream_init_mmap_counted(&stream, filename));
+	TRY(al_stream_detect_compressed(&stream));
 	TRY(al_model_shape_load(model, stream));
 
 	CATCH_LUA(, "Error loading model")
@@ -42,13 +45,36 @@ static int cmd_model_shape_save(lua_State *L)
 {
 	BEGIN()
 
-	AlModelShape *model = cmd_model_shape_accessor(L, "save", 2);
+	if (lua_gettop(L) != 2 && lua_gettop(L) != 3) {
+		luaL_error(L, "model_shape_save: requires 2 or 3 arguments");
+	}
+
+	AlModelShape *model = lua_touserdata(L, 1);
 	const char *filename = luaL_checkstring(L, 2);
 
+	AlModelShapeSaveOptions options = {
+		.precision = 0,
+		.deduplicate = false,
+		.compressed = false
+	};
+
+	if (!lua_isnoneornil(L, 3)) {
+		luaL_checktype(L, 3, LUA_TTABLE);
+
+		lua_getfield(L, 3, "precision");
+		options.precision = luaL_optnumber(L, -1, 0);
+		lua_getfield(L, 3, "deduplicate");
+		options.deduplicate = lua_toboolean(L, -1);
+		lua_getfield(L, 3, "compressed");
+		options.compressed = lua_toboolean(L, -1);
+		lua_pop(L, 3);
+	}
+
 	AlStream *stream = NULL;
 
-	TRY(al_stream_init_filename(&stream, filename, AL_OPEN_WRITE));
-	TRY(al_model_shape_save(model, stream));
+	TRY(al_stream_init_filename_counted(&stream, filename, AL_OPEN_WRITE));
+	TRY(al_model_shape_save_with_options(model, stream, &options));
+	TRY(al_stream_flush(stream));
 
 	CATCH_LUA(, "Error saving model")
 	FINALLY_LUA(
@@ -151,6 +177,8 @@ static int cmd_model_path_set_point(lua_State *L)
 		.curveBias = luaL_checknumber(L, 5)
 	};
 
+	al_model_path_changed(path);
+
 	return 0;
 }
 
@@ -188,6 +216,18 @@ static int cmd_model_path_remove_point(lua_State *L)
 	FINALLY_LUA(, 0)
 }
 
+static int cmd_model_set_pack(lua_State *L)
+{
+	BEGIN()
+
+	const char *filename = luaL_optstring(L, 1, NULL);
+
+	TRY(al_model_set_pack(filename));
+
+	CATCH_LUA(, "Error opening model pack")
+	FINALLY_LUA(, 0)
+}
+
 static int cmd_model_path_hit_test(lua_State *L)
 {
 	AlModelPath *path = cmd_path_accessor(L, "hit_test", 3);
@@ -227,6 +267,7 @@ static const luaL_Reg lib[] = {
 	{"path_add_point", cmd_model_path_add_point},
 	{"path_remove_point", cmd_model_path_remove_point},
 	{"path_hit_test", cmd_model_path_hit_test},
+	{"set_pack", cmd_model_set_pack},
 	{NULL, NULL}
 };
 
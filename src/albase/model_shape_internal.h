@@ -18,6 +18,8 @@ struct AlModelPath {
 	int numPoints;
 	size_t pointsLength;
 	AlModelPoint *points;
+	/** Changed along with the points, so models can tell which paths to rebuild */
+	unsigned int generation;
 };
 
 #endif
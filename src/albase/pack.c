@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2014 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include <string.h>
+#include <limits.h>
+
+#include "albase/pack.h"
+#include "albase/data.h"
+#include "albase/crc32c.h"
+
+#define PACK_TAG AL_DATA_TAG('P', 'A', 'C', 'K')
+#define VERSION_TAG AL_DATA_TAG('V', 'E', 'R', 'S')
+#define NAMES_TAG AL_DATA_TAG('N', 'A', 'M', 'E')
+#define OFFSETS_TAG AL_DATA_TAG('O', 'F', 'F', 'S')
+#define SIZES_TAG AL_DATA_TAG('S', 'I', 'Z', 'E')
+#define CHECKSUMS_TAG AL_DATA_TAG('C', 'R', 'C', 'S')
+
+#define PACK_VERSION 1
+
+/** Marks an unused slot in the name index */
+#define NO_DOCUMENT UINT32_MAX
+
+struct AlPack {
+	AlStream *file;
+
+	/** Where the documents start, just after the directory */
+	const uint8_t *documents;
+	size_t documentsSize;
+
+	size_t numDocuments;
+	char **names;
+	int *offsets;
+	int *sizes;
+	int *checksums;
+	/** Set once a document's checksum has been checked */
+	bool *verified;
+
+	/** Open addressed table of document indices, hashed by name */
+	uint32_t *slots;
+	size_t slotMask;
+};
+
+static uint32_t hash_name(const char *name)
+{
+	return al_crc32c(0, name, strlen(name));
+}
+
+/**
+ * Build a table to find documents by name. Fails if any name is used more
+ * than once.
+ */
+static AlError build_index(const char *const *names, size_t count, uint32_t **result, size_t *mask)
+{
+	BEGIN()
+
+	uint32_t *slots = NULL;
+	size_t numSlots = 8;
+
+	while (numSlots < count * 2) {
+		numSlots *= 2;
+	}
+
+	TRY(al_malloc(&slots, sizeof(uint32_t) * numSlots));
+
+	for (size_t i = 0; i < numSlots; i++) {
+		slots[i] = NO_DOCUMENT;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		size_t slot = hash_name(names[i]) & (numSlots - 1);
+
+		while (slots[slot] != NO_DOCUMENT) {
+			if (!strcmp(names[slots[slot]], names[i])) {
+				al_log_error("document in pack more than once: %s", names[i]);
+				THROW(AL_ERROR_INVALID_DATA);
+			}
+			slot = (slot + 1) & (numSlots - 1);
+		}
+
+		slots[slot] = i;
+	}
+
+	*result = slots;
+	*mask = numSlots - 1;
+
+	CATCH({
+		al_free(slots);
+	})
+	FINALLY()
+}
+
+static AlError read_directory(AlPack *pack, const uint8_t *ptr, size_t size)
+{
+	BEGIN()
+
+	AlMemStream stream = al_stream_init_mem_stack(ptr, size, pack->file->name);
+	AlData *data = NULL;
+	int version = 0;
+	uint64_t numNames = 0, numOffsets = 0, numSizes = 0, numChecksums = 0;
+
+	TRY(al_data_init(&data, &stream.base));
+	TRY(al_data_read_start_tag(data, PACK_TAG, NULL));
+
+	START_READ_TAGS(data) {
+		case VERSION_TAG:
+			TRY(al_data_read_value(data, AL_VAR_INT, &version, NULL));
+			TRY(al_data_skip_rest(data));
+			break;
+
+		case NAMES_TAG:
+			al_free(pack->names);
+			pack->names = NULL;
+			TRY(al_data_read_array(data, AL_VAR_STRING, &pack->names, &numNames, NULL));
+			TRY(al_data_skip_rest(data));
+			break;
+
+		case OFFSETS_TAG:
+			al_free(pack->offsets);
+			pack->offsets = NULL;
+			TRY(al_data_read_array(data, AL_VAR_INT, &pack->offsets, &numOffsets, NULL));
+			TRY(al_data_skip_rest(data));
+			break;
+
+		case SIZES_TAG:
+			al_free(pack->sizes);
+			pack->sizes = NULL;
+			TRY(al_data_read_array(data, AL_VAR_INT, &pack->sizes, &numSizes, NULL));
+			TRY(al_data_skip_rest(data));
+			break;
+
+		case CHECKSUMS_TAG:
+			al_free(pack->checksums);
+			pack->checksums = NULL;
+			TRY(al_data_read_array(data, AL_VAR_INT, &pack->checksums, &numChecksums, NULL));
+			TRY(al_data_skip_rest(data));
+			break;
+	} END_READ_TAGS(data);
+
+	if (version != PACK_VERSION) {
+		al_log_error("unsupported pack version: %d", version);
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	if (numOffsets != numNames || numSizes != numNames || numChecksums != numNames) {
+		al_log_error("pack directory is incomplete");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	uint64_t start = al_data_get_offset(data);
+	pack->documents = ptr + start;
+	pack->documentsSize = size - start;
+	pack->numDocuments = numNames;
+
+	for (size_t i = 0; i < pack->numDocuments; i++) {
+		if (pack->offsets[i] < 0 || pack->sizes[i] < 0 ||
+			(size_t)pack->offsets[i] + (size_t)pack->sizes[i] > pack->documentsSize) {
+			al_log_error("document outside of pack: %s", pack->names[i]);
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+	}
+
+	PASS({
+		al_data_free(data);
+	})
+}
+
+AlError al_pack_open(AlPack **result, const char *filename)
+{
+	BEGIN()
+
+	AlPack *pack = NULL;
+	TRY(al_malloc(&pack, sizeof(AlPack)));
+
+	pack->file = NULL;
+	pack->documents = NULL;
+	pack->documentsSize = 0;
+	pack->numDocuments = 0;
+	pack->names = NULL;
+	pack->offsets = NULL;
+	pack->sizes = NULL;
+	pack->checksums = NULL;
+	pack->verified = NULL;
+	pack->slots = NULL;
+	pack->slotMask = 0;
+
+	TRY(al_stream_init_mmap(&pack->file, filename));
+
+	AlMemStream *mapped = (AlMemStream *)pack->file;
+	TRY(read_directory(pack, mapped->ptr, (const uint8_t *)mapped->end - (const uint8_t *)mapped->ptr));
+
+	TRY(build_index((const char *const *)pack->names, pack->numDocuments, &pack->slots, &pack->slotMask));
+
+	if (pack->numDocuments > 0) {
+		TRY(al_malloc(&pack->verified, sizeof(bool) * pack->numDocuments));
+		memset(pack->verified, 0, sizeof(bool) * pack->numDocuments);
+	}
+
+	*result = pack;
+
+	CATCH({
+		al_log_error("error opening pack: %s", filename);
+		al_pack_free(pack);
+	})
+	FINALLY()
+}
+
+void al_pack_free(AlPack *pack)
+{
+	if (pack) {
+		al_free(pack->names);
+		al_free(pack->offsets);
+		al_free(pack->sizes);
+		al_free(pack->checksums);
+		al_free(pack->verified);
+		al_free(pack->slots);
+		al_stream_free(pack->file);
+		al_free(pack);
+	}
+}
+
+size_t al_pack_get_num_documents(AlPack *pack)
+{
+	return pack->numDocuments;
+}
+
+const char *al_pack_get_name(AlPack *pack, size_t index)
+{
+	return (index < pack->numDocuments) ? pack->names[index] : NULL;
+}
+
+static uint32_t find_document(AlPack *pack, const char *name)
+{
+	size_t slot = hash_name(name) & pack->slotMask;
+
+	while (pack->slots[slot] != NO_DOCUMENT) {
+		uint32_t index = pack->slots[slot];
+		if (!strcmp(pack->names[index], name)) {
+			return index;
+		}
+		slot = (slot + 1) & pack->slotMask;
+	}
+
+	return NO_DOCUMENT;
+}
+
+AlError al_pack_init_stream(AlPack *pack, const char *name, AlStream **stream)
+{
+	BEGIN()
+
+	uint32_t index = find_document(pack, name);
+
+	if (index == NO_DOCUMENT) {
+		al_log_error("document not found in pack %s: %s", pack->file->name, name);
+		THROW(AL_ERROR_INVALID_OPERATION);
+	}
+
+	const uint8_t *ptr = pack->documents + pack->offsets[index];
+	size_t size = pack->sizes[index];
+
+	if (!pack->verified[index]) {
+		if (al_crc32c(0, ptr, size) != (uint32_t)pack->checksums[index]) {
+			al_log_error("checksum mismatch in pack %s: %s", pack->file->name, name);
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+		pack->verified[index] = true;
+	}
+
+	TRY(al_stream_init_mem(stream, (void *)ptr, size, false, name));
+
+	PASS()
+}
+
+AlError al_pack_write(AlStream *stream, const char *const *names, const AlBlob *documents, size_t count)
+{
+	BEGIN()
+
+	AlData *data = NULL;
+	uint32_t *slots = NULL;
+	size_t mask;
+	int *offsets = NULL;
+	int *sizes = NULL;
+	int *checksums = NULL;
+	int version = PACK_VERSION;
+	size_t total = 0;
+
+	TRY(build_index(names, count, &slots, &mask));
+
+	if (count > 0) {
+		TRY(al_malloc(&offsets, sizeof(int) * count));
+		TRY(al_malloc(&sizes, sizeof(int) * count));
+		TRY(al_malloc(&checksums, sizeof(int) * count));
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (documents[i].length > INT_MAX - total) {
+			al_log_error("too much data for a pack");
+			THROW(AL_ERROR_INVALID_OPERATION);
+		}
+
+		offsets[i] = total;
+		sizes[i] = documents[i].length;
+		checksums[i] = (int)al_crc32c(0, documents[i].bytes, documents[i].length);
+		total += documents[i].length;
+	}
+
+	TRY(al_data_init(&data, stream));
+	al_data_set_sized_groups(data, true);
+	al_data_set_checksums(data, true);
+
+	TRY(al_data_write_start_tag(data, PACK_TAG));
+	TRY(al_data_write_simple_tag(data, VERSION_TAG, AL_VAR_INT, &version));
+
+	TRY(al_data_write_start_tag(data, NAMES_TAG));
+	TRY(al_data_write_array(data, AL_VAR_STRING, names, count));
+	TRY(al_data_write_end(data));
+
+	TRY(al_data_write_start_tag(data, OFFSETS_TAG));
+	TRY(al_data_write_array(data, AL_VAR_INT, offsets, count));
+	TRY(al_data_write_end(data));
+
+	TRY(al_data_write_start_tag(data, SIZES_TAG));
+	TRY(al_data_write_array(data, AL_VAR_INT, sizes, count));
+	TRY(al_data_write_end(data));
+
+	TRY(al_data_write_start_tag(data, CHECKSUMS_TAG));
+	TRY(al_data_write_array(data, AL_VAR_INT, checksums, count));
+	TRY(al_data_write_end(data));
+
+	TRY(al_data_write_end(data));
+	TRY(al_data_flush(data));
+
+	for (size_t i = 0; i < count; i++) {
+		if (documents[i].length > 0) {
+			TRY(stream->write(stream, documents[i].bytes, documents[i].length));
+		}
+	}
+
+	PASS({
+		al_data_free(data);
+		al_free(slots);
+		al_free(offsets);
+		al_free(sizes);
+		al_free(checksums);
+	})
+}
@@ -50,6 +50,7 @@ AlError al_script_init(lua_State **result)
 	luaL_Reg luaLibs[] = {
 		{"fs", luaopen_fs},
 		{"text", luaopen_text},
+		{"streams", luaopen_streams},
 		{NULL, NULL}
 	};
 
@@ -101,12 +102,16 @@ AlError al_script_run_file(lua_State *L, const char *filename)
 {
 	BEGIN()
 
+	AlStream *file = NULL;
 	AlStream *stream = NULL;
-	TRY(al_stream_init_filename(&stream, filename, AL_OPEN_READ));
+	TRY(al_stream_init_filename_counted(&file, filename, AL_OPEN_READ));
+	TRY(al_stream_init_prefetch(&stream, file, 0, 0, true));
+	file = NULL;
 	TRY(al_script_run_stream(L, stream));
 
 	PASS(
 		al_stream_free(stream);
+		al_stream_free(file);
 	)
 }
 
@@ -44,6 +44,8 @@ Model = wrap('model_shape', function(self, ...)
 	end
 end)
 Model.prototype.load = model.shape_load
+-- Takes an optional table of options: precision, to round and delta encode
+-- points, deduplicate, to save repeated paths as references, and compressed
 Model.prototype.save = model.shape_save
 
 function Model.prototype:paths()
@@ -51,3 +53,7 @@ function Model.prototype:paths()
 end
 Model.prototype.add_path = model.shape_add_path
 Model.prototype.remove_path = model.shape_remove_path
+
+-- Open the pack that models named with a pack: prefix are loaded from, or
+-- close it if no filename is given
+Model.set_pack = model.set_pack
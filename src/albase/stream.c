@@ -4,6 +4,8 @@
  * See COPYING for details.
  */
 
+#include <stdint.h>
+
 #include "albase/stream.h"
 
 void al_stream_free(AlStream *stream)
@@ -13,18 +15,28 @@ void al_stream_free(AlStream *stream)
 	}
 }
 
+AlError al_stream_flush(AlStream *stream)
+{
+	return stream->flush ? stream->flush(stream) : AL_NO_ERROR;
+}
+
 AlError al_stream_read_to_string(AlStream *stream, char **result, size_t *resultSize)
 {
 	BEGIN()
 
-	long size;
+	char *string = NULL;
+	int64_t size;
 	TRY(stream->seek(stream, 0, AL_SEEK_END));
 	TRY(stream->tell(stream, &size));
 	TRY(stream->seek(stream, 0, AL_SEEK_SET));
 
-	char *string;
+	if ((uint64_t)size >= SIZE_MAX) {
+		al_log_error("stream too large to read into memory: %s", stream->name);
+		THROW(AL_ERROR_INVALID_OPERATION);
+	}
+
 	TRY(al_malloc(&string, size + 1));
-	TRY(stream->read(stream, &string, size, NULL));
+	TRY(stream->read(stream, string, size, NULL));
 	string[size] = '\0';
 
 	*result = string;
@@ -33,7 +45,10 @@ AlError al_stream_read_to_string(AlStream *stream, char **result, size_t *result
 		*resultSize = size;
 	}
 
-	PASS()
+	CATCH({
+		al_free(string);
+	})
+	FINALLY()
 }
 
 AlError al_read_file_to_string(const char *filename, char **string)
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2014 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include "albase/stream.h"
+#include "albase/lua.h"
+#include "libs.h"
+
+static void push_counter(lua_State *L, const char *op, const AlStreamCounter *counter)
+{
+	lua_createtable(L, 0, 3);
+
+	lua_pushnumber(L, counter->calls);
+	lua_setfield(L, -2, "calls");
+	lua_pushnumber(L, counter->bytes);
+	lua_setfield(L, -2, "bytes");
+	lua_pushnumber(L, counter->seconds);
+	lua_setfield(L, -2, "seconds");
+
+	lua_setfield(L, -2, op);
+}
+
+static int cmd_get_stats(lua_State *L)
+{
+	AlStreamStats stats;
+	al_stream_get_total_stats(&stats);
+
+	lua_createtable(L, 0, 5);
+	push_counter(L, "read", &stats.read);
+	push_counter(L, "write", &stats.write);
+	push_counter(L, "seek", &stats.seek);
+	push_counter(L, "tell", &stats.tell);
+	push_counter(L, "borrow", &stats.borrow);
+
+	return 1;
+}
+
+static int cmd_set_counting(lua_State *L)
+{
+	luaL_checkany(L, 1);
+	al_stream_set_counting(lua_toboolean(L, 1));
+
+	return 0;
+}
+
+static const luaL_Reg lib[] = {
+	{"get_stats", cmd_get_stats},
+	{"set_counting", cmd_set_counting},
+	{NULL, NULL}
+};
+
+int luaopen_streams(lua_State *L)
+{
+	luaL_newlib(L, lib);
+	return 1;
+}
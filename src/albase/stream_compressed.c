@@ -0,0 +1,482 @@
+/*
+ * Copyright (c) 2014 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "albase/stream.h"
+#include "albase/lz.h"
+
+/*
+ * A compressed stream is AL_STREAM_COMPRESSED_MAGIC followed by blocks, each
+ * of which is a header of two uint32_ts, the decompressed size and the stored
+ * size, and then the stored bytes. If the stored size is the same as the
+ * decompressed size the block is stored uncompressed.
+ */
+
+#define MAGIC_SIZE 4
+#define HEADER_SIZE 8
+
+/** Largest block accepted when reading, to reject corrupt headers early */
+#define MAX_BLOCK_SIZE (16 * 1024 * 1024)
+
+typedef struct {
+	/** Offset of the block in the decompressed data */
+	uint64_t offset;
+	/** Offset of the block's header from the first block */
+	int64_t position;
+	uint32_t size;
+	uint32_t storedSize;
+} Block;
+
+typedef struct {
+	AlStream base;
+	AlStream *stream;
+	bool freeStream;
+
+	/** Decompressed contents of the current block */
+	uint8_t *block;
+	size_t blockSize;
+	size_t blockLength;
+	size_t blockPos;
+	uint64_t blockOffset;
+
+	uint8_t *stored;
+	size_t storedSize;
+
+	/** Blocks found so far when reading, in order */
+	Block *blocks;
+	size_t numBlocks;
+	size_t blocksLength;
+	bool allBlocksFound;
+	/** Index of the current block, or numBlocks if none is loaded */
+	size_t current;
+
+	/**
+	 * Where the wrapped stream is positioned relative to the first block,
+	 * or -1 if not known after an error
+	 */
+	int64_t position;
+} CompressedStream;
+
+static AlError grow_buffer(uint8_t **buffer, size_t *size, size_t needed)
+{
+	BEGIN()
+
+	if (*size < needed) {
+		TRY(al_realloc(buffer, needed));
+		*size = needed;
+	}
+
+	PASS()
+}
+
+static AlError seek_stream(CompressedStream *stream, int64_t position)
+{
+	BEGIN()
+
+	if (stream->position < 0) {
+		al_log_error("compressed stream %s can't be used after an error", stream->base.name);
+		THROW(AL_ERROR_IO);
+	}
+
+	if (stream->position != position) {
+		TRY(stream->stream->seek(stream->stream, position - stream->position, AL_SEEK_CUR));
+		stream->position = position;
+	}
+
+	PASS()
+}
+
+/**
+ * Read the header of the block after the last one found.
+ * found is set to false at the end of the stream.
+ */
+static AlError find_next_block(CompressedStream *stream, bool *found)
+{
+	BEGIN()
+
+	Block block = {0, 0, 0, 0};
+
+	if (stream->numBlocks > 0) {
+		Block *last = &stream->blocks[stream->numBlocks - 1];
+		block.offset = last->offset + last->size;
+		block.position = last->position + HEADER_SIZE + last->storedSize;
+	}
+
+	TRY(seek_stream(stream, block.position));
+
+	uint32_t header[2];
+	size_t bytesRead;
+	TRY(stream->stream->read(stream->stream, header, HEADER_SIZE, &bytesRead));
+	stream->position += bytesRead;
+
+	if (bytesRead == 0) {
+		stream->allBlocksFound = true;
+		*found = false;
+		RETURN();
+	}
+
+	block.size = header[0];
+	block.storedSize = header[1];
+
+	if (bytesRead != HEADER_SIZE || block.size > MAX_BLOCK_SIZE || block.storedSize > block.size) {
+		al_log_error("invalid block header in compressed stream %s", stream->base.name);
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	if (stream->numBlocks == stream->blocksLength) {
+		size_t length = stream->blocksLength ? stream->blocksLength * 2 : 16;
+		TRY(al_realloc(&stream->blocks, sizeof(Block) * length));
+		stream->blocksLength = length;
+	}
+
+	stream->blocks[stream->numBlocks++] = block;
+	*found = true;
+
+	PASS()
+}
+
+static AlError load_block(CompressedStream *stream, size_t index)
+{
+	BEGIN()
+
+	Block *block = &stream->blocks[index];
+
+	stream->current = stream->numBlocks;
+	TRY(grow_buffer(&stream->block, &stream->blockSize, block->size));
+	TRY(seek_stream(stream, block->position + HEADER_SIZE));
+
+	if (block->storedSize == block->size) {
+		TRY(stream->stream->read(stream->stream, stream->block, block->size, NULL));
+
+	} else {
+		TRY(grow_buffer(&stream->stored, &stream->storedSize, block->storedSize));
+		TRY(stream->stream->read(stream->stream, stream->stored, block->storedSize, NULL));
+		TRY(al_lz_decompress(stream->stored, block->storedSize, stream->block, block->size));
+	}
+
+	stream->position += block->storedSize;
+	stream->current = index;
+	stream->blockLength = block->size;
+	stream->blockPos = 0;
+	stream->blockOffset = block->offset;
+
+	CATCH(
+		stream->position = -1;
+	)
+	FINALLY()
+}
+
+static AlError compressed_read(AlStream *base, void *ptr, size_t size, size_t *bytesRead)
+{
+	BEGIN()
+
+	CompressedStream *stream = (CompressedStream *)base;
+	uint8_t *out = ptr;
+	size_t total = 0;
+
+	while (total < size) {
+		if (stream->blockPos == stream->blockLength) {
+			size_t next = (stream->current < stream->numBlocks) ? stream->current + 1 : 0;
+
+			if (next == stream->numBlocks) {
+				bool found = false;
+				if (!stream->allBlocksFound) {
+					TRY(find_next_block(stream, &found));
+				}
+
+				if (!found) {
+					break;
+				}
+			}
+
+			TRY(load_block(stream, next));
+			continue;
+		}
+
+		size_t length = stream->blockLength - stream->blockPos;
+		if (length > size - total) {
+			length = size - total;
+		}
+
+		memcpy(out + total, stream->block + stream->blockPos, length);
+		stream->blockPos += length;
+		total += length;
+	}
+
+	if (total < size && !bytesRead) {
+		al_log_error("unexpected end of stream");
+		THROW(AL_ERROR_IO);
+	}
+
+	if (bytesRead) {
+		*bytesRead = total;
+	}
+
+	PASS()
+}
+
+static AlError compressed_tell(AlStream *base, int64_t *offset)
+{
+	CompressedStream *stream = (CompressedStream *)base;
+
+	*offset = stream->blockOffset + stream->blockPos;
+
+	return AL_NO_ERROR;
+}
+
+static AlError compressed_seek(AlStream *base, int64_t offset, AlSeekPos whence)
+{
+	BEGIN()
+
+	CompressedStream *stream = (CompressedStream *)base;
+	bool found = true;
+	uint64_t target;
+
+	switch (whence) {
+		case AL_SEEK_CUR:
+			target = stream->blockOffset + stream->blockPos + offset;
+			break;
+
+		case AL_SEEK_END:
+			while (!stream->allBlocksFound) {
+				TRY(find_next_block(stream, &found));
+			}
+			found = true;
+
+			target = offset;
+			if (stream->numBlocks > 0) {
+				Block *last = &stream->blocks[stream->numBlocks - 1];
+				target += last->offset + last->size;
+			}
+			break;
+
+		default:
+			target = offset;
+			break;
+	}
+
+	if (target >= stream->blockOffset && target <= stream->blockOffset + stream->blockLength) {
+		stream->blockPos = target - stream->blockOffset;
+		RETURN();
+	}
+
+	// Find the block containing the target, reading more headers if needed
+	while (found && (stream->numBlocks == 0 ||
+			target >= stream->blocks[stream->numBlocks - 1].offset + stream->blocks[stream->numBlocks - 1].size)) {
+		if (stream->allBlocksFound) {
+			found = false;
+		} else {
+			TRY(find_next_block(stream, &found));
+		}
+	}
+
+	if (!found) {
+		uint64_t end = 0;
+		if (stream->numBlocks > 0) {
+			end = stream->blocks[stream->numBlocks - 1].offset + stream->blocks[stream->numBlocks - 1].size;
+		}
+
+		if (target != end) {
+			al_log_error("seek outside of compressed stream %s", stream->base.name);
+			THROW(AL_ERROR_IO);
+		}
+
+		// Positioned at the very end, with no block loaded
+		stream->current = stream->numBlocks ? stream->numBlocks - 1 : stream->numBlocks;
+		stream->blockOffset = end;
+		stream->blockLength = 0;
+		stream->blockPos = 0;
+		RETURN();
+	}
+
+	size_t low = 0, high = stream->numBlocks - 1;
+	while (low < high) {
+		size_t mid = (low + high + 1) / 2;
+		if (stream->blocks[mid].offset <= target) {
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+	}
+
+	TRY(load_block(stream, low));
+	stream->blockPos = target - stream->blockOffset;
+
+	PASS()
+}
+
+static AlError flush_block(CompressedStream *stream)
+{
+	BEGIN()
+
+	if (stream->blockPos == 0) {
+		RETURN();
+	}
+
+	uint32_t header[2] = {stream->blockPos, stream->blockPos};
+
+	size_t storedSize = al_lz_compress(stream->block, stream->blockPos, stream->stored, stream->blockPos - 1);
+	if (storedSize) {
+		header[1] = storedSize;
+	}
+
+	TRY(stream->stream->write(stream->stream, header, HEADER_SIZE));
+	TRY(stream->stream->write(stream->stream, storedSize ? stream->stored : stream->block, header[1]));
+
+	stream->blockOffset += stream->blockPos;
+	stream->blockPos = 0;
+
+	PASS()
+}
+
+static AlError compressed_write(AlStream *base, const void *ptr, size_t size)
+{
+	BEGIN()
+
+	CompressedStream *stream = (CompressedStream *)base;
+	const uint8_t *in = ptr;
+
+	while (size > 0) {
+		size_t length = stream->blockSize - stream->blockPos;
+		if (length > size) {
+			length = size;
+		}
+
+		memcpy(stream->block + stream->blockPos, in, length);
+		stream->blockPos += length;
+		in += length;
+		size -= length;
+
+		if (stream->blockPos == stream->blockSize) {
+			TRY(flush_block(stream));
+		}
+	}
+
+	PASS()
+}
+
+static AlError compressed_flush(AlStream *base)
+{
+	BEGIN()
+
+	CompressedStream *stream = (CompressedStream *)base;
+
+	TRY(flush_block(stream));
+	TRY(al_stream_flush(stream->stream));
+
+	PASS()
+}
+
+static void compressed_free(AlStream *base)
+{
+	CompressedStream *stream = (CompressedStream *)base;
+
+	if (stream) {
+		if (base->write) {
+			flush_block(stream);
+		}
+
+		if (stream->freeStream) {
+			al_stream_free(stream->stream);
+		}
+
+		al_free(stream->block);
+		al_free(stream->stored);
+		al_free(stream->blocks);
+		al_free(stream);
+	}
+}
+
+AlError al_stream_init_compressed(AlStream **result, AlStream *wrapped, AlOpenMode mode, bool freeStream)
+{
+	BEGIN()
+
+	CompressedStream *stream = NULL;
+	TRY(al_malloc(&stream, sizeof(CompressedStream)));
+
+	stream->base = (AlStream){
+		.name = wrapped->name,
+		.read = NULL,
+		.write = NULL,
+		.seek = NULL,
+		.tell = compressed_tell,
+		.free = compressed_free,
+		.borrow = NULL
+	};
+	stream->stream = wrapped;
+	stream->freeStream = false;
+	stream->block = NULL;
+	stream->blockSize = 0;
+	stream->blockLength = 0;
+	stream->blockPos = 0;
+	stream->blockOffset = 0;
+	stream->stored = NULL;
+	stream->storedSize = 0;
+	stream->blocks = NULL;
+	stream->numBlocks = 0;
+	stream->blocksLength = 0;
+	stream->allBlocksFound = false;
+	stream->current = 0;
+	stream->position = 0;
+
+	if (mode == AL_OPEN_READ) {
+		char magic[MAGIC_SIZE];
+		TRY(wrapped->read(wrapped, magic, MAGIC_SIZE, NULL));
+
+		if (memcmp(magic, AL_STREAM_COMPRESSED_MAGIC, MAGIC_SIZE) != 0) {
+			al_log_error("not a compressed stream: %s", wrapped->name);
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+
+		stream->base.read = compressed_read;
+		stream->base.seek = compressed_seek;
+
+	} else {
+		TRY(al_malloc(&stream->block, AL_STREAM_COMPRESSED_BLOCK_SIZE));
+		TRY(al_malloc(&stream->stored, AL_STREAM_COMPRESSED_BLOCK_SIZE));
+		stream->blockSize = AL_STREAM_COMPRESSED_BLOCK_SIZE;
+		stream->storedSize = AL_STREAM_COMPRESSED_BLOCK_SIZE;
+
+		TRY(wrapped->write(wrapped, AL_STREAM_COMPRESSED_MAGIC, MAGIC_SIZE));
+
+		stream->base.write = compressed_write;
+		stream->base.flush = compressed_flush;
+	}
+
+	stream->freeStream = freeStream;
+	*result = &stream->base;
+
+	CATCH(
+		compressed_free(&stream->base);
+	)
+	FINALLY()
+}
+
+AlError al_stream_detect_compressed(AlStream **stream)
+{
+	BEGIN()
+
+	AlStream *wrapped = *stream;
+	char magic[MAGIC_SIZE];
+	size_t bytesRead;
+
+	if (!wrapped->seek) {
+		al_log_error("can't check for compression in stream that can't seek: %s", wrapped->name);
+		THROW(AL_ERROR_INVALID_OPERATION);
+	}
+
+	TRY(wrapped->read(wrapped, magic, MAGIC_SIZE, &bytesRead));
+	TRY(wrapped->seek(wrapped, -(int64_t)bytesRead, AL_SEEK_CUR));
+
+	if (bytesRead == MAGIC_SIZE && !memcmp(magic, AL_STREAM_COMPRESSED_MAGIC, MAGIC_SIZE)) {
+		TRY(al_stream_init_compressed(stream, wrapped, AL_OPEN_READ, true));
+	}
+
+	PASS()
+}
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2014 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include <string.h>
+#include <SDL2/SDL.h>
+
+#include "albase/stream.h"
+
+typedef struct CountedStream CountedStream;
+
+struct CountedStream {
+	AlStream base;
+	AlStream *stream;
+	bool freeStream;
+	bool dump;
+	AlStreamStats stats;
+
+	/** Counted streams that haven't been freed yet, for the totals */
+	CountedStream *prev;
+	CountedStream *next;
+};
+
+/**
+ * Guards the list of live streams, every stream's counts, and the counts of
+ * freed ones. Counts are updated on whichever thread uses a stream, which
+ * may be a prefetching stream's reader, and read from the main thread.
+ */
+static SDL_SpinLock lock;
+static CountedStream *live;
+static AlStreamStats freed;
+
+static SDL_atomic_t counting;
+
+static inline void count(AlStreamCounter *counter, Uint64 start, uint64_t bytes)
+{
+	double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+	SDL_AtomicLock(&lock);
+	counter->calls++;
+	counter->bytes += bytes;
+	counter->seconds += seconds;
+	SDL_AtomicUnlock(&lock);
+}
+
+static void add_counter(AlStreamCounter *total, const AlStreamCounter *counter)
+{
+	total->calls += counter->calls;
+	total->bytes += counter->bytes;
+	total->seconds += counter->seconds;
+}
+
+static void add_stats(AlStreamStats *total, const AlStreamStats *stats)
+{
+	add_counter(&total->read, &stats->read);
+	add_counter(&total->write, &stats->write);
+	add_counter(&total->seek, &stats->seek);
+	add_counter(&total->tell, &stats->tell);
+	add_counter(&total->borrow, &stats->borrow);
+}
+
+static AlError counted_read(AlStream *base, void *ptr, size_t size, size_t *bytesRead)
+{
+	CountedStream *stream = (CountedStream *)base;
+	size_t n = 0;
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	AlError error = stream->stream->read(stream->stream, ptr, size, bytesRead ? &n : NULL);
+
+	if (!bytesRead && !error) {
+		n = size;
+	}
+
+	count(&stream->stats.read, start, n);
+
+	if (bytesRead) {
+		*bytesRead = n;
+	}
+
+	return error;
+}
+
+static AlError counted_write(AlStream *base, const void *ptr, size_t size)
+{
+	CountedStream *stream = (CountedStream *)base;
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	AlError error = stream->stream->write(stream->stream, ptr, size);
+	count(&stream->stats.write, start, error ? 0 : size);
+
+	return error;
+}
+
+static AlError counted_seek(AlStream *base, int64_t offset, AlSeekPos whence)
+{
+	CountedStream *stream = (CountedStream *)base;
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	AlError error = stream->stream->seek(stream->stream, offset, whence);
+	count(&stream->stats.seek, start, 0);
+
+	return error;
+}
+
+static AlError counted_tell(AlStream *base, int64_t *offset)
+{
+	CountedStream *stream = (CountedStream *)base;
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	AlError error = stream->stream->tell(stream->stream, offset);
+	count(&stream->stats.tell, start, 0);
+
+	return error;
+}
+
+static AlError counted_borrow(AlStream *base, size_t size, const void **ptr, size_t *bytesBorrowed)
+{
+	CountedStream *stream = (CountedStream *)base;
+	size_t n = 0;
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	AlError error = stream->stream->borrow(stream->stream, size, ptr, bytesBorrowed ? &n : NULL);
+
+	if (!bytesBorrowed && !error) {
+		n = size;
+	}
+
+	count(&stream->stats.borrow, start, n);
+
+	if (bytesBorrowed) {
+		*bytesBorrowed = n;
+	}
+
+	return error;
+}
+
+static AlError counted_flush(AlStream *base)
+{
+	CountedStream *stream = (CountedStream *)base;
+
+	return stream->stream->flush(stream->stream);
+}
+
+static void dump_counter(const char *name, const char *op, const AlStreamCounter *counter)
+{
+	if (counter->calls) {
+		al_log("%s: %llu %s calls, %llu bytes, %.3f ms", name, (unsigned long long)counter->calls, op,
+			(unsigned long long)counter->bytes, counter->seconds * 1000);
+	}
+}
+
+static void dump_stats(const char *name, const AlStreamStats *stats)
+{
+	dump_counter(name, "read", &stats->read);
+	dump_counter(name, "write", &stats->write);
+	dump_counter(name, "seek", &stats->seek);
+	dump_counter(name, "tell", &stats->tell);
+	dump_counter(name, "borrow", &stats->borrow);
+}
+
+static void counted_free(AlStream *base)
+{
+	CountedStream *stream = (CountedStream *)base;
+
+	if (stream) {
+		SDL_AtomicLock(&lock);
+
+		add_stats(&freed, &stream->stats);
+
+		if (stream->prev) {
+			stream->prev->next = stream->next;
+		} else if (live == stream) {
+			live = stream->next;
+		}
+
+		if (stream->next) {
+			stream->next->prev = stream->prev;
+		}
+
+		SDL_AtomicUnlock(&lock);
+
+		if (stream->dump) {
+			dump_stats(base->name ? base->name : "<stream>", &stream->stats);
+		}
+
+		if (stream->freeStream) {
+			al_stream_free(stream->stream);
+		}
+
+		al_free(stream);
+	}
+}
+
+AlError al_stream_init_counted(AlStream **result, AlStream *wrapped, bool dump, bool freeStream)
+{
+	BEGIN()
+
+	CountedStream *stream = NULL;
+	TRY(al_malloc(&stream, sizeof(CountedStream)));
+
+	stream->base = (AlStream){
+		.name = wrapped->name,
+		.read = wrapped->read ? counted_read : NULL,
+		.write = wrapped->write ? counted_write : NULL,
+		.seek = wrapped->seek ? counted_seek : NULL,
+		.tell = wrapped->tell ? counted_tell : NULL,
+		.free = counted_free,
+		.borrow = wrapped->borrow ? counted_borrow : NULL,
+		.flush = wrapped->flush ? counted_flush : NULL
+	};
+	stream->stream = wrapped;
+	stream->freeStream = freeStream;
+	stream->dump = dump;
+	memset(&stream->stats, 0, sizeof(AlStreamStats));
+
+	SDL_AtomicLock(&lock);
+	stream->prev = NULL;
+	stream->next = live;
+	if (live) {
+		live->prev = stream;
+	}
+	live = stream;
+	SDL_AtomicUnlock(&lock);
+
+	*result = &stream->base;
+
+	PASS()
+}
+
+AlError al_stream_get_stats(AlStream *base, AlStreamStats *stats)
+{
+	BEGIN()
+
+	CountedStream *stream = (CountedStream *)base;
+
+	if (base->free != counted_free) {
+		al_log_error("stream is not counted: %s", base->name);
+		THROW(AL_ERROR_INVALID_OPERATION);
+	}
+
+	SDL_AtomicLock(&lock);
+	*stats = stream->stats;
+	SDL_AtomicUnlock(&lock);
+
+	PASS()
+}
+
+void al_stream_get_total_stats(AlStreamStats *stats)
+{
+	SDL_AtomicLock(&lock);
+
+	*stats = freed;
+
+	for (CountedStream *stream = live; stream; stream = stream->next) {
+		add_stats(stats, &stream->stats);
+	}
+
+	SDL_AtomicUnlock(&lock);
+}
+
+void al_stream_set_counting(bool count)
+{
+	SDL_AtomicSet(&counting, count);
+}
+
+bool al_stream_get_counting(void)
+{
+	return SDL_AtomicGet(&counting);
+}
+
+/**
+ * Wrap a newly opened stream in a counted stream if counting is on.
+ */
+static AlError wrap_counted(AlStream **result, AlStream *stream)
+{
+	BEGIN()
+
+	if (al_stream_get_counting()) {
+		TRY(al_stream_init_counted(result, stream, true, true));
+	} else {
+		*result = stream;
+	}
+
+	CATCH(
+		al_stream_free(stream);
+	)
+	FINALLY()
+}
+
+AlError al_stream_init_filename_counted(AlStream **result, const char *filename, AlOpenMode mode)
+{
+	BEGIN()
+
+	AlStream *stream = NULL;
+	TRY(al_stream_init_filename(&stream, filename, mode));
+	TRY(wrap_counted(result, stream));
+
+	PASS()
+}
+
+AlError al_stream_init_mmap_counted(AlStream **result, const char *filename)
+{
+	BEGIN()
+
+	AlStream *stream = NULL;
+	TRY(al_stream_init_mmap(&stream, filename));
+	TRY(wrap_counted(result, stream));
+
+	PASS()
+}
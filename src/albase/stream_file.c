@@ -4,10 +4,18 @@
  * See COPYING for details.
  */
 
+// Before any headers, so that off_t, fseeko and ftello are 64-bit even on
+// 32-bit systems
+#define _FILE_OFFSET_BITS 64
+#ifndef _GNU_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <sys/types.h>
 
 #include "albase/stream.h"
 
@@ -57,13 +65,18 @@ static AlError file_write(AlStream *base, const void *ptr, size_t size)
 	PASS()
 }
 
-static AlError file_seek(AlStream *base, long offset, AlSeekPos whence)
+static AlError file_seek(AlStream *base, int64_t offset, AlSeekPos whence)
 {
 	BEGIN()
 
 	FileStream *stream = (FileStream *)base;
 
-	if (fseek(stream->file, offset, whence)) {
+	if ((off_t)offset != offset) {
+		al_log_error("seek too far for this system in file %s", stream->base.name);
+		THROW(AL_ERROR_IO);
+	}
+
+	if (fseeko(stream->file, offset, whence)) {
 		al_log_error("error seeking file %s: %s", stream->base.name, strerror(errno));
 		THROW(AL_ERROR_IO);
 	}
@@ -71,13 +84,13 @@ static AlError file_seek(AlStream *base, long offset, AlSeekPos whence)
 	PASS()
 }
 
-static AlError file_tell(AlStream *base, long *result)
+static AlError file_tell(AlStream *base, int64_t *result)
 {
 	BEGIN()
 
 	FileStream *stream = (FileStream *)base;
 
-	long offset = ftell(stream->file);
+	off_t offset = ftello(stream->file);
 
 	if (offset < 0) {
 		al_log_error("error getting file position %s: %s", stream->base.name, strerror(errno));
@@ -89,6 +102,20 @@ static AlError file_tell(AlStream *base, long *result)
 	PASS()
 }
 
+static AlError file_flush(AlStream *base)
+{
+	BEGIN()
+
+	FileStream *stream = (FileStream *)base;
+
+	if (fflush(stream->file)) {
+		al_log_error("error writing file %s: %s", stream->base.name, strerror(errno));
+		THROW(AL_ERROR_IO);
+	}
+
+	PASS()
+}
+
 static void file_free(AlStream *base)
 {
 	FileStream *stream = (FileStream *)base;
@@ -117,7 +144,9 @@ AlError al_stream_init_filename(AlStream **result, const char *filename, AlOpenM
 		.write = file_write,
 		.seek = file_seek,
 		.tell = file_tell,
-		.free = file_free
+		.free = file_free,
+		.borrow = NULL,
+		.flush = file_flush
 	};
 	stream->file = NULL;
 	stream->closeFile = true;
@@ -152,7 +181,9 @@ AlError al_stream_init_file(AlStream **result, FILE *file, bool closeFile, const
 		.write = file_write,
 		.seek = file_seek,
 		.tell = file_tell,
-		.free = file_free
+		.free = file_free,
+		.borrow = NULL,
+		.flush = file_flush
 	};
 	stream->file = file;
 	stream->closeFile = closeFile;
@@ -7,6 +7,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "albase/stream.h"
 
@@ -15,6 +20,17 @@ typedef struct {
 	bool freePtr;
 } HeapMemStream;
 
+typedef struct {
+	AlMemStream base;
+	size_t mapSize;
+} MmapStream;
+
+typedef struct {
+	AlMemStream base;
+	/** Size of the buffer at base.ptr, of which base.end is the part written */
+	size_t capacity;
+} GrowableMemStream;
+
 static AlError mem_read(AlStream *base, void *ptr, size_t size, size_t *bytesRead)
 {
 	BEGIN()
@@ -43,44 +59,75 @@ static AlError mem_read(AlStream *base, void *ptr, size_t size, size_t *bytesRea
 	PASS()
 }
 
-static AlError mem_seek(AlStream *base, long offset, AlSeekPos whence)
+static AlError mem_borrow(AlStream *base, size_t size, const void **ptr, size_t *bytesBorrowed)
 {
 	BEGIN()
 
 	AlMemStream *stream = (AlMemStream *)base;
 
-	const void *cur = stream->cur;
+	size_t available = stream->end - stream->cur;
+
+	if (available < size) {
+		if (bytesBorrowed) {
+			size = available;
+		} else {
+			al_log_error("unexpected end of stream");
+			THROW(AL_ERROR_IO);
+		}
+	}
+
+	*ptr = stream->cur;
+
+	stream->cur += size;
+
+	if (bytesBorrowed) {
+		*bytesBorrowed = size;
+	}
+
+	PASS()
+}
+
+static AlError mem_seek(AlStream *base, int64_t offset, AlSeekPos whence)
+{
+	BEGIN()
+
+	AlMemStream *stream = (AlMemStream *)base;
+
+	// Checked against the stream's size before moving, so that large offsets
+	// can't wrap the pointer around
+	uint64_t size = stream->end - stream->ptr;
+	uint64_t from = 0;
 
 	switch (whence) {
 		case AL_SEEK_SET:
-			cur = stream->ptr + offset;
+			from = 0;
 			break;
 
 		case AL_SEEK_CUR:
-			cur = stream->cur + offset;
+			from = stream->cur - stream->ptr;
 			break;
 
 		case AL_SEEK_END:
-			cur = stream->end + offset;
+			from = size;
 			break;
 	}
 
-	if (cur < stream->ptr) {
+	if (offset < 0 && (uint64_t)-(offset + 1) >= from) {
 		al_log_error("cannot seek before start of stream");
 		THROW(AL_ERROR_IO);
 	}
 
-	if (cur > stream->end) {
+	if (offset > 0 && (uint64_t)offset > size - from) {
 		al_log_error("cannot seek past end of stream");
 		THROW(AL_ERROR_IO);
 	}
 
-	stream->cur = cur;
+	stream->cur = stream->ptr + (size_t)(from + offset);
 
 	PASS()
 }
 
-static AlError mem_tell(AlStream *base, long *offset)
+static AlError mem_tell(AlStream *base, int64_t *offset)
 {
 	BEGIN()
 
@@ -127,7 +174,8 @@ AlError al_stream_init_mem(AlStream **result, void *ptr, size_t size, bool freeP
 			.write = NULL,
 			.seek = mem_seek,
 			.tell = mem_tell,
-			.free = mem_free
+			.free = mem_free,
+			.borrow = mem_borrow
 		},
 		.ptr = ptr,
 		.cur = ptr,
@@ -153,10 +201,227 @@ AlMemStream al_stream_init_mem_stack(const void *ptr, size_t size, const char *n
 			.write = NULL,
 			.seek = mem_seek,
 			.tell = mem_tell,
-			.free = NULL
+			.free = NULL,
+			.borrow = mem_borrow
+		},
+		.ptr = ptr,
+		.cur = ptr,
+		.end = ptr + size
+	};
+}
+
+static AlError grow_write(AlStream *base, const void *ptr, size_t size)
+{
+	BEGIN()
+
+	GrowableMemStream *stream = (GrowableMemStream *)base;
+
+	size_t position = stream->base.cur - stream->base.ptr;
+	size_t length = stream->base.end - stream->base.ptr;
+
+	if (size > stream->capacity - position) {
+		if (size > SIZE_MAX - position) {
+			al_log_error("memory stream too large: %s", base->name);
+			THROW(AL_ERROR_MEMORY);
+		}
+
+		size_t needed = position + size;
+		size_t capacity = stream->capacity ? stream->capacity : AL_STREAM_DEFAULT_MEM_RESERVE;
+
+		while (capacity < needed) {
+			capacity = (capacity > SIZE_MAX / 2) ? needed : capacity * 2;
+		}
+
+		void *buffer = (void *)stream->base.ptr;
+		TRY(al_realloc(&buffer, capacity));
+
+		stream->base.ptr = buffer;
+		stream->base.cur = buffer + position;
+		stream->base.end = buffer + length;
+		stream->capacity = capacity;
+	}
+
+	memcpy((void *)stream->base.cur, ptr, size);
+	stream->base.cur += size;
+
+	if (stream->base.cur > stream->base.end) {
+		stream->base.end = stream->base.cur;
+	}
+
+	PASS()
+}
+
+static void grow_free(AlStream *base)
+{
+	GrowableMemStream *stream = (GrowableMemStream *)base;
+
+	if (stream) {
+		al_free((char *)base->name);
+		al_free((void *)stream->base.ptr);
+		al_free(stream);
+	}
+}
+
+AlError al_stream_init_mem_writer(AlStream **result, size_t reserve, const char *name)
+{
+	BEGIN()
+
+	GrowableMemStream *stream = NULL;
+	char *nameCopy = NULL;
+	void *buffer = NULL;
+
+	if (name) {
+		TRY(al_malloc(&nameCopy, strlen(name) + 1));
+		strcpy(nameCopy, name);
+	}
+
+	if (!reserve) {
+		reserve = AL_STREAM_DEFAULT_MEM_RESERVE;
+	}
+
+	TRY(al_malloc(&buffer, reserve));
+	TRY(al_malloc(&stream, sizeof(GrowableMemStream)));
+
+	stream->base = (AlMemStream){
+		.base = {
+			.name = nameCopy,
+			.read = mem_read,
+			.write = grow_write,
+			.seek = mem_seek,
+			.tell = mem_tell,
+			.free = grow_free,
+			.borrow = NULL
+		},
+		.ptr = buffer,
+		.cur = buffer,
+		.end = buffer
+	};
+
+	stream->capacity = reserve;
+
+	*result = &stream->base.base;
+
+	CATCH({
+		al_free(buffer);
+		al_free(nameCopy);
+	})
+	FINALLY()
+}
+
+AlError al_stream_detach_mem(AlStream *base, void **ptr, size_t *size)
+{
+	BEGIN()
+
+	GrowableMemStream *stream = (GrowableMemStream *)base;
+
+	if (base->write != grow_write) {
+		al_log_error("stream is not a growable memory stream: %s", base->name);
+		THROW(AL_ERROR_INVALID_OPERATION);
+	}
+
+	size_t length = stream->base.end - stream->base.ptr;
+
+	if (length) {
+		*ptr = (void *)stream->base.ptr;
+	} else {
+		*ptr = NULL;
+		al_free((void *)stream->base.ptr);
+	}
+
+	*size = length;
+
+	stream->base.ptr = stream->base.cur = stream->base.end = NULL;
+	stream->capacity = 0;
+
+	PASS()
+}
+
+static void mmap_free(AlStream *base)
+{
+	MmapStream *stream = (MmapStream *)base;
+
+	if (stream) {
+		al_free((char *)base->name);
+
+		if (stream->mapSize) {
+			munmap((void *)stream->base.ptr, stream->mapSize);
+		}
+
+		al_free(stream);
+	}
+}
+
+AlError al_stream_init_mmap(AlStream **result, const char *filename)
+{
+	BEGIN()
+
+	MmapStream *stream = NULL;
+	char *nameCopy = NULL;
+	void *ptr = NULL;
+	size_t size = 0;
+	int fd = -1;
+
+	TRY(al_malloc(&nameCopy, strlen(filename) + 1));
+	strcpy(nameCopy, filename);
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		al_log_error("error opening file %s: %s", filename, strerror(errno));
+		THROW(AL_ERROR_IO);
+	}
+
+	struct stat info;
+	if (fstat(fd, &info)) {
+		al_log_error("error reading file size %s: %s", filename, strerror(errno));
+		THROW(AL_ERROR_IO);
+	}
+
+	if ((uint64_t)info.st_size > SIZE_MAX) {
+		al_log_error("file too large to map %s", filename);
+		THROW(AL_ERROR_IO);
+	}
+
+	size = info.st_size;
+
+	if (size > 0) {
+		ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (ptr == MAP_FAILED) {
+			ptr = NULL;
+			al_log_error("error mapping file %s: %s", filename, strerror(errno));
+			THROW(AL_ERROR_IO);
+		}
+	}
+
+	TRY(al_malloc(&stream, sizeof(MmapStream)));
+
+	stream->base = (AlMemStream){
+		.base = {
+			.name = nameCopy,
+			.read = mem_read,
+			.write = NULL,
+			.seek = mem_seek,
+			.tell = mem_tell,
+			.free = mmap_free,
+			.borrow = mem_borrow
 		},
 		.ptr = ptr,
 		.cur = ptr,
 		.end = ptr + size
 	};
+
+	stream->mapSize = size;
+
+	*result = &stream->base.base;
+
+	CATCH({
+		if (ptr) {
+			munmap(ptr, size);
+		}
+		al_free(nameCopy);
+	})
+	FINALLY({
+		if (fd >= 0) {
+			close(fd);
+		}
+	})
 }
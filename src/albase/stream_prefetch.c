@@ -0,0 +1,380 @@
+/*
+ * Copyright (c) 2014 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+#include "albase/stream.h"
+
+/*
+ * The reader thread fills a ring of blocks from the wrapped stream, and the
+ * stream's own reads take them in order. Blocks are counted rather than
+ * indexed, so the ring is full when end - start is the number of blocks.
+ * Everything below the lock is shared with the thread; the block the reader
+ * is filling is only touched by the thread until it's counted in end, and
+ * the block being read from only by the stream until start moves past it.
+ */
+
+typedef struct {
+	AlStream base;
+	AlStream *stream;
+	bool freeStream;
+
+	uint8_t *blocks;
+	size_t *lengths;
+	size_t blockSize;
+	size_t numBlocks;
+
+	/** Whether the block at start is being read from */
+	bool hasBlock;
+	size_t length;
+	size_t pos;
+	/** Offset of the block at start in the stream */
+	uint64_t offset;
+
+	SDL_Thread *thread;
+	SDL_mutex *lock;
+	SDL_cond *cond;
+
+	size_t start, end;
+	/** Number of bytes read from the wrapped stream */
+	uint64_t produced;
+	/** Set when the wrapped stream has ended or failed */
+	bool finished;
+	AlError error;
+	/** Set to stop the thread starting another read, for seeking */
+	bool paused;
+	bool reading;
+	bool quit;
+} PrefetchStream;
+
+static int prefetch_thread(void *data)
+{
+	PrefetchStream *stream = data;
+
+	SDL_LockMutex(stream->lock);
+
+	while (!stream->quit) {
+		if (stream->paused || stream->finished || stream->end - stream->start == stream->numBlocks) {
+			SDL_CondWait(stream->cond, stream->lock);
+			continue;
+		}
+
+		size_t index = stream->end % stream->numBlocks;
+		stream->reading = true;
+		SDL_UnlockMutex(stream->lock);
+
+		size_t n = 0;
+		AlError error = stream->stream->read(stream->stream, stream->blocks + index * stream->blockSize,
+			stream->blockSize, &n);
+
+		SDL_LockMutex(stream->lock);
+		stream->reading = false;
+
+		if (error) {
+			stream->error = error;
+			stream->finished = true;
+
+		} else if (n == 0) {
+			stream->finished = true;
+
+		} else {
+			stream->lengths[index] = n;
+			stream->produced += n;
+			stream->end++;
+		}
+
+		SDL_CondBroadcast(stream->cond);
+	}
+
+	SDL_UnlockMutex(stream->lock);
+
+	return 0;
+}
+
+/**
+ * Give the block being read from back to the thread, and wait for the next.
+ * @param[out] available Set to false at the end of the stream
+ */
+static AlError next_block(PrefetchStream *stream, bool *available)
+{
+	BEGIN()
+
+	SDL_LockMutex(stream->lock);
+
+	if (stream->hasBlock) {
+		stream->offset += stream->length;
+		stream->start++;
+		stream->hasBlock = false;
+		stream->length = 0;
+		stream->pos = 0;
+		SDL_CondBroadcast(stream->cond);
+	}
+
+	while (stream->start == stream->end && !stream->finished) {
+		SDL_CondWait(stream->cond, stream->lock);
+	}
+
+	AlError readError = AL_NO_ERROR;
+
+	if (stream->start != stream->end) {
+		stream->hasBlock = true;
+		stream->length = stream->lengths[stream->start % stream->numBlocks];
+
+	} else {
+		readError = stream->error;
+	}
+
+	SDL_UnlockMutex(stream->lock);
+
+	if (readError) {
+		al_log_error("error reading ahead in stream %s", stream->base.name);
+		THROW(readError);
+	}
+
+	*available = stream->hasBlock;
+
+	PASS()
+}
+
+static AlError prefetch_read(AlStream *base, void *ptr, size_t size, size_t *bytesRead)
+{
+	BEGIN()
+
+	PrefetchStream *stream = (PrefetchStream *)base;
+	size_t total = 0;
+
+	while (total < size) {
+		if (stream->pos == stream->length) {
+			bool available;
+			TRY(next_block(stream, &available));
+
+			if (!available) {
+				break;
+			}
+		}
+
+		const uint8_t *block = stream->blocks + (stream->start % stream->numBlocks) * stream->blockSize;
+		size_t copy = stream->length - stream->pos;
+		if (copy > size - total) {
+			copy = size - total;
+		}
+
+		memcpy(ptr + total, block + stream->pos, copy);
+		stream->pos += copy;
+		total += copy;
+	}
+
+	if (bytesRead) {
+		*bytesRead = total;
+
+	} else if (total < size) {
+		al_log_error("unexpected end of stream");
+		THROW(AL_ERROR_IO);
+	}
+
+	PASS()
+}
+
+static AlError prefetch_tell(AlStream *base, int64_t *offset)
+{
+	PrefetchStream *stream = (PrefetchStream *)base;
+
+	*offset = stream->offset + stream->pos;
+
+	return AL_NO_ERROR;
+}
+
+/**
+ * Stop the thread between reads, so the wrapped stream can be used here.
+ */
+static void pause_thread(PrefetchStream *stream)
+{
+	SDL_LockMutex(stream->lock);
+	stream->paused = true;
+
+	while (stream->reading) {
+		SDL_CondWait(stream->cond, stream->lock);
+	}
+
+	SDL_UnlockMutex(stream->lock);
+}
+
+static void resume_thread(PrefetchStream *stream)
+{
+	SDL_LockMutex(stream->lock);
+	stream->paused = false;
+	SDL_CondBroadcast(stream->cond);
+	SDL_UnlockMutex(stream->lock);
+}
+
+static AlError prefetch_seek(AlStream *base, int64_t offset, AlSeekPos whence)
+{
+	BEGIN()
+
+	PrefetchStream *stream = (PrefetchStream *)base;
+	uint64_t target = 0;
+
+	if (whence != AL_SEEK_END) {
+		int64_t from = (whence == AL_SEEK_CUR) ? (int64_t)(stream->offset + stream->pos) : 0;
+
+		if (offset < -from) {
+			al_log_error("cannot seek before start of stream");
+			THROW(AL_ERROR_IO);
+		}
+
+		target = from + offset;
+
+		// Seeks that stay in the block being read, like AlData giving back
+		// what it didn't use, don't need the thread to start again
+		if (stream->hasBlock && target >= stream->offset && target <= stream->offset + stream->length) {
+			stream->pos = target - stream->offset;
+			RETURN();
+		}
+	}
+
+	pause_thread(stream);
+
+	// The thread is between reads, so produced can't change under us
+	if (whence == AL_SEEK_END) {
+		int64_t before, after;
+		TRY(stream->stream->tell(stream->stream, &before));
+		TRY(stream->stream->seek(stream->stream, offset, AL_SEEK_END));
+		TRY(stream->stream->tell(stream->stream, &after));
+		target = stream->produced + (after - before);
+
+	} else {
+		TRY(stream->stream->seek(stream->stream, (int64_t)(target - stream->produced), AL_SEEK_CUR));
+	}
+
+	SDL_LockMutex(stream->lock);
+	stream->start = stream->end = 0;
+	stream->produced = target;
+	stream->finished = false;
+	stream->error = AL_NO_ERROR;
+	SDL_UnlockMutex(stream->lock);
+
+	stream->hasBlock = false;
+	stream->length = 0;
+	stream->pos = 0;
+	stream->offset = target;
+
+	PASS({
+		if (stream->paused) {
+			resume_thread(stream);
+		}
+	})
+}
+
+static void prefetch_free(AlStream *base)
+{
+	PrefetchStream *stream = (PrefetchStream *)base;
+
+	if (stream) {
+		if (stream->thread) {
+			SDL_LockMutex(stream->lock);
+			stream->quit = true;
+			SDL_CondBroadcast(stream->cond);
+			SDL_UnlockMutex(stream->lock);
+
+			SDL_WaitThread(stream->thread, NULL);
+
+			// Leave the wrapped stream where reading actually got to
+			uint64_t unread = stream->produced - (stream->offset + stream->pos);
+			if (unread > 0 && stream->stream->seek) {
+				stream->stream->seek(stream->stream, -(int64_t)unread, AL_SEEK_CUR);
+			}
+		}
+
+		if (stream->freeStream) {
+			al_stream_free(stream->stream);
+		}
+
+		SDL_DestroyCond(stream->cond);
+		SDL_DestroyMutex(stream->lock);
+		al_free(stream->blocks);
+		al_free(stream->lengths);
+		al_free(stream);
+	}
+}
+
+AlError al_stream_init_prefetch(AlStream **result, AlStream *wrapped, size_t blockSize, size_t numBlocks, bool freeStream)
+{
+	BEGIN()
+
+	PrefetchStream *stream = NULL;
+
+	if (!blockSize) {
+		blockSize = AL_STREAM_PREFETCH_BLOCK_SIZE;
+	}
+
+	if (numBlocks < 2) {
+		numBlocks = AL_STREAM_PREFETCH_BLOCKS;
+	}
+
+	if (blockSize > SIZE_MAX / numBlocks) {
+		al_log_error("prefetch buffer too large");
+		THROW(AL_ERROR_INVALID_OPERATION);
+	}
+
+	TRY(al_malloc(&stream, sizeof(PrefetchStream)));
+
+	stream->base = (AlStream){
+		.name = wrapped->name,
+		.read = prefetch_read,
+		.write = NULL,
+		.seek = wrapped->seek ? prefetch_seek : NULL,
+		.tell = prefetch_tell,
+		.free = prefetch_free,
+		.borrow = NULL
+	};
+	stream->stream = wrapped;
+	stream->freeStream = false;
+	stream->blocks = NULL;
+	stream->lengths = NULL;
+	stream->blockSize = blockSize;
+	stream->numBlocks = numBlocks;
+	stream->hasBlock = false;
+	stream->length = 0;
+	stream->pos = 0;
+	stream->offset = 0;
+	stream->thread = NULL;
+	stream->lock = NULL;
+	stream->cond = NULL;
+	stream->start = 0;
+	stream->end = 0;
+	stream->produced = 0;
+	stream->finished = false;
+	stream->error = AL_NO_ERROR;
+	stream->paused = false;
+	stream->reading = false;
+	stream->quit = false;
+
+	TRY(al_malloc(&stream->blocks, blockSize * numBlocks));
+	TRY(al_malloc(&stream->lengths, sizeof(size_t) * numBlocks));
+
+	stream->lock = SDL_CreateMutex();
+	stream->cond = SDL_CreateCond();
+	if (!stream->lock || !stream->cond) {
+		al_log_error("failed to create prefetch lock");
+		THROW(AL_ERROR_GENERIC);
+	}
+
+	stream->thread = SDL_CreateThread(prefetch_thread, "stream prefetch", stream);
+	if (!stream->thread) {
+		al_log_error("failed to create prefetch thread");
+		THROW(AL_ERROR_GENERIC);
+	}
+
+	stream->freeStream = freeStream;
+	*result = &stream->base;
+
+	CATCH({
+		prefetch_free(&stream->base);
+	})
+	FINALLY()
+}
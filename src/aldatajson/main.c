@@ -0,0 +1,1491 @@
+/*
+ * Copyright (c) 2014 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <inttypes.h>
+
+#include "albase/data.h"
+
+/** Bytes of output collected before being written */
+#define OUTPUT_BUFFER_SIZE 65536
+
+/** Bytes of input read at a time */
+#define INPUT_BUFFER_SIZE 65536
+
+/** Longest text of a single number, in either direction */
+#define MAX_NUMBER_LENGTH 32
+
+/** Items of an array collected before they're written, when reading JSON */
+#define ARRAY_CHUNK_LENGTH 256
+
+/** Most groups that can be open at once, the same as AlData allows */
+#define MAX_DEPTH AL_DATA_DEFAULT_MAX_DEPTH
+
+static const char *typeNames[] = {"bool", "int", "double", "vec2", "vec3", "vec4", "box2", "string", "blob"};
+
+static const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static size_t get_item_size(AlVarType type)
+{
+	switch (type) {
+		case AL_VAR_BOOL: return sizeof(bool);
+		case AL_VAR_INT: return sizeof(int32_t);
+		case AL_VAR_DOUBLE: return sizeof(double);
+		case AL_VAR_VEC2: return sizeof(double) * 2;
+		case AL_VAR_VEC3: return sizeof(double) * 3;
+		case AL_VAR_VEC4: return sizeof(double) * 4;
+		case AL_VAR_BOX2: return sizeof(double) * 4;
+		case AL_VAR_STRING: return sizeof(char *);
+		case AL_VAR_BLOB: return sizeof(AlBlob);
+		default: return 0;
+	}
+}
+
+/** Number of doubles in one value of a vector type */
+static int get_num_components(AlVarType type)
+{
+	return (type >= AL_VAR_DOUBLE && type <= AL_VAR_BOX2) ? get_item_size(type) / sizeof(double) : 0;
+}
+
+typedef struct {
+	uint8_t *bytes;
+	size_t length;
+	size_t capacity;
+} Buffer;
+
+static AlError buffer_append(Buffer *buffer, const void *ptr, size_t size)
+{
+	BEGIN()
+
+	if (buffer->capacity - buffer->length < size) {
+		size_t capacity = buffer->capacity ? buffer->capacity : 256;
+		while (capacity - buffer->length < size) {
+			capacity *= 2;
+		}
+
+		TRY(al_realloc(&buffer->bytes, capacity));
+		buffer->capacity = capacity;
+	}
+
+	if (size > 0) {
+		memcpy(buffer->bytes + buffer->length, ptr, size);
+		buffer->length += size;
+	}
+
+	PASS()
+}
+
+/*
+ * Output
+ */
+
+typedef struct {
+	FILE *file;
+	size_t length;
+	char buffer[OUTPUT_BUFFER_SIZE];
+} Output;
+
+static AlError output_flush(Output *output)
+{
+	BEGIN()
+
+	if (output->length > 0 && fwrite(output->buffer, 1, output->length, output->file) != output->length) {
+		al_log_error("error writing output");
+		THROW(AL_ERROR_IO);
+	}
+
+	output->length = 0;
+
+	PASS()
+}
+
+/**
+ * Make room for size bytes at the end of the buffer, which must be much
+ * smaller than the buffer.
+ */
+static inline AlError output_reserve(Output *output, size_t size)
+{
+	if (OUTPUT_BUFFER_SIZE - output->length < size) {
+		return output_flush(output);
+	}
+
+	return AL_NO_ERROR;
+}
+
+static AlError output_bytes(Output *output, const void *ptr, size_t size)
+{
+	BEGIN()
+
+	const char *bytes = ptr;
+
+	while (size > 0) {
+		if (output->length == OUTPUT_BUFFER_SIZE) {
+			TRY(output_flush(output));
+		}
+
+		size_t n = OUTPUT_BUFFER_SIZE - output->length;
+		if (n > size) {
+			n = size;
+		}
+
+		memcpy(output->buffer + output->length, bytes, n);
+		output->length += n;
+		bytes += n;
+		size -= n;
+	}
+
+	PASS()
+}
+
+static AlError output_text(Output *output, const char *text)
+{
+	return output_bytes(output, text, strlen(text));
+}
+
+static AlError output_newline(Output *output, int depth)
+{
+	BEGIN()
+
+	size_t size = 1 + depth * 2;
+	TRY(output_reserve(output, size));
+
+	output->buffer[output->length] = '\n';
+	memset(output->buffer + output->length + 1, ' ', size - 1);
+	output->length += size;
+
+	PASS()
+}
+
+static size_t format_int(char *text, int64_t value)
+{
+	char digits[24];
+	size_t numDigits = 0, length = 0;
+	uint64_t magnitude = (value < 0) ? -(uint64_t)value : (uint64_t)value;
+
+	do {
+		digits[numDigits++] = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude);
+
+	if (value < 0) {
+		text[length++] = '-';
+	}
+
+	while (numDigits > 0) {
+		text[length++] = digits[--numDigits];
+	}
+
+	return length;
+}
+
+/**
+ * Format a finite double with the fewest digits that read back as the same
+ * value. There's always a decimal point or exponent, so it reads back as a
+ * double rather than an int.
+ */
+static size_t format_double(char *text, double value)
+{
+	size_t length = 0;
+
+	// Whole numbers are common, and much quicker to format directly
+	if (fabs(value) < 1e15 && value == (double)(int64_t)value) {
+		if (value == 0 && signbit(value)) {
+			text[length++] = '-';
+		}
+
+		length += format_int(text + length, (int64_t)value);
+		memcpy(text + length, ".0", 2);
+		return length + 2;
+	}
+
+	// With at most 15 digits, %g rounds a normal double to the shortest
+	// text that reads back as it, if there is one that short. Subnormals have
+	// fewer digits of precision, so shorter texts must be tried.
+	int precision = (fabs(value) < DBL_MIN) ? 1 : 15;
+
+	for (; precision <= 17; precision++) {
+		length = snprintf(text, MAX_NUMBER_LENGTH, "%.*g", precision, value);
+		if (strtod(text, NULL) == value) {
+			break;
+		}
+	}
+
+	if (!memchr(text, '.', length) && !memchr(text, 'e', length)) {
+		memcpy(text + length, ".0", 2);
+		length += 2;
+	}
+
+	return length;
+}
+
+static const char *get_non_finite_name(double value)
+{
+	return isnan(value) ? "nan" : (value > 0) ? "inf" : "-inf";
+}
+
+static AlError output_int(Output *output, int64_t value)
+{
+	BEGIN()
+
+	TRY(output_reserve(output, MAX_NUMBER_LENGTH));
+	output->length += format_int(output->buffer + output->length, value);
+
+	PASS()
+}
+
+/**
+ * Write a double as a number, or as a string naming it if it's not finite.
+ */
+static AlError output_component(Output *output, double value)
+{
+	BEGIN()
+
+	TRY(output_reserve(output, MAX_NUMBER_LENGTH));
+
+	if (isfinite(value)) {
+		output->length += format_double(output->buffer + output->length, value);
+	} else {
+		output->length += sprintf(output->buffer + output->length, "\"%s\"", get_non_finite_name(value));
+	}
+
+	PASS()
+}
+
+/**
+ * Write a JSON string. Bytes from 0x80 up are written as they are, so UTF-8
+ * passes through, unless escapeHigh is set, which is used for tags.
+ */
+static AlError output_string(Output *output, const uint8_t *chars, size_t length, bool escapeHigh)
+{
+	BEGIN()
+
+	size_t start = 0;
+
+	TRY(output_bytes(output, "\"", 1));
+
+	for (size_t i = 0; i < length; i++) {
+		uint8_t c = chars[i];
+
+		if (c >= 0x20 && c != '"' && c != '\\' && (c < 0x80 || !escapeHigh)) {
+			continue;
+		}
+
+		TRY(output_bytes(output, chars + start, i - start));
+		start = i + 1;
+
+		TRY(output_reserve(output, 8));
+		switch (c) {
+			case '"': output->length += sprintf(output->buffer + output->length, "\\\""); break;
+			case '\\': output->length += sprintf(output->buffer + output->length, "\\\\"); break;
+			case '\n': output->length += sprintf(output->buffer + output->length, "\\n"); break;
+			case '\r': output->length += sprintf(output->buffer + output->length, "\\r"); break;
+			case '\t': output->length += sprintf(output->buffer + output->length, "\\t"); break;
+			default: output->length += sprintf(output->buffer + output->length, "\\u%04x", c); break;
+		}
+	}
+
+	TRY(output_bytes(output, chars + start, length - start));
+	TRY(output_bytes(output, "\"", 1));
+
+	PASS()
+}
+
+static AlError output_base64(Output *output, const uint8_t *bytes, size_t length)
+{
+	BEGIN()
+
+	TRY(output_bytes(output, "\"", 1));
+
+	for (size_t i = 0; i < length; i += 3) {
+		uint32_t group = bytes[i] << 16;
+		if (i + 1 < length) group |= bytes[i + 1] << 8;
+		if (i + 2 < length) group |= bytes[i + 2];
+
+		TRY(output_reserve(output, 4));
+		char *text = output->buffer + output->length;
+		text[0] = base64Chars[(group >> 18) & 0x3F];
+		text[1] = base64Chars[(group >> 12) & 0x3F];
+		text[2] = (i + 1 < length) ? base64Chars[(group >> 6) & 0x3F] : '=';
+		text[3] = (i + 2 < length) ? base64Chars[group & 0x3F] : '=';
+		output->length += 4;
+	}
+
+	TRY(output_bytes(output, "\"", 1));
+
+	PASS()
+}
+
+/**
+ * Write a value. Inside arrays, values are written without the object that
+ * otherwise says what type they are.
+ */
+static AlError output_value(Output *output, AlVarType type, const void *value, bool inArray)
+{
+	BEGIN()
+
+	switch (type) {
+		case AL_VAR_BOOL:
+			TRY(output_text(output, *(const bool *)value ? "true" : "false"));
+			break;
+
+		case AL_VAR_INT:
+			TRY(output_int(output, *(const int32_t *)value));
+			break;
+
+		case AL_VAR_DOUBLE: {
+			double d = *(const double *)value;
+			if (isfinite(d) || inArray) {
+				TRY(output_component(output, d));
+			} else {
+				TRY(output_text(output, "{\"double\": "));
+				TRY(output_component(output, d));
+				TRY(output_text(output, "}"));
+			}
+			break;
+		}
+
+		case AL_VAR_VEC2:
+		case AL_VAR_VEC3:
+		case AL_VAR_VEC4:
+		case AL_VAR_BOX2: {
+			const double *components = value;
+
+			if (!inArray) {
+				TRY(output_text(output, "{\""));
+				TRY(output_text(output, typeNames[type]));
+				TRY(output_text(output, "\": "));
+			}
+
+			TRY(output_bytes(output, "[", 1));
+			for (int i = 0; i < get_num_components(type); i++) {
+				if (i > 0) {
+					TRY(output_bytes(output, ", ", 2));
+				}
+				TRY(output_component(output, components[i]));
+			}
+			TRY(output_bytes(output, "]", 1));
+
+			if (!inArray) {
+				TRY(output_bytes(output, "}", 1));
+			}
+			break;
+		}
+
+		case AL_VAR_STRING: {
+			const char *chars = *(const char *const *)value;
+			TRY(output_string(output, (const uint8_t *)chars, strlen(chars), false));
+			break;
+		}
+
+		case AL_VAR_BLOB: {
+			const AlBlob *blob = value;
+
+			if (!inArray) {
+				TRY(output_text(output, "{\"blob\": "));
+			}
+
+			TRY(output_base64(output, blob->bytes, blob->length));
+
+			if (!inArray) {
+				TRY(output_bytes(output, "}", 1));
+			}
+			break;
+		}
+
+		default:
+			al_log_error("unknown value type: 0x%02x", type);
+			THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	PASS()
+}
+
+/*
+ * Alice data to JSON
+ *
+ * The document is a JSON array of its items. Groups are arrays of their
+ * items, or {"tag": "TAGS", "group": [...]} if they start with a tag. Bools,
+ * ints and strings are plain JSON values, and doubles are numbers that
+ * always have a decimal point or exponent. Other values are objects naming
+ * their type, such as {"vec2": [1.0, 2.0]}, and arrays are
+ * {"array": "vec2", "count": 1, "items": [[1.0, 2.0]]}.
+ */
+
+typedef struct {
+	Output *output;
+	/** Number of groups open, plus one for the array around the document */
+	int depth;
+	/** Whether nothing has been written in the innermost group yet */
+	bool first;
+	/** A group has started, but isn't written until it's known if it has a tag */
+	bool groupPending;
+	/** Whether each open group was written with a tag */
+	bool tagged[MAX_DEPTH + 2];
+	uint64_t arrayRemaining;
+	bool arrayFirst;
+} Transcoder;
+
+static AlError write_pending_group(Transcoder *transcoder)
+{
+	BEGIN()
+
+	if (transcoder->groupPending) {
+		transcoder->groupPending = false;
+		TRY(output_bytes(transcoder->output, "[", 1));
+	}
+
+	PASS()
+}
+
+static AlError start_item(Transcoder *transcoder)
+{
+	BEGIN()
+
+	TRY(write_pending_group(transcoder));
+
+	if (!transcoder->first) {
+		TRY(output_bytes(transcoder->output, ",", 1));
+	}
+
+	TRY(output_newline(transcoder->output, transcoder->depth));
+	transcoder->first = false;
+
+	PASS()
+}
+
+static AlError transcode_start(void *context, uint64_t groupSize)
+{
+	BEGIN()
+
+	Transcoder *transcoder = context;
+
+	TRY(start_item(transcoder));
+
+	if (transcoder->depth > MAX_DEPTH) {
+		al_log_error("groups nested too deeply");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	transcoder->depth++;
+	transcoder->tagged[transcoder->depth] = false;
+	transcoder->groupPending = true;
+	transcoder->first = true;
+
+	PASS()
+}
+
+static AlError transcode_end(void *context)
+{
+	BEGIN()
+
+	Transcoder *transcoder = context;
+
+	TRY(write_pending_group(transcoder));
+
+	if (!transcoder->first) {
+		TRY(output_newline(transcoder->output, transcoder->depth - 1));
+	}
+
+	TRY(output_text(transcoder->output, transcoder->tagged[transcoder->depth] ? "]}" : "]"));
+
+	transcoder->depth--;
+	transcoder->first = false;
+
+	PASS()
+}
+
+static AlError transcode_tag(void *context, AlDataTag tag)
+{
+	BEGIN()
+
+	Transcoder *transcoder = context;
+	uint8_t chars[4] = {tag, tag >> 8, tag >> 16, tag >> 24};
+
+	// AlData only ever writes tags at the start of groups
+	if (!transcoder->groupPending) {
+		al_log_error("tag not at the start of a group");
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	transcoder->groupPending = false;
+	transcoder->tagged[transcoder->depth] = true;
+
+	TRY(output_text(transcoder->output, "{\"tag\": "));
+	TRY(output_string(transcoder->output, chars, 4, true));
+	TRY(output_text(transcoder->output, ", \"group\": ["));
+
+	PASS()
+}
+
+static AlError transcode_value(void *context, AlVarType type, const void *value)
+{
+	BEGIN()
+
+	Transcoder *transcoder = context;
+
+	TRY(start_item(transcoder));
+	TRY(output_value(transcoder->output, type, value, false));
+
+	PASS()
+}
+
+static AlError transcode_array_start(void *context, AlVarType type, uint64_t count)
+{
+	BEGIN()
+
+	Transcoder *transcoder = context;
+	Output *output = transcoder->output;
+
+	TRY(start_item(transcoder));
+	TRY(output_text(output, "{\"array\": \""));
+	TRY(output_text(output, typeNames[type]));
+	TRY(output_text(output, "\", \"count\": "));
+	TRY(output_int(output, count));
+	TRY(output_text(output, ", \"items\": ["));
+
+	if (count == 0) {
+		TRY(output_text(output, "]}"));
+	}
+
+	transcoder->arrayRemaining = count;
+	transcoder->arrayFirst = true;
+
+	PASS()
+}
+
+static AlError transcode_array_chunk(void *context, AlVarType type, const void *items, uint64_t count)
+{
+	BEGIN()
+
+	Transcoder *transcoder = context;
+	Output *output = transcoder->output;
+	const uint8_t *item = items;
+	size_t itemSize = get_item_size(type);
+
+	for (uint64_t i = 0; i < count; i++, item += itemSize) {
+		if (!transcoder->arrayFirst) {
+			TRY(output_bytes(output, ",", 1));
+		}
+		transcoder->arrayFirst = false;
+
+		TRY(output_newline(output, transcoder->depth + 1));
+		TRY(output_value(output, type, item, true));
+	}
+
+	transcoder->arrayRemaining -= count;
+
+	if (transcoder->arrayRemaining == 0) {
+		TRY(output_newline(output, transcoder->depth));
+		TRY(output_text(output, "]}"));
+	}
+
+	PASS()
+}
+
+static AlError data_to_json(AlData *data, Output *output)
+{
+	BEGIN()
+
+	Transcoder transcoder = {
+		.output = output,
+		.depth = 1,
+		.first = true,
+		.groupPending = false
+	};
+
+	AlDataHandler handler = {
+		.startGroup = transcode_start,
+		.endGroup = transcode_end,
+		.tag = transcode_tag,
+		.value = transcode_value,
+		.arrayStart = transcode_array_start,
+		.arrayChunk = transcode_array_chunk
+	};
+
+	TRY(output_bytes(output, "[", 1));
+	TRY(al_data_parse(data, &handler, &transcoder));
+
+	if (!transcoder.first) {
+		TRY(output_newline(output, 0));
+	}
+
+	TRY(output_text(output, "]\n"));
+	TRY(output_flush(output));
+
+	PASS()
+}
+
+/*
+ * JSON to alice data
+ */
+
+typedef struct {
+	FILE *file;
+	const char *cur;
+	const char *end;
+	int line;
+	/** The last string read, with a NUL after it */
+	Buffer string;
+	char buffer[INPUT_BUFFER_SIZE];
+} Input;
+
+/** Get the next character without reading it, or -1 at the end */
+static int input_peek(Input *input)
+{
+	if (input->cur == input->end) {
+		size_t n = fread(input->buffer, 1, INPUT_BUFFER_SIZE, input->file);
+		input->cur = input->buffer;
+		input->end = input->buffer + n;
+
+		if (n == 0) {
+			return -1;
+		}
+	}
+
+	return (uint8_t)*input->cur;
+}
+
+static int input_next(Input *input)
+{
+	int c = input_peek(input);
+
+	if (c >= 0) {
+		input->cur++;
+		if (c == '\n') {
+			input->line++;
+		}
+	}
+
+	return c;
+}
+
+static int skip_space(Input *input)
+{
+	int c = input_peek(input);
+
+	while (c == ' ' || c == '\n' || c == '\t' || c == '\r') {
+		input_next(input);
+		c = input_peek(input);
+	}
+
+	return c;
+}
+
+static bool accept(Input *input, char expected)
+{
+	if (skip_space(input) == expected) {
+		input_next(input);
+		return true;
+	}
+
+	return false;
+}
+
+static AlError expect(Input *input, char expected)
+{
+	BEGIN()
+
+	if (!accept(input, expected)) {
+		al_log_error("line %d: expected '%c'", input->line, expected);
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	PASS()
+}
+
+static AlError read_hex(Input *input, uint32_t *result)
+{
+	BEGIN()
+
+	*result = 0;
+
+	for (int i = 0; i < 4; i++) {
+		int c = input_next(input);
+		int digit = (c >= '0' && c <= '9') ? c - '0' :
+			(c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+			(c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+
+		if (digit < 0) {
+			al_log_error("line %d: invalid escape", input->line);
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+		*result = (*result << 4) | digit;
+	}
+
+	PASS()
+}
+
+static AlError append_utf8(Buffer *buffer, uint32_t code)
+{
+	uint8_t bytes[4];
+	size_t length;
+
+	if (code < 0x80) {
+		bytes[0] = code;
+		length = 1;
+	} else if (code < 0x800) {
+		bytes[0] = 0xC0 | (code >> 6);
+		bytes[1] = 0x80 | (code & 0x3F);
+		length = 2;
+	} else if (code < 0x10000) {
+		bytes[0] = 0xE0 | (code >> 12);
+		bytes[1] = 0x80 | ((code >> 6) & 0x3F);
+		bytes[2] = 0x80 | (code & 0x3F);
+		length = 3;
+	} else {
+		bytes[0] = 0xF0 | (code >> 18);
+		bytes[1] = 0x80 | ((code >> 12) & 0x3F);
+		bytes[2] = 0x80 | ((code >> 6) & 0x3F);
+		bytes[3] = 0x80 | (code & 0x3F);
+		length = 4;
+	}
+
+	return buffer_append(buffer, bytes, length);
+}
+
+/**
+ * Read a string into input->string. If bytes is set, escapes below 0x100
+ * are single bytes rather than UTF-8, as written for tags.
+ */
+static AlError read_string(Input *input, bool bytes)
+{
+	BEGIN()
+
+	Buffer *string = &input->string;
+	string->length = 0;
+
+	TRY(expect(input, '"'));
+
+	while (true) {
+		// Copy runs of plain characters straight from the input buffer
+		const char *run = input->cur;
+		while (run != input->end && *run != '"' && *run != '\\' && *run != '\n') {
+			run++;
+		}
+		TRY(buffer_append(string, input->cur, run - input->cur));
+		input->cur = run;
+
+		int c = input_next(input);
+
+		if (c < 0 || c == '\n') {
+			al_log_error("line %d: unterminated string", input->line);
+			THROW(AL_ERROR_INVALID_DATA);
+
+		} else if (c == '"') {
+			break;
+
+		} else if (c == '\\') {
+			uint8_t escaped;
+
+			switch (input_next(input)) {
+				case '"': escaped = '"'; break;
+				case '\\': escaped = '\\'; break;
+				case '/': escaped = '/'; break;
+				case 'b': escaped = '\b'; break;
+				case 'f': escaped = '\f'; break;
+				case 'n': escaped = '\n'; break;
+				case 'r': escaped = '\r'; break;
+				case 't': escaped = '\t'; break;
+
+				case 'u': {
+					uint32_t code;
+					TRY(read_hex(input, &code));
+
+					if (bytes && code < 0x100) {
+						escaped = code;
+						break;
+					}
+
+					if (code >= 0xD800 && code < 0xDC00) {
+						uint32_t low;
+						if (input_next(input) != '\\' || input_next(input) != 'u') {
+							al_log_error("line %d: unpaired surrogate", input->line);
+							THROW(AL_ERROR_INVALID_DATA);
+						}
+						TRY(read_hex(input, &low));
+						code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+					}
+
+					TRY(append_utf8(string, code));
+					continue;
+				}
+
+				default:
+					al_log_error("line %d: invalid escape", input->line);
+					THROW(AL_ERROR_INVALID_DATA);
+			}
+
+			TRY(buffer_append(string, &escaped, 1));
+
+		} else {
+			uint8_t byte = c;
+			TRY(buffer_append(string, &byte, 1));
+		}
+	}
+
+	TRY(buffer_append(string, "", 1));
+	string->length--;
+
+	PASS()
+}
+
+static bool is_string(Input *input, const char *expected)
+{
+	return input->string.length == strlen(expected) && !memcmp(input->string.bytes, expected, input->string.length);
+}
+
+static AlError read_key(Input *input, const char *expected)
+{
+	BEGIN()
+
+	TRY(read_string(input, false));
+
+	if (expected && !is_string(input, expected)) {
+		al_log_error("line %d: expected key \"%s\"", input->line, expected);
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	TRY(expect(input, ':'));
+
+	PASS()
+}
+
+/**
+ * Read the text of a number.
+ * @param[out] isDouble Set if the number has a decimal point or exponent
+ */
+static AlError read_number(Input *input, char *text, bool *isDouble)
+{
+	BEGIN()
+
+	size_t length = 0;
+	int c = skip_space(input);
+
+	*isDouble = false;
+
+	while ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E') {
+		if (length == MAX_NUMBER_LENGTH - 1) {
+			al_log_error("line %d: number too long", input->line);
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+		if (c == '.' || c == 'e' || c == 'E') {
+			*isDouble = true;
+		}
+
+		text[length++] = c;
+		input_next(input);
+		c = input_peek(input);
+	}
+
+	text[length] = '\0';
+
+	if (length == 0) {
+		al_log_error("line %d: expected a value", input->line);
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	PASS()
+}
+
+static AlError read_int(Input *input, int64_t min, int64_t max, int64_t *result)
+{
+	BEGIN()
+
+	char text[MAX_NUMBER_LENGTH];
+	bool isDouble;
+	char *end;
+
+	TRY(read_number(input, text, &isDouble));
+
+	long long value = strtoll(text, &end, 10);
+	if (isDouble || *end || value < min || value > max) {
+		al_log_error("line %d: invalid int: %s", input->line, text);
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	*result = value;
+
+	PASS()
+}
+
+static AlError read_bool(Input *input, bool *result)
+{
+	BEGIN()
+
+	char text[6] = "";
+	int c = skip_space(input);
+
+	for (size_t i = 0; i < 5 && c >= 'a' && c <= 'z'; i++) {
+		text[i] = input_next(input);
+		c = input_peek(input);
+	}
+
+	if (!strcmp(text, "true")) {
+		*result = true;
+	} else if (!strcmp(text, "false")) {
+		*result = false;
+	} else {
+		al_log_error("line %d: expected a value", input->line);
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	PASS()
+}
+
+/**
+ * Read a double, which may be written as an int, or as a string naming a
+ * value that's not finite.
+ */
+static AlError read_component(Input *input, double *result)
+{
+	BEGIN()
+
+	if (skip_space(input) == '"') {
+		TRY(read_string(input, false));
+
+		if (is_string(input, "nan")) {
+			*result = NAN;
+		} else if (is_string(input, "inf")) {
+			*result = INFINITY;
+		} else if (is_string(input, "-inf")) {
+			*result = -INFINITY;
+		} else {
+			al_log_error("line %d: invalid double", input->line);
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+	} else {
+		char text[MAX_NUMBER_LENGTH];
+		bool isDouble;
+		char *end;
+
+		TRY(read_number(input, text, &isDouble));
+
+		*result = strtod(text, &end);
+		if (*end) {
+			al_log_error("line %d: invalid double: %s", input->line, text);
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+	}
+
+	PASS()
+}
+
+static AlError read_components(Input *input, AlVarType type, double *result)
+{
+	BEGIN()
+
+	TRY(expect(input, '['));
+
+	for (int i = 0; i < get_num_components(type); i++) {
+		if (i > 0) {
+			TRY(expect(input, ','));
+		}
+		TRY(read_component(input, &result[i]));
+	}
+
+	TRY(expect(input, ']'));
+
+	PASS()
+}
+
+static int get_base64_value(uint8_t c)
+{
+	const char *found = (c != '\0') ? strchr(base64Chars, c) : NULL;
+	return found ? found - base64Chars : -1;
+}
+
+/**
+ * Read a base64 string, decoding it into bytes.
+ */
+static AlError read_base64(Input *input, Buffer *bytes)
+{
+	BEGIN()
+
+	TRY(read_string(input, false));
+
+	const uint8_t *text = input->string.bytes;
+	size_t length = input->string.length;
+
+	while (length > 0 && text[length - 1] == '=') {
+		length--;
+	}
+
+	for (size_t i = 0; i < length; i += 4) {
+		uint8_t decoded[3];
+		uint32_t group = 0;
+		size_t n = (length - i < 4) ? length - i : 4;
+
+		if (n == 1) {
+			al_log_error("line %d: invalid base64", input->line);
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+		for (size_t j = 0; j < 4; j++) {
+			int value = (j < n) ? get_base64_value(text[i + j]) : 0;
+			if (value < 0) {
+				al_log_error("line %d: invalid base64", input->line);
+				THROW(AL_ERROR_INVALID_DATA);
+			}
+			group = (group << 6) | value;
+		}
+
+		decoded[0] = group >> 16;
+		decoded[1] = group >> 8;
+		decoded[2] = group;
+		TRY(buffer_append(bytes, decoded, n - 1));
+	}
+
+	PASS()
+}
+
+/**
+ * Read an item of an array into item, which has space for one item of
+ * type. Strings and blobs are added to bytes instead.
+ */
+static AlError read_array_item(Input *input, AlVarType type, void *item, Buffer *bytes)
+{
+	BEGIN()
+
+	switch (type) {
+		case AL_VAR_BOOL:
+			TRY(read_bool(input, item));
+			break;
+
+		case AL_VAR_INT: {
+			int64_t value;
+			TRY(read_int(input, INT32_MIN, INT32_MAX, &value));
+			*(int32_t *)item = value;
+			break;
+		}
+
+		case AL_VAR_DOUBLE:
+			TRY(read_component(input, item));
+			break;
+
+		case AL_VAR_VEC2:
+		case AL_VAR_VEC3:
+		case AL_VAR_VEC4:
+		case AL_VAR_BOX2:
+			TRY(read_components(input, type, item));
+			break;
+
+		case AL_VAR_STRING:
+			TRY(read_string(input, false));
+			TRY(buffer_append(bytes, input->string.bytes, input->string.length + 1));
+			break;
+
+		case AL_VAR_BLOB:
+			TRY(read_base64(input, bytes));
+			break;
+
+		default:
+			al_log_error("unknown value type: 0x%02x", type);
+			THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	PASS()
+}
+
+/**
+ * Write an array of strings or blobs, which can only be written whole.
+ */
+static AlError write_packed_array(AlData *data, AlVarType type, const Buffer *bytes, const uint64_t *lengths, uint64_t count)
+{
+	BEGIN()
+
+	void *table = NULL;
+	const uint8_t *next = bytes->bytes;
+
+	TRY(al_malloc(&table, get_item_size(type) * count));
+
+	for (uint64_t i = 0; i < count; i++) {
+		if (type == AL_VAR_STRING) {
+			((const char **)table)[i] = (const char *)next;
+			next += lengths[i] + 1;
+		} else {
+			((AlBlob *)table)[i] = (AlBlob){(uint8_t *)next, lengths[i]};
+			next += lengths[i];
+		}
+	}
+
+	TRY(al_data_write_array(data, type, table, count));
+
+	PASS({
+		al_free(table);
+	})
+}
+
+/**
+ * Read the rest of an array object, after its "array" key. Items are
+ * written in chunks as they're read, except for strings and blobs.
+ */
+static AlError read_array(Input *input, AlData *data)
+{
+	BEGIN()
+
+	AlVarType type;
+	int64_t count;
+	double chunk[ARRAY_CHUNK_LENGTH * 4];
+	size_t chunkLength = 0;
+	Buffer bytes = {NULL, 0, 0};
+	Buffer lengths = {NULL, 0, 0};
+
+	TRY(read_string(input, false));
+
+	for (type = 0; type <= AL_VAR_BLOB; type++) {
+		if (is_string(input, typeNames[type])) {
+			break;
+		}
+	}
+
+	if (type > AL_VAR_BLOB) {
+		al_log_error("line %d: unknown array type: %s", input->line, input->string.bytes);
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	TRY(expect(input, ','));
+	TRY(read_key(input, "count"));
+	TRY(read_int(input, 0, INT64_MAX, &count));
+	TRY(expect(input, ','));
+	TRY(read_key(input, "items"));
+	TRY(expect(input, '['));
+
+	bool packed = (type == AL_VAR_STRING || type == AL_VAR_BLOB);
+	size_t itemSize = get_item_size(type);
+
+	if (!packed) {
+		TRY(al_data_write_array_start(data, type, AL_DATA_ENCODING_RAW, 0, count));
+	}
+
+	for (int64_t i = 0; i < count; i++) {
+		if (i > 0) {
+			TRY(expect(input, ','));
+		}
+
+		if (packed) {
+			size_t start = bytes.length;
+			TRY(read_array_item(input, type, NULL, &bytes));
+
+			uint64_t length = bytes.length - start - (type == AL_VAR_STRING ? 1 : 0);
+			TRY(buffer_append(&lengths, &length, sizeof(uint64_t)));
+
+		} else {
+			TRY(read_array_item(input, type, (uint8_t *)chunk + chunkLength * itemSize, NULL));
+
+			if (++chunkLength == ARRAY_CHUNK_LENGTH) {
+				TRY(al_data_write_array_items(data, chunk, itemSize, chunkLength));
+				chunkLength = 0;
+			}
+		}
+	}
+
+	if (skip_space(input) != ']') {
+		al_log_error("line %d: array doesn't have %" PRId64 " items", input->line, count);
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	TRY(expect(input, ']'));
+	TRY(expect(input, '}'));
+
+	if (packed) {
+		TRY(write_packed_array(data, type, &bytes, (const uint64_t *)lengths.bytes, count));
+	} else {
+		TRY(al_data_write_array_items(data, chunk, itemSize, chunkLength));
+	}
+
+	PASS({
+		al_free(bytes.bytes);
+		al_free(lengths.bytes);
+	})
+}
+
+/**
+ * Read an object, after its opening brace. Objects either start a tagged
+ * group, in which case started is set, or are a single value.
+ */
+static AlError read_object(Input *input, AlData *data, bool *started)
+{
+	BEGIN()
+
+	Buffer bytes = {NULL, 0, 0};
+
+	*started = false;
+
+	TRY(read_key(input, NULL));
+
+	if (is_string(input, "tag")) {
+		AlDataTag tag;
+
+		TRY(read_string(input, true));
+		if (input->string.length != 4) {
+			al_log_error("line %d: tags must be 4 bytes", input->line);
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+		memcpy(&tag, input->string.bytes, 4);
+		TRY(expect(input, ','));
+		TRY(read_key(input, "group"));
+		TRY(expect(input, '['));
+		TRY(al_data_write_start_tag(data, tag));
+		*started = true;
+		RETURN();
+	}
+
+	if (is_string(input, "array")) {
+		TRY(read_array(input, data));
+		RETURN();
+	}
+
+	if (is_string(input, "double")) {
+		double value;
+		TRY(read_component(input, &value));
+		TRY(al_data_write_value(data, AL_VAR_DOUBLE, &value));
+
+	} else if (is_string(input, "blob")) {
+		TRY(read_base64(input, &bytes));
+		TRY(al_data_write_value(data, AL_VAR_BLOB, &(AlBlob){bytes.bytes, bytes.length}));
+
+	} else {
+		AlVarType type;
+
+		for (type = AL_VAR_VEC2; type <= AL_VAR_BOX2; type++) {
+			if (is_string(input, typeNames[type])) {
+				break;
+			}
+		}
+
+		if (type > AL_VAR_BOX2) {
+			al_log_error("line %d: unknown value type: %s", input->line, input->string.bytes);
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+		double components[4];
+		TRY(read_components(input, type, components));
+		TRY(al_data_write_value(data, type, components));
+	}
+
+	TRY(expect(input, '}'));
+
+	PASS({
+		al_free(bytes.bytes);
+	})
+}
+
+static AlError read_plain_value(Input *input, AlData *data, int c)
+{
+	BEGIN()
+
+	if (c == '"') {
+		TRY(read_string(input, false));
+
+		if (input->string.length > UINT32_MAX) {
+			al_log_error("line %d: string too long", input->line);
+			THROW(AL_ERROR_INVALID_DATA);
+		}
+
+		TRY(al_data_write_string(data, (const char *)input->string.bytes, input->string.length));
+
+	} else if (c == 't' || c == 'f') {
+		bool value;
+		TRY(read_bool(input, &value));
+		TRY(al_data_write_value(data, AL_VAR_BOOL, &value));
+
+	} else {
+		char text[MAX_NUMBER_LENGTH];
+		bool isDouble;
+		char *end;
+
+		TRY(read_number(input, text, &isDouble));
+
+		if (isDouble) {
+			double value = strtod(text, &end);
+			if (*end) {
+				al_log_error("line %d: invalid double: %s", input->line, text);
+				THROW(AL_ERROR_INVALID_DATA);
+			}
+			TRY(al_data_write_value(data, AL_VAR_DOUBLE, &value));
+
+		} else {
+			long long value = strtoll(text, &end, 10);
+			if (*end || value < INT32_MIN || value > INT32_MAX) {
+				al_log_error("line %d: invalid int: %s", input->line, text);
+				THROW(AL_ERROR_INVALID_DATA);
+			}
+			TRY(al_data_write_value(data, AL_VAR_INT, &(int32_t){value}));
+		}
+	}
+
+	PASS()
+}
+
+static AlError close_group(Input *input, AlData *data, bool tagged)
+{
+	BEGIN()
+
+	TRY(al_data_write_end(data));
+
+	if (tagged) {
+		TRY(expect(input, '}'));
+	}
+
+	PASS()
+}
+
+/**
+ * Read a whole document. Open groups are tracked on a stack rather than by
+ * recursing, so nesting only costs a bool per group.
+ */
+static AlError json_to_data(Input *input, AlData *data)
+{
+	BEGIN()
+
+	bool tagged[MAX_DEPTH + 1];
+	int depth = 0;
+	bool done;
+
+	TRY(expect(input, '['));
+	done = accept(input, ']');
+
+	while (!done) {
+		int c = skip_space(input);
+		bool started = false;
+		bool isTagged = false;
+
+		if (c == '[') {
+			input_next(input);
+			TRY(al_data_write_start(data));
+			started = true;
+
+		} else if (c == '{') {
+			input_next(input);
+			TRY(read_object(input, data, &started));
+			isTagged = started;
+
+		} else {
+			TRY(read_plain_value(input, data, c));
+		}
+
+		if (started) {
+			if (depth == MAX_DEPTH) {
+				al_log_error("line %d: groups nested too deeply", input->line);
+				THROW(AL_ERROR_INVALID_DATA);
+			}
+
+			tagged[++depth] = isTagged;
+
+			if (!accept(input, ']')) {
+				continue;
+			}
+
+			TRY(close_group(input, data, tagged[depth--]));
+		}
+
+		// Close every group that ends after this item
+		while (!accept(input, ',')) {
+			TRY(expect(input, ']'));
+
+			if (depth == 0) {
+				done = true;
+				break;
+			}
+
+			TRY(close_group(input, data, tagged[depth--]));
+		}
+	}
+
+	if (skip_space(input) >= 0) {
+		al_log_error("line %d: unexpected text after document", input->line);
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	if (ferror(input->file)) {
+		al_log_error("error reading input");
+		THROW(AL_ERROR_IO);
+	}
+
+	TRY(al_data_flush(data));
+
+	PASS()
+}
+
+int main(int argc, char *argv[])
+{
+	BEGIN()
+
+	static Output output;
+	static Input input;
+	AlStream *file = NULL;
+	AlStream *compressed = NULL;
+	AlData *data = NULL;
+	bool reverse = false;
+	bool compress = false;
+	bool sized = false;
+	bool checksums = false;
+	bool deduplicate = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--reverse")) {
+			reverse = true;
+		} else if (!strcmp(argv[i], "-z") || !strcmp(argv[i], "--compressed")) {
+			compress = true;
+		} else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--sized")) {
+			sized = true;
+		} else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--checksums")) {
+			checksums = true;
+		} else if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--deduplicate")) {
+			deduplicate = true;
+		} else {
+			fprintf(stderr, "usage: %s [-z|--compressed] < data > json\n", argv[0]);
+			fprintf(stderr, "       %s -r|--reverse [-z|--compressed] [-s|--sized] [-c|--checksums] [-d|--deduplicate] < json > data\n", argv[0]);
+			THROW(AL_ERROR_GENERIC);
+		}
+	}
+
+	if (reverse) {
+		TRY(al_stream_init_file(&file, stdout, false, "<stdout>"));
+
+		if (compress) {
+			TRY(al_stream_init_compressed(&compressed, file, AL_OPEN_WRITE, false));
+		}
+
+		TRY(al_data_init(&data, compressed ? compressed : file));
+		al_data_set_sized_groups(data, sized);
+		al_data_set_checksums(data, checksums);
+		al_data_set_deduplicate(data, deduplicate);
+
+		input.file = stdin;
+		input.line = 1;
+		TRY(json_to_data(&input, data));
+		TRY(al_stream_flush(compressed ? compressed : file));
+
+	} else {
+		TRY(al_stream_init_file(&file, stdin, false, "<stdin>"));
+
+		if (compress) {
+			TRY(al_stream_init_compressed(&compressed, file, AL_OPEN_READ, false));
+		}
+
+		TRY(al_data_init(&data, compressed ? compressed : file));
+
+		output.file = stdout;
+		TRY(data_to_json(data, &output));
+	}
+
+	CATCH()
+	FINALLY({
+		al_data_free(data);
+		al_stream_free(compressed);
+		al_stream_free(file);
+		al_free(input.string.bytes);
+	})
+}
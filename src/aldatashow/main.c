@@ -5,9 +5,14 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
 
 #include "albase/data.h"
 
+static bool showSizes = false;
+
 static void print_indent(int n)
 {
 	for (int i = 0; i < n; i++) {
@@ -96,87 +101,469 @@ static size_t get_var_size(AlVarType type)
 		case AL_VAR_VEC3: return sizeof(Vec3);
 		case AL_VAR_VEC4: return sizeof(Vec4);
 		case AL_VAR_BOX2: return sizeof(Box2);
+		case AL_VAR_STRING: return sizeof(char *);
+		case AL_VAR_BLOB: return sizeof(AlBlob);
 		default: return 0;
 	}
 }
 
-static void print_array(AlDataItem item, int indent)
+typedef struct {
+	int indent;
+	bool first;
+	/** Items of the current array still to be printed */
+	uint64_t arrayRemaining;
+} Printer;
+
+static void print_separator(Printer *printer)
+{
+	if (printer->first) {
+		printer->first = false;
+	} else {
+		printf(" ");
+	}
+}
+
+static AlError print_start(void *context, uint64_t groupSize)
+{
+	Printer *printer = context;
+
+	if ((printer->indent == 0 && !printer->first) || printer->indent > 0) {
+		printf("\n");
+	}
+	print_indent(printer->indent);
+
+	printf("(");
+	if (showSizes && groupSize) {
+		printf("<%" PRIu64 "> ", groupSize);
+	}
+
+	printer->indent++;
+	printer->first = true;
+
+	return AL_NO_ERROR;
+}
+
+static AlError print_end(void *context)
+{
+	Printer *printer = context;
+
+	printf(")");
+	printer->indent--;
+	printer->first = false;
+
+	return AL_NO_ERROR;
+}
+
+static AlError print_tag_item(void *context, AlDataTag tag)
+{
+	print_separator(context);
+	print_tag(tag);
+
+	return AL_NO_ERROR;
+}
+
+static AlError print_value_item(void *context, AlVarType type, const void *value)
+{
+	print_separator(context);
+	print_value(type, (void *)value);
+
+	return AL_NO_ERROR;
+}
+
+static void print_array_end(Printer *printer)
+{
+	if (printer->arrayRemaining == 0) {
+		print_indent(printer->indent);
+		printf("}");
+	}
+}
+
+static AlError print_array_start(void *context, AlVarType type, uint64_t count)
 {
+	Printer *printer = context;
+
+	print_separator(printer);
 	printf("{\n");
-	void *items = item.value.array.items;
-	size_t itemSize = get_var_size(item.type);
-	for (uint64_t i = 0; i < item.value.array.length; i++) {
-		print_indent(indent + 1);
-		print_value(item.type, items);
+
+	printer->arrayRemaining = count;
+	print_array_end(printer);
+
+	return AL_NO_ERROR;
+}
+
+static AlError print_array_chunk(void *context, AlVarType type, const void *items, uint64_t count)
+{
+	Printer *printer = context;
+	const uint8_t *item = items;
+	size_t itemSize = get_var_size(type);
+
+	for (uint64_t i = 0; i < count; i++, item += itemSize) {
+		print_indent(printer->indent + 1);
+		print_value(type, (void *)item);
 		printf("\n");
-		items += itemSize;
 	}
-	print_indent(indent);
-	printf("}");
 
+	printer->arrayRemaining -= count;
+	print_array_end(printer);
+
+	return AL_NO_ERROR;
+}
+
+static AlError print_data(AlData *data)
+{
+	Printer printer = {0, true, 0};
+	AlDataHandler handler = {
+		.startGroup = print_start,
+		.endGroup = print_end,
+		.tag = print_tag_item,
+		.value = print_value_item,
+		.arrayStart = print_array_start,
+		.arrayChunk = print_array_chunk
+	};
+
+	return al_data_parse(data, &handler, &printer);
 }
 
-static AlError print_data(AlData *data, int indent)
+#define NUM_VAR_TYPES (AL_VAR_BLOB + 1)
+
+/** Stats for items outside of any group */
+#define TOP_LEVEL_STATS 0
+/** Stats for groups that don't start with a tag */
+#define UNTAGGED_STATS 1
+
+#define NO_STATS UINT32_MAX
+
+static const char *typeNames[NUM_VAR_TYPES] = {
+	"bool", "int", "double", "vec2", "vec3", "vec4", "box2", "string", "blob"
+};
+
+typedef struct {
+	/** Shown instead of the tag for the top level and untagged groups */
+	const char *name;
+	AlDataTag tag;
+	uint64_t groups;
+	/** Size of the groups, including everything nested in them */
+	uint64_t bytes;
+	/**
+	 * Bytes of group tokens, tags, type bytes and lengths directly in the
+	 * groups. Header and payload of all stats add up to the size of the data.
+	 */
+	uint64_t header;
+	/** Bytes of values and array items directly in the groups */
+	uint64_t payload;
+	uint64_t values[NUM_VAR_TYPES];
+	uint64_t arrays[NUM_VAR_TYPES];
+	uint64_t arrayItems[NUM_VAR_TYPES];
+	/** Payload bytes of each type, whether single values or arrays */
+	uint64_t typeBytes[NUM_VAR_TYPES];
+	/** References to earlier groups, which are counted as header */
+	uint64_t references;
+	uint64_t referenceBytes;
+	/** Size of the groups referred to */
+	uint64_t referredBytes;
+} TagStats;
+
+typedef struct {
+	uint64_t groups;
+	uint64_t values;
+	uint64_t bytes;
+} DepthStats;
+
+typedef struct {
+	uint32_t stats;
+	uint64_t offset;
+	/** Set until the item after the start token shows whether it has a tag */
+	bool tagPending;
+	uint64_t startBytes;
+} StatsFrame;
+
+typedef struct {
+	TagStats *tags;
+	size_t numTags;
+	size_t tagsLength;
+
+	/** Open addressed table of indices into tags, hashed by tag */
+	uint32_t *slots;
+	size_t slotMask;
+
+	StatsFrame *frames;
+	size_t numFrames;
+	size_t framesLength;
+
+	DepthStats *depths;
+	size_t depthsLength;
+} Stats;
+
+static size_t get_hash_slot(Stats *stats, AlDataTag tag)
+{
+	size_t slot = (tag * 0x9E3779B1u) & stats->slotMask;
+
+	while (stats->slots[slot] != NO_STATS && stats->tags[stats->slots[slot]].tag != tag) {
+		slot = (slot + 1) & stats->slotMask;
+	}
+
+	return slot;
+}
+
+static AlError grow_slots(Stats *stats)
 {
 	BEGIN()
 
-	AlDataItem item;
-	bool first = true;
+	size_t numSlots = stats->slots ? (stats->slotMask + 1) * 2 : 64;
+	TRY(al_realloc(&stats->slots, sizeof(uint32_t) * numSlots));
+	stats->slotMask = numSlots - 1;
+
+	for (size_t i = 0; i < numSlots; i++) {
+		stats->slots[i] = NO_STATS;
+	}
+
+	for (size_t i = 0; i < stats->numTags; i++) {
+		if (!stats->tags[i].name) {
+			stats->slots[get_hash_slot(stats, stats->tags[i].tag)] = i;
+		}
+	}
+
+	PASS()
+}
+
+static AlError add_stats(Stats *stats, const char *name, AlDataTag tag, uint32_t *result)
+{
+	BEGIN()
+
+	if (stats->numTags == stats->tagsLength) {
+		size_t length = stats->tagsLength ? stats->tagsLength * 2 : 32;
+		TRY(al_realloc(&stats->tags, sizeof(TagStats) * length));
+		stats->tagsLength = length;
+	}
+
+	TagStats *tagStats = &stats->tags[stats->numTags];
+	memset(tagStats, 0, sizeof(TagStats));
+	tagStats->name = name;
+	tagStats->tag = tag;
+
+	*result = stats->numTags++;
+
+	PASS()
+}
+
+static AlError find_stats(Stats *stats, AlDataTag tag, uint32_t *result)
+{
+	BEGIN()
+
+	if (!stats->slots || stats->numTags * 2 > stats->slotMask) {
+		TRY(grow_slots(stats));
+	}
+
+	size_t slot = get_hash_slot(stats, tag);
+
+	if (stats->slots[slot] == NO_STATS) {
+		TRY(add_stats(stats, NULL, tag, &stats->slots[slot]));
+	}
+
+	*result = stats->slots[slot];
+
+	PASS()
+}
+
+static AlError push_frame(Stats *stats, uint64_t offset, uint64_t startBytes)
+{
+	BEGIN()
+
+	if (stats->numFrames == stats->framesLength) {
+		size_t length = stats->framesLength ? stats->framesLength * 2 : 16;
+		TRY(al_realloc(&stats->frames, sizeof(StatsFrame) * length));
+		stats->framesLength = length;
+	}
+
+	stats->frames[stats->numFrames++] = (StatsFrame){
+		.stats = UNTAGGED_STATS,
+		.offset = offset,
+		.tagPending = true,
+		.startBytes = startBytes
+	};
+
+	PASS()
+}
+
+static AlError get_depth(Stats *stats, size_t depth, DepthStats **result)
+{
+	BEGIN()
+
+	if (depth >= stats->depthsLength) {
+		size_t length = stats->depthsLength ? stats->depthsLength * 2 : 16;
+		while (length <= depth) {
+			length *= 2;
+		}
+
+		TRY(al_realloc(&stats->depths, sizeof(DepthStats) * length));
+		memset(stats->depths + stats->depthsLength, 0, sizeof(DepthStats) * (length - stats->depthsLength));
+		stats->depthsLength = length;
+	}
+
+	*result = &stats->depths[depth];
+
+	PASS()
+}
+
+static AlError count_header(Stats *stats, uint32_t index, size_t depth, uint64_t bytes)
+{
+	BEGIN()
+
+	DepthStats *depthStats;
+	TRY(get_depth(stats, depth, &depthStats));
+
+	stats->tags[index].header += bytes;
+	depthStats->bytes += bytes;
+
+	PASS()
+}
+
+static int get_uint_size(uint64_t value)
+{
+	int size = 1;
+
+	while (value >>= 7) {
+		size++;
+	}
+
+	return size;
+}
+
+static AlError count_value(Stats *stats, uint32_t index, size_t depth, const AlDataItem *item, uint64_t bytes)
+{
+	BEGIN()
+
+	TagStats *tagStats = &stats->tags[index];
+	DepthStats *depthStats;
+	TRY(get_depth(stats, depth, &depthStats));
+
+	// Type byte, and the length of arrays, strings and blobs
+	uint64_t header = 1;
+
+	if (item->array) {
+		header += get_uint_size(item->value.array.length);
+		tagStats->arrays[item->type]++;
+		tagStats->arrayItems[item->type] += item->value.array.length;
+
+	} else {
+		if (item->type == AL_VAR_STRING) {
+			header += get_uint_size(item->value.string.length);
+		} else if (item->type == AL_VAR_BLOB) {
+			header += get_uint_size(item->value.blob.length);
+		}
+		tagStats->values[item->type]++;
+	}
+
+	tagStats->header += header;
+	tagStats->payload += bytes - header;
+	tagStats->typeBytes[item->type] += bytes - header;
+
+	depthStats->values++;
+	depthStats->bytes += bytes;
+
+	PASS()
+}
+
+static AlError count_reference(Stats *stats, uint32_t index, size_t depth, const AlDataItem *item, uint64_t bytes)
+{
+	BEGIN()
+
+	TagStats *tagStats = &stats->tags[index];
+
+	TRY(count_header(stats, index, depth, bytes));
+	tagStats->references++;
+	tagStats->referenceBytes += bytes;
+	tagStats->referredBytes += item->value.reference.size;
+
+	PASS()
+}
+
+/**
+ * The tag of a group is only known once the item after its start token has
+ * been read, so the start token is counted then.
+ */
+static AlError resolve_frame_tag(Stats *stats, const AlDataItem *item, uint64_t bytes, bool *used)
+{
+	BEGIN()
+
+	StatsFrame *frame = &stats->frames[stats->numFrames - 1];
+	uint64_t header = frame->startBytes;
+
+	frame->tagPending = false;
+	*used = (item->type == AL_TOKEN_TAG);
+
+	if (*used) {
+		TRY(find_stats(stats, item->value.tag, &frame->stats));
+		header += bytes;
+	}
+
+	TRY(count_header(stats, frame->stats, stats->numFrames - 1, header));
+
+	PASS()
+}
+
+static AlError collect_stats(Stats *stats, AlData *data)
+{
+	BEGIN()
+
+	uint32_t index;
+	TRY(add_stats(stats, "(top level)", AL_NO_TAG, &index));
+	TRY(add_stats(stats, "(untagged)", AL_NO_TAG, &index));
 
 	while (true) {
-		TRY(al_data_read(data, &item));
+		AlDataItem item;
+		uint64_t offset = al_data_get_offset(data);
+		TRY(al_data_skip_item(data, &item));
+		uint64_t bytes = al_data_get_offset(data) - offset;
+
+		if (item.type == AL_TOKEN_EOF) {
+			if (stats->numFrames > 0) {
+				al_log_error("unexpected end of data in group");
+				THROW(AL_ERROR_INVALID_DATA);
+			}
+			break;
+		}
 
-		switch (item.type) {
-			case AL_TOKEN_START:
-				if ((indent == 0 && !first) || indent > 0) {
-					printf("\n");
-				}
-				print_indent(indent);
+		if (stats->numFrames > 0 && stats->frames[stats->numFrames - 1].tagPending) {
+			bool used;
+			TRY(resolve_frame_tag(stats, &item, bytes, &used));
+			if (used) {
+				continue;
+			}
+		}
 
-				first = false;
+		size_t depth = stats->numFrames;
+		uint32_t current = depth ? stats->frames[depth - 1].stats : TOP_LEVEL_STATS;
 
-				printf("(");
-				print_data(data, indent + 1);
+		switch (item.type) {
+			case AL_TOKEN_START: {
+				DepthStats *depthStats;
+				TRY(get_depth(stats, depth, &depthStats));
+				depthStats->groups++;
+				TRY(push_frame(stats, offset, bytes));
 				break;
+			}
 
-			case AL_TOKEN_END:
-				printf(")");
-				RETURN();
-
-			case AL_TOKEN_EOF:
-				RETURN();
+			case AL_TOKEN_END: {
+				StatsFrame *frame = &stats->frames[depth - 1];
+				TagStats *tagStats = &stats->tags[frame->stats];
+				tagStats->groups++;
+				tagStats->bytes += offset + bytes - frame->offset;
+				TRY(count_header(stats, frame->stats, depth - 1, bytes));
+				stats->numFrames--;
+				break;
+			}
 
 			case AL_TOKEN_TAG:
-				if (first) {
-					first = false;
-				} else {
-					printf(" ");
-				}
+				TRY(count_header(stats, current, depth, bytes));
+				break;
 
-				print_tag(item.value.tag);
+			case AL_TOKEN_REFERENCE:
+				TRY(count_reference(stats, current, depth, &item, bytes));
 				break;
 
-			case AL_VAR_BOOL:
-			case AL_VAR_INT:
-			case AL_VAR_DOUBLE:
-			case AL_VAR_VEC2:
-			case AL_VAR_VEC3:
-			case AL_VAR_VEC4:
-			case AL_VAR_BOX2:
-			case AL_VAR_STRING:
-			case AL_VAR_BLOB:
-				if (first) {
-					first = false;
-				} else {
-					printf(" ");
-				}
-
-				if (!item.array) {
-					print_value(item.type, &item.value);
-
-				} else {
-					print_array(item, indent);
-				}
+			default:
+				TRY(count_value(stats, current, depth, &item, bytes));
 				break;
 		}
 	}
@@ -184,20 +571,193 @@ static AlError print_data(AlData *data, int indent)
 	PASS()
 }
 
+static int compare_stats(const void *a, const void *b)
+{
+	const TagStats *statsA = a;
+	const TagStats *statsB = b;
+	uint64_t bytesA = statsA->header + statsA->payload;
+	uint64_t bytesB = statsB->header + statsB->payload;
+
+	return (bytesA < bytesB) - (bytesA > bytesB);
+}
+
+static double get_percent(uint64_t bytes, uint64_t total)
+{
+	return total ? 100.0 * bytes / total : 0.0;
+}
+
+static void print_stats(Stats *stats)
+{
+	TagStats all = {"(all)", AL_NO_TAG};
+
+	for (size_t i = 0; i < stats->numTags; i++) {
+		TagStats *tagStats = &stats->tags[i];
+		all.groups += tagStats->groups;
+		all.header += tagStats->header;
+		all.payload += tagStats->payload;
+		for (int type = 0; type < NUM_VAR_TYPES; type++) {
+			all.values[type] += tagStats->values[type];
+			all.arrays[type] += tagStats->arrays[type];
+			all.arrayItems[type] += tagStats->arrayItems[type];
+			all.typeBytes[type] += tagStats->typeBytes[type];
+		}
+		all.references += tagStats->references;
+		all.referenceBytes += tagStats->referenceBytes;
+		all.referredBytes += tagStats->referredBytes;
+	}
+
+	uint64_t total = all.header + all.payload;
+	all.bytes = total;
+
+	qsort(stats->tags, stats->numTags, sizeof(TagStats), compare_stats);
+
+	printf("%-12s %12s %14s %14s %14s %7s\n", "tag", "groups", "bytes", "header", "payload", "own");
+
+	for (size_t i = 0; i <= stats->numTags; i++) {
+		TagStats *tagStats = (i < stats->numTags) ? &stats->tags[i] : &all;
+		uint64_t own = tagStats->header + tagStats->payload;
+
+		if (!own) {
+			continue;
+		}
+
+		if (tagStats == &all) {
+			printf("\n");
+		}
+
+		if (tagStats->name) {
+			printf("%-12s", tagStats->name);
+		} else {
+			print_tag(tagStats->tag);
+			printf("%8s", "");
+		}
+
+		printf(" %12" PRIu64 " %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %6.2f%%\n",
+			tagStats->groups, tagStats->bytes, tagStats->header, tagStats->payload,
+			get_percent(own, total));
+
+		for (int type = 0; type < NUM_VAR_TYPES; type++) {
+			if (!tagStats->values[type] && !tagStats->arrays[type]) {
+				continue;
+			}
+
+			printf("  %-10s %12s %14s %14s %14" PRIu64 " %6.2f%%  ",
+				typeNames[type], "", "", "", tagStats->typeBytes[type],
+				get_percent(tagStats->typeBytes[type], total));
+
+			if (tagStats->values[type]) {
+				printf("%" PRIu64 " values", tagStats->values[type]);
+			}
+			if (tagStats->arrays[type]) {
+				printf("%s%" PRIu64 " arrays of %" PRIu64 " items",
+					tagStats->values[type] ? ", " : "",
+					tagStats->arrays[type], tagStats->arrayItems[type]);
+			}
+			printf("\n");
+		}
+
+		if (tagStats->references) {
+			printf("  %-10s %12s %14s %14" PRIu64 " %14s %6.2f%%  %" PRIu64 " references to %" PRIu64 " bytes\n",
+				"references", "", "", tagStats->referenceBytes, "",
+				get_percent(tagStats->referenceBytes, total),
+				tagStats->references, tagStats->referredBytes);
+		}
+	}
+
+	printf("\n%-12s %12s %14s %14s\n", "depth", "groups", "values", "bytes");
+
+	for (size_t depth = 0; depth < stats->depthsLength; depth++) {
+		DepthStats *depthStats = &stats->depths[depth];
+
+		if (depthStats->groups || depthStats->values || depthStats->bytes) {
+			printf("%-12zu %12" PRIu64 " %14" PRIu64 " %14" PRIu64 "\n",
+				depth, depthStats->groups, depthStats->values, depthStats->bytes);
+		}
+	}
+}
+
+static AlError show_stats(AlData *data)
+{
+	BEGIN()
+
+	Stats stats = {NULL, 0, 0, NULL, 0, NULL, 0, 0, NULL, 0};
+
+	TRY(collect_stats(&stats, data));
+	print_stats(&stats);
+
+	PASS({
+		al_free(stats.tags);
+		al_free(stats.slots);
+		al_free(stats.frames);
+		al_free(stats.depths);
+	})
+}
+
+static AlError verify_data(AlData *data)
+{
+	BEGIN()
+
+	AlDataHandler handler = {NULL, NULL, NULL, NULL, NULL, NULL};
+	TRY(al_data_parse(data, &handler, NULL));
+
+	printf("ok\n");
+
+	PASS()
+}
+
 int main(int argc, char *argv[])
 {
 	BEGIN()
 
 	AlStream *file = NULL;
+	AlStream *compressed = NULL;
 	AlData *data = NULL;
+	bool decompress = false;
+	bool verify = false;
+	bool stats = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--sizes")) {
+			showSizes = true;
+		} else if (!strcmp(argv[i], "-z") || !strcmp(argv[i], "--compressed")) {
+			decompress = true;
+		} else if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verify")) {
+			verify = true;
+		} else if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--stats")) {
+			stats = true;
+		} else {
+			fprintf(stderr, "usage: %s [-s|--sizes] [-z|--compressed] [-v|--verify] [-t|--stats] < file\n", argv[0]);
+			THROW(AL_ERROR_GENERIC);
+		}
+	}
+
 	TRY(al_stream_init_file(&file, stdin, false, "<stdin>"));
-	TRY(al_data_init(&data, file));
-	TRY(print_data(data, 0));
-	printf("\n");
+
+	if (decompress) {
+		TRY(al_stream_init_compressed(&compressed, file, AL_OPEN_READ, false));
+	}
+
+	TRY(al_data_init(&data, compressed ? compressed : file));
+
+	if (stats) {
+		// Checksums are only checked when asked, to keep large files quick
+		al_data_set_verify(data, verify);
+		TRY(show_stats(data));
+
+	} else if (verify) {
+		TRY(verify_data(data));
+
+	} else {
+		// Show damaged files as far as they can be parsed
+		al_data_set_verify(data, false);
+		TRY(print_data(data));
+		printf("\n");
+	}
 
 	CATCH()
 	FINALLY({
 		al_data_free(data);
+		al_stream_free(compressed);
 		al_stream_free(file);
 	})
 }
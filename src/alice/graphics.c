@@ -270,11 +270,9 @@ static void render_model(AlModel *model, Vec2 location, double scale)
 	glVertexAttribPointer(modelShader.position, 2, GL_FLOAT, GL_FALSE, sizeof(AlGlModelVertex), (void *)offsetof(AlGlModelVertex, position));
 	glVertexAttribPointer(modelShader.param, 3, GL_FLOAT, GL_FALSE, sizeof(AlGlModelVertex), (void *)offsetof(AlGlModelVertex, param));
 
-	int start = 0;
 	for (int i = 0; i < model->numPaths; i++) {
 		algl_uniform_vec3(modelShader.colour, model->colours[i]);
-		glDrawArrays(GL_TRIANGLES, start, model->vertexCounts[i]);
-		start += model->vertexCounts[i];
+		glDrawArrays(GL_TRIANGLES, model->vertexStarts[i], model->vertexCounts[i]);
 	}
 
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
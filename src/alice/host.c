@@ -139,6 +139,7 @@ void al_host_free(AlHost *host)
 
 		al_widget_systems_free();
 		al_model_systems_free();
+		al_model_set_pack(NULL);
 
 		lua_close(host->lua);
 
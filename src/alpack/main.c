@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2014 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "albase/pack.h"
+
+static AlError list_pack(const char *filename)
+{
+	BEGIN()
+
+	AlPack *pack = NULL;
+	TRY(al_pack_open(&pack, filename));
+
+	for (size_t i = 0; i < al_pack_get_num_documents(pack); i++) {
+		const char *name = al_pack_get_name(pack, i);
+		AlStream *stream = NULL;
+
+		// Opening each document checks its checksum
+		TRY(al_pack_init_stream(pack, name, &stream));
+
+		AlMemStream *document = (AlMemStream *)stream;
+		printf("%zu %s\n", (size_t)((const char *)document->end - (const char *)document->ptr), name);
+
+		al_stream_free(stream);
+	}
+
+	PASS({
+		al_pack_free(pack);
+	})
+}
+
+static AlError write_pack(const char *filename, int numDocuments, char **names)
+{
+	BEGIN()
+
+	AlStream **files = NULL;
+	AlBlob *documents = NULL;
+	AlStream *output = NULL;
+
+	TRY(al_malloc(&files, sizeof(AlStream *) * numDocuments));
+
+	for (int i = 0; i < numDocuments; i++) {
+		files[i] = NULL;
+	}
+
+	TRY(al_malloc(&documents, sizeof(AlBlob) * numDocuments));
+
+	for (int i = 0; i < numDocuments; i++) {
+		TRY(al_stream_init_mmap(&files[i], names[i]));
+
+		AlMemStream *mapped = (AlMemStream *)files[i];
+		documents[i].bytes = (uint8_t *)mapped->ptr;
+		documents[i].length = (const uint8_t *)mapped->end - (const uint8_t *)mapped->ptr;
+	}
+
+	TRY(al_stream_init_filename(&output, filename, AL_OPEN_WRITE));
+	TRY(al_pack_write(output, (const char *const *)names, documents, numDocuments));
+	TRY(al_stream_flush(output));
+
+	PASS({
+		al_stream_free(output);
+
+		if (files) {
+			for (int i = 0; i < numDocuments; i++) {
+				al_stream_free(files[i]);
+			}
+		}
+
+		al_free(files);
+		al_free(documents);
+	})
+}
+
+int main(int argc, char *argv[])
+{
+	BEGIN()
+
+	if (argc == 3 && (!strcmp(argv[1], "-l") || !strcmp(argv[1], "--list"))) {
+		TRY(list_pack(argv[2]));
+
+	} else if (argc >= 3 && (!strcmp(argv[1], "-o") || !strcmp(argv[1], "--output"))) {
+		TRY(write_pack(argv[2], argc - 3, argv + 3));
+
+	} else {
+		fprintf(stderr, "usage: %s -o|--output pack files...\n", argv[0]);
+		fprintf(stderr, "       %s -l|--list pack\n", argv[0]);
+		THROW(AL_ERROR_GENERIC);
+	}
+
+	PASS()
+}